@@ -0,0 +1,1623 @@
+#include "EventLoop.hpp"
+#include "JackTransportLink.hpp"
+#include "Journal.hpp"
+#include "LinkSession.hpp"
+#include "OscSockets.hpp"
+#include "PhaseCV.hpp"
+#include "SimBackend.hpp"
+#include "TempoMap.hpp"
+#include "TimelineWriter.hpp"
+
+#include <OptionParser.h>
+#include <osc/OscOutboundPacketStream.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Microbenchmarks for the realtime code paths, results are written to stdout
+// as csv or json lines so that runs can be compared.
+
+namespace {
+
+const std::vector<jack_nframes_t> bench_nframes = {16,  32,   64,   128, 256,
+                                                   512, 1024, 2048, 4096};
+const std::vector<double> bench_bpms = {20.0, 60.0, 120.0, 180.0, 300.0, 999.0};
+const std::vector<double> bench_ticks_per_beat = {192.0, 960.0, 1920.0};
+
+typedef std::vector<std::pair<std::string, double>> Params;
+
+class Report {
+public:
+  Report(bool json) : mJSON(json) {
+    if (!mJSON) {
+      std::cout << "suite,case,params,samples,mean_ns,p50_ns,p99_ns,max_ns"
+                << std::endl;
+    }
+  }
+
+  // summarize and write out the samples, in nanoseconds
+  void add(const std::string &suite, const std::string &name,
+           const Params &params, std::vector<double> &samples) {
+    if (samples.empty()) {
+      return;
+    }
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (auto s : samples) {
+      sum += s;
+    }
+    const size_t n = samples.size();
+    double mean = sum / static_cast<double>(n);
+    double p50 = samples[n / 2];
+    double p99 = samples[std::min(n - 1, (n * 99) / 100)];
+    double max = samples.back();
+
+    std::stringstream out;
+    if (mJSON) {
+      out << "{\"suite\":\"" << suite << "\",\"case\":\"" << name
+          << "\",\"params\":{";
+      for (size_t i = 0; i < params.size(); i++) {
+        out << (i == 0 ? "" : ",") << "\"" << params[i].first
+            << "\":" << params[i].second;
+      }
+      out << "},\"samples\":" << n << ",\"mean_ns\":" << mean
+          << ",\"p50_ns\":" << p50 << ",\"p99_ns\":" << p99
+          << ",\"max_ns\":" << max << "}";
+    } else {
+      out << suite << "," << name << ",";
+      for (size_t i = 0; i < params.size(); i++) {
+        out << (i == 0 ? "" : " ") << params[i].first << "="
+            << params[i].second;
+      }
+      out << "," << n << "," << mean << "," << p50 << "," << p99 << ","
+          << max;
+    }
+    std::cout << out.str() << std::endl;
+  }
+
+private:
+  bool mJSON;
+};
+
+// how the bridges under test start, with link disabled so that nothing goes
+// out on the network
+JackTransportLink::Settings benchSettings(double bpm) {
+  JackTransportLink::Settings settings;
+  settings.initialBPM = bpm;
+  settings.enableLink = false;
+  return settings;
+}
+
+// processCallback and timeBaseCallback, per cycle, with the MIDI clock running
+void benchCallbacks(Report &report, jack_nframes_t sampleRate, size_t cycles) {
+  const double sr = static_cast<double>(sampleRate);
+  std::vector<double> process, timebase;
+  process.reserve(cycles);
+  timebase.reserve(cycles);
+
+  for (auto nframes : bench_nframes) {
+    for (auto bpm : bench_bpms) {
+      for (auto tpb : bench_ticks_per_beat) {
+        auto backend = std::make_unique<SimBackend>(sampleRate, nframes);
+        SimBackend *sim = backend.get();
+        auto settings = benchSettings(bpm);
+        settings.initialTicksPerBeat = tpb;
+        JackTransportLink j(std::move(backend), settings);
+
+        // roll for a couple of bars so the midi clock is running
+        sim->transportStart();
+        const auto warmup =
+            static_cast<uint64_t>(3.0 * 4.0 * 60.0 * sr / bpm);
+        while (sim->frameTime() < warmup) {
+          sim->cycle();
+        }
+
+        process.clear();
+        timebase.clear();
+        sim->setMeasureCallbacks(true);
+        for (size_t i = 0; i < cycles; i++) {
+          sim->cycle();
+          process.push_back(static_cast<double>(sim->lastProcessNanos()));
+          timebase.push_back(static_cast<double>(sim->lastTimeBaseNanos()));
+        }
+
+        Params params = {{"nframes", nframes},
+                         {"bpm", bpm},
+                         {"ticks_per_beat", tpb},
+                         {"sample_rate", sr}};
+        report.add("callbacks", "processCallback", params, process);
+        report.add("callbacks", "timeBaseCallback", params, timebase);
+      }
+    }
+  }
+}
+
+// updateBBT, stepping a clock at a time, each sample is the mean of a batch
+void benchUpdateBBT(Report &report, size_t cycles) {
+  using std::chrono::steady_clock;
+  const size_t batch = 1000;
+  std::vector<double> samples;
+  samples.reserve(cycles);
+  volatile int32_t sink = 0;
+
+  for (auto tpb : bench_ticks_per_beat) {
+    const double ticksPerClock = tpb / 24.0;
+    int32_t bar = 0, beat = 0;
+    double tick = 0.0;
+    samples.clear();
+    for (size_t i = 0; i < cycles; i++) {
+      auto start = steady_clock::now();
+      for (size_t b = 0; b < batch; b++) {
+        tick += ticksPerClock;
+        updateBBT(bar, beat, tick, tpb, 4);
+      }
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    steady_clock::now() - start)
+                    .count();
+      samples.push_back(static_cast<double>(ns) / static_cast<double>(batch));
+      sink = bar;
+    }
+    report.add("bbt", "updateBBT", {{"ticks_per_beat", tpb}}, samples);
+  }
+  (void)sink;
+}
+
+// PhaseCV::process with every output connected, each sample is the mean of a
+// batch of cycles
+void benchPhaseCV(Report &report, jack_nframes_t sampleRate, size_t cycles) {
+  using std::chrono::steady_clock;
+  const size_t batch = 100;
+  const double sr = static_cast<double>(sampleRate);
+  const double bpm = 120.0;
+  std::vector<double> samples;
+  samples.reserve(cycles);
+  PhaseCV cv(4);
+
+  for (auto nframes : bench_nframes) {
+    std::vector<float> buffers(4 * nframes);
+    PhaseCV::Outputs outputs;
+    outputs.beatPhase = buffers.data();
+    outputs.barPhase = buffers.data() + nframes;
+    outputs.gate = buffers.data() + 2 * nframes;
+    outputs.trigger = buffers.data() + 3 * nframes;
+    const double cycleBeats = static_cast<double>(nframes) * bpm / (60.0 * sr);
+    double beat = 0.0;
+    samples.clear();
+    for (size_t i = 0; i < cycles; i++) {
+      auto start = steady_clock::now();
+      for (size_t b = 0; b < batch; b++) {
+        cv.process(outputs, nframes, sr, beat, bpm, 4.0, true);
+        beat += cycleBeats;
+      }
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    steady_clock::now() - start)
+                    .count();
+      samples.push_back(static_cast<double>(ns) / static_cast<double>(batch));
+    }
+    report.add("cv", "PhaseCV::process",
+               {{"nframes", nframes}, {"sample_rate", sr}}, samples);
+  }
+}
+
+// the beat phase ramp against link's beatAtTime at the time of every sample,
+// over cycles cycles at each tempo. link keeps beats in millionths at
+// microsecond times, the start of the cycle and the sample can each be half a
+// microsecond out, that and the float output make up the tolerance. returns
+// false if any sample is outside it
+bool checkPhaseCV(jack_nframes_t sampleRate, size_t cycles) {
+  const double sr = static_cast<double>(sampleRate);
+  const jack_nframes_t nframes = 256;
+  const double quantum = 4.0;
+  std::vector<float> out(nframes);
+  bool ok = true;
+
+  for (auto bpm : bench_bpms) {
+    ableton::Link link(bpm);
+    auto state = link.captureAppSessionState();
+    const auto origin = link.clock().micros();
+    // somewhere that isn't a whole beat, in the middle of the session
+    state.forceBeatAtTime(1000.3, origin, quantum);
+    auto timeAt = [&](uint64_t frame) {
+      return origin + std::chrono::microseconds(std::llround(
+                          static_cast<double>(frame) * 1e6 / sr));
+    };
+
+    const double step = bpm / (60.0 * sr);
+    const double tolerance = 2e-6 + 1e-6 * bpm / 60.0 + 1e-6;
+    double maxError = 0.0;
+    for (size_t c = 0; c < cycles; c++) {
+      const uint64_t frame = c * nframes;
+      PhaseCV::ramp(out.data(), nframes,
+                    state.beatAtTime(timeAt(frame), quantum), step);
+      for (jack_nframes_t i = 0; i < nframes; i++) {
+        double expected = state.beatAtTime(timeAt(frame + i), quantum);
+        double error = static_cast<double>(out[i]) -
+                       (expected - std::floor(expected));
+        // a sample right on the wrap can land either side of it
+        error -= std::round(error);
+        maxError = std::max(maxError, std::abs(error));
+      }
+    }
+    std::cerr << "phase cv bpm " << bpm << " max error " << maxError
+              << " beats, " << maxError / step << " samples" << std::endl;
+    if (maxError > tolerance) {
+      std::cerr << "phase cv bpm " << bpm << " is outside the tolerance of "
+                << tolerance << " beats" << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// hand j a bundle of one message with a double, tagged for time on link's
+// clock
+void sendTimed(JackTransportLink &j, ableton::Link &link,
+               std::chrono::microseconds time, const char *address,
+               double value) {
+  int64_t unixMicros =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count() +
+      (time - link.clock().micros()).count();
+  uint64_t seconds = static_cast<uint64_t>(unixMicros / 1000000) + 2208988800;
+  uint64_t fraction =
+      (static_cast<uint64_t>(unixMicros % 1000000) << 32) / 1000000;
+  char buffer[256];
+  oscpack::OutboundPacketStream packet(buffer, sizeof(buffer));
+  packet << oscpack::BeginBundle((seconds << 32) | fraction)
+         << oscpack::BeginMessage(address) << value << oscpack::EndMessage
+         << oscpack::EndBundle;
+  j.ProcessPacket(packet.Data(), static_cast<int>(packet.Size()),
+                  oscpack::IpEndpointName());
+}
+
+// processCallback with time tagged osc events waiting, far in the future so
+// they are looked at every cycle but never applied
+void benchSchedule(Report &report, jack_nframes_t sampleRate, size_t cycles) {
+  const double sr = static_cast<double>(sampleRate);
+  std::vector<double> process;
+  process.reserve(cycles);
+  for (int pending : {0, 16, 63}) {
+    auto session = std::make_shared<LinkSession>(120.0, true, false);
+    auto backend = std::make_unique<SimBackend>(sampleRate, 256);
+    SimBackend *sim = backend.get();
+    JackTransportLink j(std::move(backend), benchSettings(120.0), session);
+    sim->transportStart();
+    for (int i = 0; i < pending; i++) {
+      sendTimed(j, session->link(),
+                session->link().clock().micros() + std::chrono::hours(1),
+                "/jacklink/bpm", 100.0 + i);
+    }
+    while (sim->frameTime() < sampleRate) {
+      sim->cycle();
+    }
+
+    process.clear();
+    sim->setMeasureCallbacks(true);
+    for (size_t i = 0; i < cycles; i++) {
+      sim->cycle();
+      process.push_back(static_cast<double>(sim->lastProcessNanos()));
+    }
+    report.add("osc", "processCallback",
+               {{"pending", pending}, {"sample_rate", sr}}, process);
+  }
+}
+
+// a tempo change in a time tagged bundle, on a frame that isn't the start of
+// a cycle, synced to link and free running. Where it landed is worked out
+// from the beats either side of it, returns false if that is more than a
+// frame from the tag
+bool checkOscSchedule(jack_nframes_t sampleRate) {
+  const double sr = static_cast<double>(sampleRate);
+  const jack_nframes_t nframes = 256;
+  const double from = 120.0;
+  const double to = 157.3;
+  bool ok = true;
+
+  for (bool sync : {true, false}) {
+    auto session = std::make_shared<LinkSession>(from, true, false);
+    auto backend = std::make_unique<SimBackend>(sampleRate, nframes);
+    SimBackend *sim = backend.get();
+    JackTransportLink j(std::move(backend), benchSettings(from), session);
+    j.setSyncLink(sync);
+    sim->transportStart();
+    while (sim->frameTime() < sampleRate) {
+      sim->cycle();
+    }
+
+    // the host time of a frame. Between cycles the frame is the next
+    // cycle's, which starts at the next usecs
+    jack_nframes_t nextFrame;
+    jack_time_t cycleUsecs, nextUsecs;
+    float periodUsecs;
+    sim->getCycleTimes(&nextFrame, &cycleUsecs, &nextUsecs, &periodUsecs);
+    auto timeAt = [&](double frame) {
+      return std::chrono::microseconds(
+          static_cast<int64_t>(nextUsecs) +
+          std::llround((frame - static_cast<double>(nextFrame)) * 1e6 / sr));
+    };
+
+    const double changeFrame =
+        static_cast<double>(sim->frameTime() + 10 * nframes + 101);
+    sendTimed(j, session->link(), timeAt(changeFrame), "/jacklink/bpm", to);
+    // link only keeps the current tempo, take the beat before the change
+    // from the session before it
+    auto before = session->link().captureAppSessionState();
+
+    // free running, a cycle's snapshot has the beat the timebase callback
+    // rolled on to, at the start of the next cycle
+    double beforeFrame = 0.0, beforeBeat = 0.0;
+    double afterFrame = 0.0, afterBeat = 0.0;
+    while (static_cast<double>(sim->frameTime()) < changeFrame + sr) {
+      sim->cycle();
+      double frame = static_cast<double>(sim->frameTime());
+      if (frame < changeFrame - static_cast<double>(nframes)) {
+        beforeFrame = frame;
+        beforeBeat = j.snapshot().beat;
+      }
+      afterFrame = frame;
+      afterBeat = j.snapshot().beat;
+    }
+    if (sync) {
+      auto after = session->link().captureAppSessionState();
+      beforeFrame = changeFrame - sr / 2.0;
+      afterFrame = changeFrame + sr / 2.0;
+      beforeBeat = before.beatAtTime(timeAt(beforeFrame), 4.0);
+      afterBeat = after.beatAtTime(timeAt(afterFrame), 4.0);
+    }
+
+    // beats = (landed - before) * from + (after - landed) * to, per frame
+    const double perFrameFrom = from / (60.0 * sr);
+    const double perFrameTo = to / (60.0 * sr);
+    double landed = (afterBeat - beforeBeat - afterFrame * perFrameTo +
+                     beforeFrame * perFrameFrom) /
+                    (perFrameFrom - perFrameTo);
+    double error = landed - changeFrame;
+    std::cerr << "osc schedule " << (sync ? "link" : "free running")
+              << " tempo change landed " << error << " frames from its tag"
+              << std::endl;
+    if (!(std::abs(error) <= 1.0)) {
+      std::cerr << "osc schedule " << (sync ? "link" : "free running")
+                << " is more than a frame out" << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// synced to link, a tagged tempo change then a locate to a beat after it.
+// The locate must land on the frame jack clients were given that beat at,
+// which takes the tempo map having the change on the frame it was played.
+// Returns false if it is more than a frame out
+bool checkOscScheduleLocate(jack_nframes_t sampleRate) {
+  const double sr = static_cast<double>(sampleRate);
+  const jack_nframes_t nframes = 256;
+  const double from = 120.0;
+  const double to = 157.3;
+
+  auto session = std::make_shared<LinkSession>(from, true, false);
+  auto backend = std::make_unique<SimBackend>(sampleRate, nframes);
+  SimBackend *sim = backend.get();
+  JackTransportLink j(std::move(backend), benchSettings(from), session);
+  sim->transportStart();
+  while (sim->frameTime() < sampleRate) {
+    sim->cycle();
+  }
+  jack_nframes_t nextFrame;
+  jack_time_t cycleUsecs, nextUsecs;
+  float periodUsecs;
+  sim->getCycleTimes(&nextFrame, &cycleUsecs, &nextUsecs, &periodUsecs);
+  const double changeFrame =
+      static_cast<double>(sim->frameTime() + 10 * nframes + 101);
+  sendTimed(j, session->link(),
+            std::chrono::microseconds(
+                static_cast<int64_t>(nextUsecs) +
+                std::llround((changeFrame - static_cast<double>(nextFrame)) *
+                             1e6 / sr)),
+            "/jacklink/bpm", to);
+
+  // the transport frame of each cycle and the beat the clients got for it
+  std::vector<std::pair<double, double>> played;
+  while (sim->frameTime() < 3 * sampleRate) {
+    double frame = static_cast<double>(sim->position().frame);
+    sim->cycle();
+    played.emplace_back(frame, j.snapshot().beat);
+  }
+
+  const double beat = played.back().second - 2.0;
+  auto after = std::find_if(played.begin(), played.end(),
+                            [beat](const std::pair<double, double> &p) {
+                              return p.second > beat;
+                            });
+  auto before = after - 1;
+  const double expected = before->first + (beat - before->second) *
+                                              (after->first - before->first) /
+                                              (after->second - before->second);
+
+  std::array<char, 128> buffer;
+  oscpack::OutboundPacketStream p(buffer.data(), buffer.size());
+  p << oscpack::BeginMessage("/jacklink/beattime") << beat
+    << oscpack::EndMessage;
+  j.ProcessPacket(p.Data(), static_cast<int>(p.Size()),
+                  oscpack::IpEndpointName());
+  sim->cycle();
+  double located = static_cast<double>(sim->position().frame);
+  std::cerr << "osc schedule link locate after the tempo change landed "
+            << located - expected << " frames from where its beat was played"
+            << std::endl;
+  if (!(std::abs(located - expected) <= 1.0)) {
+    std::cerr << "osc schedule link locate is more than a frame out"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+enum class Transport { UDP, Unix, TCP };
+
+const char *transport_name(Transport t) {
+  switch (t) {
+  case Transport::UDP:
+    return "udp";
+  case Transport::Unix:
+    return "unix";
+  case Transport::TCP:
+    return "tcp";
+  }
+  return "";
+}
+
+int64_t steady_nanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// records how long each message took to get here, the load generator sends
+// the time it sent it as the first argument
+class LatencyListener : public oscpack::OscPacketListener {
+public:
+  std::vector<double> latencies;
+
+protected:
+  void ProcessMessage(const oscpack::ReceivedMessage &m,
+                      const oscpack::IpEndpointName &) override {
+    auto arg = m.ArgumentsBegin();
+    if (arg != m.ArgumentsEnd() && arg->IsInt64()) {
+      latencies.push_back(
+          static_cast<double>(steady_nanos() - arg->AsInt64Unchecked()));
+    }
+  }
+};
+
+struct TransportRun {
+  // nanoseconds from send to dispatch, of the messages that arrived
+  std::vector<double> latencies;
+  // from the first send to the last arrival
+  double perSecond = 0.0;
+};
+
+// a load generator thread sending messages to our listener over transport,
+// at rate messages a second or, for 0, flat out. The listener is read from
+// an event loop on this thread like the service does
+TransportRun runTransport(Transport transport, double rate, size_t messages) {
+  TransportRun run;
+  LatencyListener listener;
+  listener.latencies.reserve(messages);
+  EventLoop loop;
+
+  std::unique_ptr<OscUnixSocket> unixSocket;
+  std::unique_ptr<OscStreamServer> stream;
+  int udp = -1;
+  int fd = -1;
+  sockaddr_in local = {};
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  switch (transport) {
+  case Transport::UDP: {
+    udp = openOscUdpSocket(0);
+    socklen_t len = sizeof(local);
+    if (udp < 0 ||
+        getsockname(udp, reinterpret_cast<sockaddr *>(&local), &len) != 0) {
+      break;
+    }
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    loop.add(udp, [&]() { readOscDatagrams(udp, listener); });
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    connect(fd, reinterpret_cast<sockaddr *>(&local), sizeof(local));
+  } break;
+  case Transport::Unix: {
+    std::string path =
+        "/tmp/jack_transport_link_bench." + std::to_string(getpid());
+    unixSocket = std::make_unique<OscUnixSocket>(path);
+    if (unixSocket->fd() < 0) {
+      break;
+    }
+    int rfd = unixSocket->fd();
+    loop.add(rfd, [&, rfd]() { readOscDatagrams(rfd, listener); });
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path.c_str());
+    fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  } break;
+  case Transport::TCP: {
+    stream = std::make_unique<OscStreamServer>(loop, listener, 0);
+    if (!stream->isOpen()) {
+      break;
+    }
+    local.sin_port = htons(static_cast<uint16_t>(stream->port()));
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    connect(fd, reinterpret_cast<sockaddr *>(&local), sizeof(local));
+  } break;
+  }
+  if (fd < 0) {
+    std::cerr << "osc transport " << transport_name(transport)
+              << " couldn't be set up" << std::endl;
+    if (udp >= 0) {
+      close(udp);
+    }
+    return run;
+  }
+
+  std::atomic<bool> sent = false;
+  auto start = std::chrono::steady_clock::now();
+  std::thread generator([&]() {
+    std::array<char, 64> buffer;
+    std::vector<char> framed;
+    framed.reserve(2 * buffer.size());
+    for (size_t i = 0; i < messages; i++) {
+      if (rate > 0.0) {
+        std::this_thread::sleep_until(
+            start + std::chrono::nanoseconds(static_cast<int64_t>(
+                        static_cast<double>(i) * 1e9 / rate)));
+      }
+      oscpack::OutboundPacketStream p(buffer.data(), buffer.size());
+      p << oscpack::BeginMessage("/jacklink/bench")
+        << static_cast<oscpack::int64>(steady_nanos())
+        << oscpack::EndMessage;
+      if (transport != Transport::TCP) {
+        // a full udp buffer drops it, a full unix one blocks
+        send(fd, p.Data(), p.Size(), 0);
+        continue;
+      }
+      framed.clear();
+      SlipDecoder::encode(p.Data(), p.Size(), framed);
+      for (size_t off = 0; off < framed.size();) {
+        ssize_t n = send(fd, framed.data() + off, framed.size() - off, 0);
+        if (n <= 0) {
+          break;
+        }
+        off += static_cast<size_t>(n);
+      }
+    }
+    sent = true;
+  });
+
+  // until everything has arrived or, once it has all been sent, nothing
+  // more does for a while
+  auto last = std::chrono::steady_clock::now();
+  size_t seen = 0;
+  while (listener.latencies.size() < messages) {
+    loop.runOnce(50);
+    auto now = std::chrono::steady_clock::now();
+    if (listener.latencies.size() != seen) {
+      seen = listener.latencies.size();
+      last = now;
+    } else if (sent && now - last > std::chrono::milliseconds(250)) {
+      break;
+    }
+  }
+  generator.join();
+  close(fd);
+  stream.reset();
+  if (udp >= 0) {
+    close(udp);
+  }
+
+  double seconds = std::chrono::duration<double>(last - start).count();
+  run.latencies = std::move(listener.latencies);
+  run.perSecond =
+      seconds > 0.0 ? static_cast<double>(run.latencies.size()) / seconds
+                    : 0.0;
+  return run;
+}
+
+// the listeners fed by a local load generator at a couple of rates and flat
+// out. Each sample is one message's time from send to dispatch, a udp run
+// that fell behind shows how many it dropped in received
+void benchOscTransport(Report &report, size_t messages) {
+  for (auto transport : {Transport::UDP, Transport::Unix, Transport::TCP}) {
+    for (double rate : {20000.0, 50000.0, 0.0}) {
+      auto run = runTransport(transport, rate, messages);
+      report.add("transport", transport_name(transport),
+                 {{"rate", rate},
+                  {"messages", static_cast<double>(messages)},
+                  {"received", static_cast<double>(run.latencies.size())},
+                  {"per_second", run.perSecond}},
+                 run.latencies);
+    }
+  }
+}
+
+// slip framing of packets full of the bytes it escapes, then the unix domain
+// and tcp listeners flat out, which unlike udp must not lose anything.
+// returns false if any of it goes wrong
+bool checkOscTransport(size_t messages) {
+  bool ok = true;
+  std::vector<std::vector<char>> packets = {
+      {'\xC0'}, {'\xDB'}, {'\xDB', '\xDC'}, {'\xC0', '\xDB', '\xDD', 'a'}};
+  std::vector<char> stream;
+  for (auto &p : packets) {
+    SlipDecoder::encode(p.data(), p.size(), stream);
+  }
+  std::vector<std::vector<char>> decoded;
+  SlipDecoder decoder;
+  // a byte at a time, as a stream might arrive
+  for (char c : stream) {
+    decoder.feed(&c, 1, [&](const char *data, size_t size) {
+      decoded.emplace_back(data, data + size);
+    });
+  }
+  if (decoded != packets) {
+    std::cerr << "osc transport slip framing doesn't round trip" << std::endl;
+    ok = false;
+  }
+
+  for (auto transport : {Transport::Unix, Transport::TCP}) {
+    auto run = runTransport(transport, 0.0, messages);
+    if (run.latencies.size() != messages) {
+      std::cerr << "osc transport " << transport_name(transport) << " lost "
+                << messages - run.latencies.size() << " of " << messages
+                << " messages" << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// a tempo map of segments changes, each a few cycles long at a tempo between
+// 20 and 300, like a link session being dragged around. end is the frame of
+// the last change and bpm its tempo
+TempoMap make_tempo_map(size_t segments, double sampleRate, double &end,
+                        double &bpm) {
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<double> bpms(20.0, 300.0);
+  std::uniform_int_distribution<int> lengths(256, 4096);
+  // room to spare, a map filling up starts merging
+  TempoMap map(segments * 2);
+  bpm = bpms(gen);
+  map.reset(sampleRate, bpm);
+  end = 0.0;
+  while (map.size() < segments) {
+    end += lengths(gen);
+    bpm = bpms(gen);
+    map.record(end, bpm);
+  }
+  return map;
+}
+
+// TempoMap lookups both ways at random points, and record rolling on past
+// the last change as the timebase callback does every cycle, with up to 100k
+// segments. Each sample is the mean of a batch
+void benchTempoMap(Report &report, size_t cycles) {
+  using std::chrono::steady_clock;
+  const size_t batch = 1000;
+  std::vector<double> beatAt, frameAt, record;
+  beatAt.reserve(cycles);
+  frameAt.reserve(cycles);
+  record.reserve(cycles);
+  std::vector<double> at(batch);
+  volatile double sink = 0.0;
+
+  for (size_t segments : {1000, 10000, 100000}) {
+    double end, bpm;
+    TempoMap map = make_tempo_map(segments, 48000.0, end, bpm);
+    std::mt19937 gen(2);
+    std::uniform_real_distribution<double> frames(0.0, end);
+    std::uniform_real_distribution<double> beats(0.0, map.beatAt(end));
+    auto time = [&](std::vector<double> &samples, auto &&lookup) {
+      auto start = steady_clock::now();
+      double acc = 0.0;
+      for (auto x : at) {
+        acc += lookup(x);
+      }
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    steady_clock::now() - start)
+                    .count();
+      samples.push_back(static_cast<double>(ns) / static_cast<double>(batch));
+      sink = acc;
+    };
+
+    beatAt.clear();
+    frameAt.clear();
+    record.clear();
+    for (size_t i = 0; i < cycles; i++) {
+      for (auto &x : at) {
+        x = frames(gen);
+      }
+      time(beatAt, [&](double f) { return map.beatAt(f); });
+      for (auto &x : at) {
+        x = beats(gen);
+      }
+      time(frameAt, [&](double b) { return map.frameAt(b); });
+      for (auto &x : at) {
+        end += 256.0;
+        x = end;
+      }
+      time(record, [&](double f) { return map.record(f, bpm) ? 1.0 : 0.0; });
+    }
+
+    Params params = {{"segments", static_cast<double>(segments)}};
+    report.add("tempomap", "beatAt", params, beatAt);
+    report.add("tempomap", "frameAt", params, frameAt);
+    report.add("tempomap", "record", params, record);
+  }
+  (void)sink;
+}
+
+// TempoMap against summing the segments one by one, and after a locate back
+// at the tempo it was rolling at, then a free running transport that changes
+// tempo part way and is located by osc to a beat after the change, then one
+// before it. Each locate must land on the frame that beat was played at,
+// returns false if any of it is out
+bool checkTempoMap(jack_nframes_t sampleRate) {
+  const double sr = static_cast<double>(sampleRate);
+  bool ok = true;
+
+  double end, bpm;
+  TempoMap map = make_tempo_map(10000, sr, end, bpm);
+  // the segments back out of the map, a change at every frame it reports
+  // a different tempo from
+  std::vector<std::pair<double, double>> segments;
+  {
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> bpms(20.0, 300.0);
+    std::uniform_int_distribution<int> lengths(256, 4096);
+    double frame = 0.0;
+    segments.emplace_back(frame, bpms(gen));
+    while (segments.size() < map.size()) {
+      frame += lengths(gen);
+      segments.emplace_back(frame, bpms(gen));
+    }
+  }
+  std::mt19937 gen(3);
+  std::uniform_real_distribution<double> frames(0.0, end * 1.1);
+  double worstBeat = 0.0, worstFrame = 0.0;
+  for (int i = 0; i < 2000; i++) {
+    double frame = frames(gen);
+    double beat = 0.0;
+    for (size_t s = 0; s < segments.size(); s++) {
+      double next = s + 1 < segments.size() ? segments[s + 1].first : frame;
+      double upto = std::min(next, frame);
+      if (upto > segments[s].first) {
+        beat += (upto - segments[s].first) * segments[s].second / (60.0 * sr);
+      }
+    }
+    worstBeat = std::max(worstBeat, std::abs(map.beatAt(frame) - beat));
+    worstFrame = std::max(worstFrame, std::abs(map.frameAt(beat) - frame));
+  }
+  std::cerr << "tempo map max error " << worstBeat << " beats, " << worstFrame
+            << " frames" << std::endl;
+  if (!(worstBeat < 1e-6 && worstFrame < 1e-3)) {
+    std::cerr << "tempo map lookups are out" << std::endl;
+    ok = false;
+  }
+
+  // a locate back into a stretch at the tempo still rolling, then on past
+  // where the old changes were, they must be gone
+  {
+    TempoMap back(16);
+    back.reset(sr, 120.0);
+    back.record(sr, 90.0);
+    back.record(2.0 * sr, 120.0);
+    back.record(0.5 * sr, 120.0);
+    double frame = 3.0 * sr;
+    double error = std::abs(back.beatAt(frame) - 6.0);
+    std::cerr << "tempo map after a locate back is " << error
+              << " beats out, " << back.size() << " segments" << std::endl;
+    if (!(error < 1e-9) || back.size() != 1) {
+      std::cerr << "tempo map kept changes from before a locate back"
+                << std::endl;
+      ok = false;
+    }
+  }
+
+  // a tempo dragged a little every cycle, many times over what a small map
+  // holds. Nothing is dropped, seeks past the last change are exact and the
+  // merged history stays close to what was played
+  {
+    const size_t capacity = 1024;
+    TempoMap full(capacity);
+    full.reset(sr, 120.0);
+    std::vector<std::pair<double, double>> played = {{0.0, 0.0}};
+    double frame = 0.0, beat = 0.0, bpm = 120.0;
+    bool recorded = true;
+    for (int cycle = 1; cycle <= 20000; cycle++) {
+      beat += 256.0 * bpm / (60.0 * sr);
+      frame += 256.0;
+      bpm = 120.0 + 20.0 * std::sin(cycle / 300.0);
+      played.emplace_back(frame, beat);
+      recorded = full.record(frame, bpm) && recorded;
+    }
+    double worst = 0.0;
+    for (auto &p : played) {
+      worst = std::max(worst, std::abs(full.frameAt(p.second) - p.first));
+    }
+    double after = frame + 10.0 * sr;
+    double afterBeat = beat + 10.0 * bpm / 60.0;
+    double end = std::max(std::abs(full.beatAt(after) - afterBeat),
+                          std::abs(full.frameAt(afterBeat) - after) / sr);
+    std::cerr << "tempo map of " << capacity << " after " << played.size()
+              << " changes has " << full.size() << " segments, history "
+              << worst << " frames out, past the end " << end << std::endl;
+    if (!recorded || full.size() > capacity || !(end < 1e-6) ||
+        !(worst < 0.01 * sr)) {
+      std::cerr << "tempo map lost changes once full" << std::endl;
+      ok = false;
+    }
+  }
+
+  // the transport
+  auto session = std::make_shared<LinkSession>(120.0, true, false);
+  auto backend = std::make_unique<SimBackend>(sampleRate, 256);
+  SimBackend *sim = backend.get();
+  JackTransportLink j(std::move(backend), benchSettings(120.0), session);
+  j.setSyncLink(false);
+  sim->transportStart();
+  jack_position_t pos;
+  while (sim->transportQuery(&pos), pos.frame < 2 * sampleRate) {
+    sim->cycle();
+  }
+  // the timebase callback rolls on from the frame it writes at the new tempo
+  j.setBPM(90.0);
+  sim->cycle();
+  sim->transportQuery(&pos);
+  const double changeFrame = static_cast<double>(pos.frame);
+  const double changeBeat = changeFrame * 120.0 / (60.0 * sr);
+  while (sim->transportQuery(&pos), pos.frame < 5 * sampleRate) {
+    sim->cycle();
+  }
+
+  for (double beat : {changeBeat + 3.0, changeBeat - 1.5}) {
+    double expected =
+        beat < changeBeat
+            ? beat * 60.0 * sr / 120.0
+            : changeFrame + (beat - changeBeat) * 60.0 * sr / 90.0;
+    std::array<char, 128> buffer;
+    oscpack::OutboundPacketStream p(buffer.data(), buffer.size());
+    p << oscpack::BeginMessage("/jacklink/beattime") << beat
+      << oscpack::EndMessage;
+    j.ProcessPacket(p.Data(), static_cast<int>(p.Size()),
+                    oscpack::IpEndpointName());
+    // the locate is applied, and the transport moved, within the next cycle
+    sim->cycle();
+    sim->transportQuery(&pos);
+    double located = static_cast<double>(pos.frame);
+    double bbt = (pos.bar - 1) * 4.0 + (pos.beat - 1) +
+                 pos.tick / pos.ticks_per_beat;
+    std::cerr << "tempo map locate to beat " << beat << " landed "
+              << located - expected << " frames out, at beat " << bbt
+              << std::endl;
+    if (!(std::abs(located - expected) <= 1.0) ||
+        !(std::abs(bbt - beat) <= 1.0 / pos.ticks_per_beat)) {
+      std::cerr << "tempo map locate is out" << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// the events in the journal at path and the files rotated out before it,
+// oldest first, returns false if any of them isn't a journal
+bool read_journal(const std::string &path, size_t files,
+                  std::vector<JournalEvent> &events) {
+  for (size_t i = files; i-- > 0;) {
+    std::string file = i == 0 ? path : path + "." + std::to_string(i);
+    FILE *f = std::fopen(file.c_str(), "rb");
+    if (f == nullptr) {
+      continue;
+    }
+    JournalHeader header;
+    bool ok = std::fread(&header, sizeof(header), 1, f) == 1 &&
+              std::memcmp(header.magic, journal_magic,
+                          sizeof(header.magic)) == 0 &&
+              header.recordSize == sizeof(JournalEvent);
+    JournalEvent e;
+    while (ok && std::fread(&e, sizeof(e), 1, f) == 1) {
+      events.push_back(e);
+    }
+    std::fclose(f);
+    if (!ok) {
+      std::cerr << file << " is not a journal" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+void remove_journal(const std::string &path, size_t files) {
+  for (size_t i = 0; i <= files; i++) {
+    std::string file = i == 0 ? path : path + "." + std::to_string(i);
+    unlink(file.c_str());
+  }
+}
+
+std::string journal_path() {
+  return "/tmp/jack_transport_link_bench_journal." + std::to_string(getpid());
+}
+
+// Journal::record from a thread journaling a few events a cycle, alone and
+// with other threads recording as the link and notification threads would.
+// Each sample is the mean of the events in a cycle
+void benchJournal(Report &report, size_t cycles) {
+  using std::chrono::steady_clock;
+  const size_t batch = 4;
+  const auto pause = std::chrono::microseconds(250);
+  std::vector<double> samples;
+  samples.reserve(cycles);
+  auto path = journal_path();
+
+  for (size_t contenders : {0, 3}) {
+    uint64_t dropped;
+    {
+      Journal journal(path, 16 * 1024 * 1024, 1);
+      std::atomic<bool> stop = false;
+      std::vector<std::thread> threads;
+      for (size_t t = 0; t < contenders; t++) {
+        threads.emplace_back([&, t]() {
+          JournalEvent e;
+          e.type = JournalEvent::Type::LinkPeers;
+          e.source = static_cast<uint16_t>(t + 1);
+          while (!stop.load(std::memory_order_relaxed)) {
+            e.hostTime = Journal::now();
+            journal.record(e);
+            std::this_thread::sleep_for(pause);
+          }
+        });
+      }
+
+      samples.clear();
+      JournalEvent e;
+      e.type = JournalEvent::Type::Tempo;
+      for (size_t i = 0; i < cycles; i++) {
+        auto start = steady_clock::now();
+        for (size_t b = 0; b < batch; b++) {
+          e.a = static_cast<double>(b);
+          journal.record(e);
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      steady_clock::now() - start)
+                      .count();
+        samples.push_back(static_cast<double>(ns) / static_cast<double>(batch));
+        std::this_thread::sleep_for(pause);
+      }
+      stop = true;
+      for (auto &t : threads) {
+        t.join();
+      }
+      dropped = journal.dropped();
+    }
+    remove_journal(path, 1);
+    if (dropped > 0) {
+      std::cerr << "journal dropped " << dropped << " events with "
+                << contenders << " other threads" << std::endl;
+    }
+    report.add("journal", "record",
+               {{"contenders", static_cast<double>(contenders)}}, samples);
+  }
+}
+
+// Threads journal numbered events into small files that rotate, what is
+// kept must be in order for every thread with nothing missing up to its
+// last. Then a simulated server starts, changes tempo and stops, and the
+// journal must have it. Returns false if either is wrong
+bool checkJournal(jack_nframes_t sampleRate) {
+  bool ok = true;
+  auto path = journal_path();
+  const size_t files = 3;
+  const size_t threadCount = 4;
+  const uint64_t perThread = 2000;
+  {
+    Journal journal(path, sizeof(JournalHeader) + 1000 * sizeof(JournalEvent),
+                    files);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; t++) {
+      threads.emplace_back([&, t]() {
+        JournalEvent e;
+        e.type = JournalEvent::Type::Xrun;
+        e.source = static_cast<uint16_t>(t);
+        for (uint64_t n = 0; n < perThread; n++) {
+          e.a = static_cast<double>(n);
+          journal.record(e);
+          // bursts well within the queue between drains
+          if (n % 256 == 255) {
+            std::this_thread::sleep_for(Journal::drain_interval);
+          }
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    if (journal.dropped() != 0) {
+      std::cerr << "journal dropped " << journal.dropped() << " events"
+                << std::endl;
+      ok = false;
+    }
+  }
+  std::vector<JournalEvent> events;
+  ok = read_journal(path, files, events) && ok;
+  std::vector<double> next(threadCount, -1.0);
+  size_t outOfOrder = 0;
+  for (auto &e : events) {
+    if (e.type != JournalEvent::Type::Xrun || e.source >= threadCount) {
+      outOfOrder++;
+      continue;
+    }
+    // the oldest events rotated away, from then on every one
+    auto &n = next[e.source];
+    if (n >= 0.0 && e.a != n) {
+      outOfOrder++;
+    }
+    n = e.a + 1.0;
+  }
+  std::cerr << "journal kept " << events.size() << " of "
+            << threadCount * perThread << " events in " << files << " files"
+            << std::endl;
+  if (outOfOrder > 0 || events.size() < 2000 ||
+      std::any_of(next.begin(), next.end(), [&](double n) {
+        return n != static_cast<double>(perThread);
+      })) {
+    std::cerr << "journal lost or reordered " << outOfOrder << " events"
+              << std::endl;
+    ok = false;
+  }
+  remove_journal(path, files);
+
+  events.clear();
+  {
+    Journal journal(path, 1024 * 1024, 1);
+    auto backend = std::make_unique<SimBackend>(sampleRate, 256);
+    SimBackend *sim = backend.get();
+    auto settings = benchSettings(120.0);
+    settings.maxStartHoldSeconds = 0.0;
+    JackTransportLink j(std::move(backend), settings);
+    j.setJournal(&journal, 2);
+    sim->transportStart();
+    for (int i = 0; i < 100; i++) {
+      sim->cycle();
+    }
+    j.setBPM(90.0);
+    for (int i = 0; i < 100; i++) {
+      sim->cycle();
+    }
+    sim->transportStop();
+    for (int i = 0; i < 10; i++) {
+      sim->cycle();
+    }
+    j.setJournal(nullptr, 0);
+  }
+  ok = read_journal(path, 1, events) && ok;
+  remove_journal(path, 1);
+  std::vector<std::string> seen;
+  uint32_t frame = 0;
+  for (auto &e : events) {
+    if (e.source != 2 || e.frameTime < frame) {
+      std::cerr << "journal event from the wrong server or out of order"
+                << std::endl;
+      ok = false;
+    }
+    frame = e.frameTime;
+    std::string name = journalEventName(e.type);
+    if (e.type == JournalEvent::Type::TransportState) {
+      name += e.a == JackTransportRolling   ? " rolling"
+              : e.a == JackTransportStopped ? " stopped"
+                                            : " starting";
+    } else if (e.type == JournalEvent::Type::Tempo) {
+      name += " " + std::to_string(static_cast<int>(e.a));
+    }
+    // the clock restarts whenever the transport starts or moves
+    if (e.type != JournalEvent::Type::MIDIResync &&
+        e.type != JournalEvent::Type::MIDIContinue &&
+        e.type != JournalEvent::Type::MIDIStart &&
+        e.type != JournalEvent::Type::Reposition) {
+      seen.push_back(name);
+    }
+  }
+  // nothing holds the start, it rolls on the first cycle
+  const std::vector<std::string> expected = {
+      "transport rolling", "tempo 90", "transport stopped", "midi-stop"};
+  if (seen != expected) {
+    std::cerr << "journal of a simulated server was";
+    for (auto &s : seen) {
+      std::cerr << " [" << s << "]";
+    }
+    std::cerr << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+// the click, synced to link, against link's beat at the time it is heard, the
+// host time of its sample plus the sound card's playback latency and the
+// offset. The first sample of a click that isn't silent is up to a sample
+// after its beat, link's microseconds make up the rest of the tolerance.
+// Without latency, with the sound card's, with an offset on top and with a
+// negative one, the midi clock then runs behind the audio rather than ahead.
+// Returns false if a click is more than a sample from its beat or the midi
+// clock had to resync
+bool checkClickPhase(jack_nframes_t sampleRate) {
+  struct Case {
+    jack_nframes_t systemLatency;
+    double offsetMs;
+  };
+  const double sr = static_cast<double>(sampleRate);
+  const jack_nframes_t nframes = 256;
+  const double bpm = 120.0;
+  const double quantum = 4.0;
+  const double tolerance = 1.0 + 2.0 * sr / 1e6;
+  bool ok = true;
+
+  for (auto c : {Case{0, 0.0}, Case{512, 0.0}, Case{512, 3.5},
+                 Case{256, -2.0}}) {
+    auto session = std::make_shared<LinkSession>(bpm, true, false);
+    auto backend = std::make_unique<SimBackend>(sampleRate, nframes);
+    SimBackend *sim = backend.get();
+    auto settings = benchSettings(bpm);
+    settings.initialQuantum = quantum;
+    settings.clickSubdivision = 1;
+    JackTransportLink j(std::move(backend), settings, session);
+    // through the latency callback, like a graph change
+    sim->setSystemPlaybackLatency(c.systemLatency);
+    j.setOutputLatencyOffset(c.offsetMs);
+    const double latencyUsecs =
+        static_cast<double>(c.systemLatency) * 1e6 / sr + c.offsetMs * 1e3;
+
+    sim->transportStart();
+    while (sim->frameTime() < sampleRate / 2) {
+      sim->cycle();
+    }
+
+    // a click sounds for 30ms, anything after 50ms of silence is the next
+    // one, the tail of one still sounding is left out
+    const uint64_t silence = static_cast<uint64_t>(sr / 20.0);
+    uint64_t lastSound = sim->frameTime();
+    size_t clicks = 0;
+    double maxError = 0.0;
+    while (sim->frameTime() < 5 * sampleRate) {
+      jack_nframes_t nextFrame;
+      jack_time_t cycleUsecs, nextUsecs;
+      float periodUsecs;
+      sim->getCycleTimes(&nextFrame, &cycleUsecs, &nextUsecs, &periodUsecs);
+      const uint64_t frame = sim->frameTime();
+      sim->cycle();
+
+      const jack_default_audio_sample_t *click = sim->audioBuffer("click");
+      for (jack_nframes_t i = 0; click != nullptr && i < nframes; i++) {
+        if (click[i] == 0.0f) {
+          continue;
+        }
+        if (frame + i - lastSound > silence) {
+          auto heard = std::chrono::microseconds(std::llround(
+              static_cast<double>(nextUsecs) +
+              static_cast<double>(i) * 1e6 / sr + latencyUsecs));
+          double beat = session->link().captureAppSessionState().beatAtTime(
+              heard, quantum);
+          double error = (beat - std::round(beat)) * 60.0 * sr / bpm;
+          maxError = std::max(maxError, std::abs(error));
+          clicks++;
+        }
+        lastSound = frame + i;
+      }
+    }
+
+    auto resyncs = j.rtStats().clockResyncs.value();
+    std::cerr << "click phase, output latency " << c.systemLatency
+              << " frames " << c.offsetMs << "ms offset, " << clicks
+              << " clicks heard at most " << maxError
+              << " samples from their beat, " << resyncs
+              << " midi clock resyncs" << std::endl;
+    // 4.5 seconds at 120 bpm
+    if (clicks < 8 || maxError > tolerance || resyncs != 0) {
+      std::cerr << "click phase, output latency " << c.systemLatency
+                << " frames " << c.offsetMs
+                << "ms offset is out of phase with link" << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// the shared memory timeline, synced to link, against link's beat at the
+// record's host time every cycle. Link keeps beats in millionths at
+// microsecond times. Returns false if a record is out by more than that
+bool checkTimelinePhase(jack_nframes_t sampleRate) {
+  const double bpm = 120.0;
+  const double quantum = 4.0;
+  const double tolerance = 2e-6 + 1e-6 * bpm / 60.0;
+  const std::string name =
+      "/jack_transport_link_bench." + std::to_string(getpid());
+
+  TimelineWriter writer(name);
+  TimelineReader reader(name);
+  if (!writer.isOpen() || !reader.isOpen()) {
+    std::cerr << "timeline phase cannot open " << name << std::endl;
+    return false;
+  }
+  auto session = std::make_shared<LinkSession>(bpm, true, false);
+  auto backend = std::make_unique<SimBackend>(sampleRate, 256);
+  SimBackend *sim = backend.get();
+  auto settings = benchSettings(bpm);
+  settings.initialQuantum = quantum;
+  JackTransportLink j(std::move(backend), settings, session);
+  j.setTimelineWriter(&writer);
+  sim->transportStart();
+
+  double maxError = 0.0;
+  size_t records = 0;
+  while (sim->frameTime() < 2 * sampleRate) {
+    sim->cycle();
+    TimelineRecord record;
+    if (!reader.read(record) || !record.playing) {
+      continue;
+    }
+    double beat = session->link().captureAppSessionState().beatAtTime(
+        std::chrono::microseconds(record.hostTime), quantum);
+    maxError = std::max(
+        maxError, std::abs(timelineBeatAtTime(record, record.hostTime) - beat));
+    records++;
+  }
+  j.setTimelineWriter(nullptr);
+
+  std::cerr << "timeline phase " << records << " records at most " << maxError
+            << " beats from link" << std::endl;
+  if (records == 0 || maxError > tolerance) {
+    std::cerr << "timeline phase is out of phase with link" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// two servers on one session in step, the second starts a second after the
+// first and the sync callback holds its start for the quantum boundary. Bars
+// are a whole number of cycles, so the start phase statistic must come out
+// within the few microseconds the two servers' clocks are apart. Returns false
+// if it doesn't or the start wasn't held
+bool checkStartPhase(jack_nframes_t sampleRate) {
+  const double sr = static_cast<double>(sampleRate);
+  const jack_nframes_t nframes = 256;
+  const double quantum = 4.0;
+  // a bar every 375 cycles
+  const double bpm = 240.0 * sr / (375.0 * nframes);
+  const double tolerance = 1e-3;
+
+  auto session = std::make_shared<LinkSession>(bpm, true, false);
+  auto settings = benchSettings(bpm);
+  settings.initialQuantum = quantum;
+  std::array<SimBackend *, 2> sims;
+  std::array<std::unique_ptr<JackTransportLink>, 2> bridges;
+  for (size_t i = 0; i < 2; i++) {
+    auto backend = std::make_unique<SimBackend>(sampleRate, nframes);
+    sims[i] = backend.get();
+    bridges[i] = std::make_unique<JackTransportLink>(std::move(backend),
+                                                     settings, session);
+  }
+  auto run = [&](double seconds) {
+    const uint64_t until =
+        sims[0]->frameTime() + static_cast<uint64_t>(seconds * sr);
+    while (sims[0]->frameTime() < until) {
+      sims[0]->cycle();
+      sims[1]->cycle();
+    }
+  };
+  sims[0]->transportStart();
+  run(1.0);
+  sims[1]->transportStart();
+  run(3.0);
+
+  const auto &stats = bridges[1]->rtStats();
+  std::cerr << "start phase " << stats.heldStarts.value()
+            << " held starts, at most " << stats.startPhaseErrorBeats.max()
+            << " beats from the boundary" << std::endl;
+  if (stats.heldStarts.value() == 0 ||
+      stats.startPhaseErrorBeats.count() == 0 ||
+      stats.startPhaseErrorBeats.max() > tolerance) {
+    std::cerr << "start phase is off the quantum boundary" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// the control side from the threads that drive it in the service, link's
+// thread changing the tempo, jack's notification thread setting the tempo and
+// sync, and the event loop with osc tempo messages and processEvents, each
+// waiting for a cycle after every command, while a realtime thread runs the
+// cycles. Build with -DSANITIZER=thread to have the threading checked too.
+// The last tempo set must come out of the snapshot and no command may wait
+// more than two cycles, returns false otherwise
+bool checkCommands(jack_nframes_t sampleRate, size_t commands) {
+  auto backend = std::make_unique<SimBackend>(sampleRate, 64);
+  SimBackend *sim = backend.get();
+  JackTransportLink j(std::move(backend), benchSettings(120.0));
+  sim->transportStart();
+
+  std::atomic<bool> run = true;
+  std::thread rt([&]() {
+    while (run.load(std::memory_order_relaxed)) {
+      sim->cycle();
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  });
+  auto waitCycles = [&](uint64_t cycles) {
+    const uint64_t until = j.snapshot().cycle + cycles;
+    while (j.snapshot().cycle < until) {
+      std::this_thread::yield();
+    }
+  };
+  auto control = [&](auto &&command) {
+    return std::thread([&, command]() {
+      for (size_t i = 0; i < commands; i++) {
+        command(static_cast<double>(i % 100));
+        waitCycles(1);
+      }
+    });
+  };
+
+  std::vector<std::thread> threads;
+  threads.push_back(
+      control([&](double i) { j.linkTempoChanged(60.0 + i); }));
+  threads.push_back(control([&](double i) {
+    if (std::fmod(i, 16.0) == 0.0) {
+      j.setSyncLink(std::fmod(i, 32.0) == 0.0);
+    } else {
+      j.setBPM(80.0 + i);
+    }
+  }));
+  threads.push_back(control([&](double i) {
+    std::array<char, 64> buffer;
+    oscpack::OutboundPacketStream p(buffer.data(), buffer.size());
+    p << oscpack::BeginMessage("/jacklink/bpm") << 100.0 + i
+      << oscpack::EndMessage;
+    j.ProcessPacket(p.Data(), static_cast<int>(p.Size()),
+                    oscpack::IpEndpointName());
+    j.processEvents();
+  }));
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  // the last word
+  j.setSyncLink(false);
+  j.setBPM(97.0);
+  waitCycles(2);
+  run = false;
+  rt.join();
+
+  auto snapshot = j.snapshot();
+  std::cerr << "commands " << 3 * commands << " from three threads, at most "
+            << snapshot.maxCommandLatency << " cycles waiting, tempo "
+            << snapshot.bpm << std::endl;
+  if (snapshot.bpm != 97.0 || snapshot.syncLink ||
+      snapshot.maxCommandLatency > 2) {
+    std::cerr << "commands were lost or applied late" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// the event loop is woken to report a tempo change, the snapshot it reads the
+// tempo from must already have it, even when it wakes while the realtime
+// thread is still in the cycle. The midi clock written during the cycle
+// stands in for the event loop waking then. Returns false if it reads the
+// tempo from before the change
+bool checkReportedTempo(jack_nframes_t sampleRate) {
+  // long enough for a clock every cycle
+  auto backend = std::make_unique<SimBackend>(sampleRate, 2048);
+  SimBackend *sim = backend.get();
+  JackTransportLink j(std::move(backend), benchSettings(120.0));
+  j.setSyncLink(false);
+  std::vector<double> woken;
+  auto wake = [&]() {
+    pollfd fd = {j.eventFD(), POLLIN, 0};
+    if (poll(&fd, 1, 0) == 1) {
+      woken.push_back(j.snapshot().bpm);
+      j.processEvents();
+    }
+  };
+  sim->setMIDISink([&](const std::string &, uint64_t,
+                       const jack_midi_data_t *, size_t) { wake(); });
+  sim->transportStart();
+  for (int i = 0; i < 100; i++) {
+    sim->cycle();
+    wake();
+  }
+
+  bool ok = true;
+  for (double bpm : {90.0, 133.0, 61.5}) {
+    woken.clear();
+    j.setBPM(bpm);
+    for (int i = 0; i < 2; i++) {
+      sim->cycle();
+      wake();
+    }
+    std::cerr << "reported tempo " << bpm << " woken " << woken.size()
+              << " times, read " << (woken.empty() ? 0.0 : woken.front())
+              << std::endl;
+    if (woken.empty() || woken.front() != bpm) {
+      std::cerr << "reported tempo read before the snapshot had it"
+                << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// free run for a day at each buffer size, the timeline counts whole frames so
+// every render has to end on the same beat, to the bit
+bool checkFreeRun(jack_nframes_t sampleRate) {
+  const double bpm = 100.0;
+  const std::vector<jack_nframes_t> bufferSizes = {64, 128, 256, 512, 2048};
+  // a whole number of cycles at every size
+  const uint64_t totalFrames =
+      uint64_t(86400) * sampleRate / bufferSizes.back() * bufferSizes.back();
+  const double expected = static_cast<double>(totalFrames) * bpm /
+                          (60.0 * static_cast<double>(sampleRate));
+
+  bool ok = true;
+  std::optional<double> first;
+  for (auto bufferSize : bufferSizes) {
+    auto backend = std::make_unique<SimBackend>(sampleRate, bufferSize);
+    SimBackend *sim = backend.get();
+    JackTransportLink j(std::move(backend), benchSettings(bpm));
+    j.setSyncLink(false);
+    sim->transportStart();
+    while (sim->frameTime() < totalFrames) {
+      sim->cycle();
+    }
+    // the timebase has already positioned the frame the day ends on
+    double beat = j.snapshot().beat;
+    std::cerr << "free run " << bufferSize << " frames: "
+              << std::setprecision(17) << beat << std::setprecision(6)
+              << " beats" << std::endl;
+    if (!first) {
+      first = beat;
+    }
+    if (beat != *first || beat != expected) {
+      std::cerr << "free run ended off " << std::setprecision(17) << expected
+                << std::setprecision(6) << " beats" << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  auto parser =
+      optparse::OptionParser().description("Jack Transport Link benchmarks");
+  parser.add_option("-s", "--suite")
+      .type("string")
+      .help("which suite to run: all, callbacks, bbt, cv, osc, transport, "
+            "tempomap, journal, phase, commands, freerun, default: %default")
+      .action("store")
+      .dest("suite")
+      .set_default("all");
+  parser.add_option("-c", "--cycles")
+      .type("int")
+      .help("samples to take for each case, default: %default")
+      .action("store")
+      .dest("cycles")
+      .set_default("2000");
+  parser.add_option("-r", "--sample-rate")
+      .type("int")
+      .help("the simulated sample rate, default: %default")
+      .action("store")
+      .dest("sr")
+      .set_default("48000");
+  parser.add_option("-f", "--format")
+      .type("string")
+      .help("output format: csv or json (one object per line), default: "
+            "%default")
+      .action("store")
+      .dest("format")
+      .set_default("csv");
+
+  optparse::Values options = parser.parse_args(argc, argv);
+  std::string suite = options["suite"];
+  int cycles = options.get("cycles");
+  int sr = options.get("sr");
+  if (cycles <= 0 || sr <= 0) {
+    std::cerr << "one or more numeric options are out of range" << std::endl;
+    return -1;
+  }
+
+  Report report(options["format"] == "json");
+  if (suite == "all" || suite == "callbacks") {
+    benchCallbacks(report, static_cast<jack_nframes_t>(sr),
+                   static_cast<size_t>(cycles));
+  }
+  if (suite == "all" || suite == "bbt") {
+    benchUpdateBBT(report, static_cast<size_t>(cycles));
+  }
+  if (suite == "all" || suite == "cv") {
+    benchPhaseCV(report, static_cast<jack_nframes_t>(sr),
+                 static_cast<size_t>(cycles));
+    if (!checkPhaseCV(static_cast<jack_nframes_t>(sr),
+                      static_cast<size_t>(cycles))) {
+      return 1;
+    }
+  }
+  if (suite == "all" || suite == "osc") {
+    benchSchedule(report, static_cast<jack_nframes_t>(sr),
+                  static_cast<size_t>(cycles));
+    if (!checkOscSchedule(static_cast<jack_nframes_t>(sr)) ||
+        !checkOscScheduleLocate(static_cast<jack_nframes_t>(sr))) {
+      return 1;
+    }
+  }
+  if (suite == "all" || suite == "transport") {
+    // a message per sample is over too quickly to say much
+    benchOscTransport(report, static_cast<size_t>(cycles) * 10);
+    if (!checkOscTransport(static_cast<size_t>(cycles) * 10)) {
+      return 1;
+    }
+  }
+  if (suite == "all" || suite == "tempomap") {
+    benchTempoMap(report, static_cast<size_t>(cycles));
+    if (!checkTempoMap(static_cast<jack_nframes_t>(sr))) {
+      return 1;
+    }
+  }
+  if (suite == "all" || suite == "journal") {
+    benchJournal(report, static_cast<size_t>(cycles));
+    if (!checkJournal(static_cast<jack_nframes_t>(sr))) {
+      return 1;
+    }
+  }
+  if (suite == "all" || suite == "phase") {
+    if (!checkClickPhase(static_cast<jack_nframes_t>(sr)) ||
+        !checkTimelinePhase(static_cast<jack_nframes_t>(sr)) ||
+        !checkStartPhase(static_cast<jack_nframes_t>(sr))) {
+      return 1;
+    }
+  }
+  if (suite == "all" || suite == "commands") {
+    if (!checkCommands(static_cast<jack_nframes_t>(sr),
+                       static_cast<size_t>(cycles)) ||
+        !checkReportedTempo(static_cast<jack_nframes_t>(sr))) {
+      return 1;
+    }
+  }
+  if (suite == "all" || suite == "freerun") {
+    if (!checkFreeRun(static_cast<jack_nframes_t>(sr))) {
+      return 1;
+    }
+  }
+  return 0;
+}
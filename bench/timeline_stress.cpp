@@ -0,0 +1,138 @@
+#include "TimelineShm.hpp"
+#include "TimelineWriter.hpp"
+
+#include <OptionParser.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Hammers the shared memory timeline with a writer that never pauses and
+// readers on their own mappings, every field of a record is derived from the
+// same counter so a torn read shows up as a record that disagrees with itself.
+// Exits non zero if any reader saw one.
+
+namespace {
+
+TimelineRecord make_record(uint64_t n) {
+  TimelineRecord record;
+  record.hostTime = static_cast<int64_t>(n);
+  record.beat = static_cast<double>(n) * 0.25;
+  record.bpm = static_cast<double>(n % 1000) + 20.0;
+  record.quantum = static_cast<double>(n % 7) + 1.0;
+  record.playing = static_cast<uint32_t>(n & 1);
+  record.numPeers = static_cast<uint32_t>(n * 3);
+  return record;
+}
+
+bool consistent(const TimelineRecord &record) {
+  auto expected = make_record(static_cast<uint64_t>(record.hostTime));
+  return record.beat == expected.beat && record.bpm == expected.bpm &&
+         record.quantum == expected.quantum &&
+         record.playing == expected.playing &&
+         record.numPeers == expected.numPeers;
+}
+
+struct ReaderResult {
+  uint64_t reads = 0;
+  uint64_t failed = 0;
+  uint64_t torn = 0;
+  uint64_t backwards = 0;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  auto parser = optparse::OptionParser().description(
+      "Jack Transport Link shared memory timeline stress test");
+  parser.add_option("-s", "--seconds")
+      .type("double")
+      .help("how long to run, default: %default")
+      .action("store")
+      .dest("seconds")
+      .set_default("5.0");
+  parser.add_option("-r", "--readers")
+      .type("int")
+      .help("reader threads, default: %default")
+      .action("store")
+      .dest("readers")
+      .set_default("3");
+
+  optparse::Values options = parser.parse_args(argc, argv);
+  double seconds = options.get("seconds");
+  int readers = options.get("readers");
+  if (seconds <= 0.0 || readers <= 0) {
+    std::cerr << "one or more numeric options are out of range" << std::endl;
+    return -1;
+  }
+
+  // our own name so a running service isn't disturbed
+  std::string name =
+      "/jack_transport_link_stress_" + std::to_string(getpid());
+  TimelineWriter writer(name);
+  if (!writer.isOpen()) {
+    return -1;
+  }
+  writer.publish(make_record(0));
+
+  std::atomic<bool> run = true;
+  std::vector<ReaderResult> results(static_cast<size_t>(readers));
+  std::vector<std::thread> threads;
+  for (auto &result : results) {
+    threads.emplace_back([&run, &name, &result]() {
+      TimelineReader reader(name);
+      if (!reader.isOpen()) {
+        result.failed++;
+        return;
+      }
+      int64_t last = -1;
+      TimelineRecord record;
+      while (run.load(std::memory_order_relaxed)) {
+        if (!reader.read(record)) {
+          result.failed++;
+          continue;
+        }
+        result.reads++;
+        if (!consistent(record)) {
+          result.torn++;
+        }
+        if (record.hostTime < last) {
+          result.backwards++;
+        }
+        last = record.hostTime;
+      }
+    });
+  }
+
+  uint64_t writes = 0;
+  auto end = std::chrono::steady_clock::now() +
+             std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                 std::chrono::duration<double>(seconds));
+  while (std::chrono::steady_clock::now() < end) {
+    for (int i = 0; i < 1000; i++) {
+      writer.publish(make_record(++writes));
+    }
+  }
+  run = false;
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  ReaderResult total;
+  for (auto &result : results) {
+    total.reads += result.reads;
+    total.failed += result.failed;
+    total.torn += result.torn;
+    total.backwards += result.backwards;
+  }
+  std::cout << "writes " << writes << std::endl;
+  std::cout << "reads " << total.reads << std::endl;
+  std::cout << "failed reads " << total.failed << std::endl;
+  std::cout << "torn reads " << total.torn << std::endl;
+  std::cout << "backwards reads " << total.backwards << std::endl;
+  return total.torn == 0 && total.backwards == 0 && total.reads > 0 ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+#include <jack/midiport.h>
+#include <jack/types.h>
+
+class JackTransportLink;
+
+/// The seam between JackTransportLink and the JACK client API.
+///
+/// Everything JackTransportLink needs from JACK goes through here so that a
+/// simulated backend can drive the same callbacks without a server.
+/// The methods mirror the jack_* calls they replace.
+class Backend {
+public:
+  virtual ~Backend() = default;
+
+  // register our callbacks and start processing, the callbacks get the
+  // JackTransportLink instance as their argument
+  virtual void activate(JackTransportLink *link) = 0;
+  virtual void deactivate() = 0;
+
+  virtual jack_port_t *portRegister(const char *name, const char *type,
+                                    unsigned long flags) = 0;
+  virtual void *portGetBuffer(jack_port_t *port, jack_nframes_t nframes) = 0;
+  // max latency between an output port and the playback ports it feeds
+  virtual jack_nframes_t portPlaybackLatency(jack_port_t * /*port*/) {
+    return 0;
+  }
+  // max playback latency of the physical outputs, from the graph to the
+  // speakers. Not realtime safe, called from the latency callback
+  virtual jack_nframes_t systemPlaybackLatency() { return 0; }
+
+  // realtime
+  virtual int getCycleTimes(jack_nframes_t *currentFrames,
+                            jack_time_t *currentUsecs, jack_time_t *nextUsecs,
+                            float *periodUsecs) = 0;
+  // host time, on link's clock, of the cycle that starts sampleTime frames
+  // after activation, filtered of scheduling jitter. Called once a cycle.
+  virtual std::chrono::microseconds
+  sampleTimeToHostTime(double sampleTime) = 0;
+  virtual jack_nframes_t sampleRate() = 0;
+  // any thread, an estimate of the frame time now
+  virtual jack_nframes_t estimatedFrameTime() = 0;
+  virtual jack_nframes_t bufferSize() = 0;
+  virtual jack_transport_state_t transportQuery(jack_position_t *pos) = 0;
+  virtual void midiClearBuffer(void *portBuffer) = 0;
+  virtual int midiEventWrite(void *portBuffer, jack_nframes_t time,
+                             const jack_midi_data_t *data, size_t size) = 0;
+  virtual uint32_t midiEventCount(void *portBuffer) = 0;
+  virtual int midiEventGet(jack_midi_event_t *event, void *portBuffer,
+                           uint32_t index) = 0;
+
+  // transport control
+  virtual void transportStart() = 0;
+  virtual void transportStop() = 0;
+  virtual int transportReposition(const jack_position_t *pos) = 0;
+
+  // metadata, backends without metadata support simply don't have a uuid
+  virtual bool clientUUID(jack_uuid_t & /*uuid*/) { return false; }
+  virtual bool getProperty(jack_uuid_t /*subject*/, const std::string & /*key*/,
+                           std::string & /*valueOut*/,
+                           std::string & /*typeOut*/) {
+    return false;
+  }
+  virtual int setProperty(jack_uuid_t /*subject*/, const char * /*key*/,
+                          const char * /*value*/, const char * /*type*/) {
+    return -1;
+  }
+};
@@ -0,0 +1,149 @@
+#include "Click.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+const double pi = 3.14159265358979323846;
+
+// frequency and level of each grain type
+const std::array<double, 3> grain_freqs = {1760.0, 1320.0, 1320.0};
+const std::array<double, 3> grain_levels = {0.5, 0.35, 0.2};
+// raised cosine attack and fade out, exponential decay in between, the
+// smooth edges keep the burst band-limited
+const double attack_seconds = 0.001;
+const double decay_seconds = 0.006;
+const double fade_seconds = 0.004;
+const double grain_seconds = 0.03;
+// a click this close to the start of the cycle, in clicks, is played at the
+// start rather than missed
+const double early_clicks = 1e-6;
+
+double envelope(double t) {
+  double env = std::exp(-t / decay_seconds);
+  if (t < attack_seconds) {
+    env *= 0.5 - 0.5 * std::cos(pi * t / attack_seconds);
+  }
+  double fadeStart = grain_seconds - fade_seconds;
+  if (t > fadeStart) {
+    env *= 0.5 + 0.5 * std::cos(pi * std::min(1.0, (t - fadeStart) /
+                                                        fade_seconds));
+  }
+  return env;
+}
+
+// out += in, kept free of aliasing so it vectorizes
+void mix(float *__restrict out, const float *__restrict in, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] += in[i];
+  }
+}
+} // namespace
+
+Click::Click(double sampleRate, int subdivision)
+    : mSubdivision(std::max(1, subdivision)),
+      mGrainLength(static_cast<size_t>(std::ceil(grain_seconds * sampleRate)) +
+                   1) {
+  mGrains.resize(GrainCount * phases * mGrainLength, 0.0f);
+  for (int type = 0; type < GrainCount; type++) {
+    for (int phase = 0; phase < phases; phase++) {
+      // sample n of this grain is n - phase / phases samples after the click
+      float *samples = mGrains.data() + (type * phases + phase) * mGrainLength;
+      for (size_t n = 0; n < mGrainLength; n++) {
+        double t = (static_cast<double>(n) -
+                    static_cast<double>(phase) / static_cast<double>(phases)) /
+                   sampleRate;
+        if (t < 0.0 || t > grain_seconds) {
+          continue;
+        }
+        samples[n] = static_cast<float>(grain_levels[type] * envelope(t) *
+                                        std::sin(2.0 * pi * grain_freqs[type] *
+                                                 t));
+      }
+    }
+  }
+}
+
+void Click::process(float *out, uint32_t nframes, double sampleRate,
+                    double beat, double bpm, double quantum, bool rolling) {
+  std::memset(out, 0, nframes * sizeof(float));
+
+  // tails of the clicks from earlier cycles
+  for (auto &voice : mVoices) {
+    if (voice.remaining > 0) {
+      size_t n = std::min(voice.remaining, static_cast<size_t>(nframes));
+      mix(out, voice.samples, n);
+      voice.samples += n;
+      voice.remaining -= n;
+    }
+  }
+
+  if (!rolling || bpm <= 0.0 || sampleRate <= 0.0) {
+    mContinuous = false;
+    return;
+  }
+
+  // the grains were made for the sample rate at construction, a different
+  // rate only shifts their pitch, the placement uses the current rate
+  const double subdivision = static_cast<double>(mSubdivision);
+  const double framesPerBeat = 60.0 * sampleRate / bpm;
+  const double cycleBeats = static_cast<double>(nframes) / framesPerBeat;
+
+  // carry on from the last click unless the transport jumped
+  if (!mContinuous || std::abs(beat - mEndBeat) >= 0.5 / subdivision) {
+    mLastIndex = static_cast<int64_t>(
+                     std::ceil(beat * subdivision - early_clicks)) -
+                 1;
+  }
+  for (int64_t index = mLastIndex + 1;; index++) {
+    double clickBeat = static_cast<double>(index) / subdivision;
+    double offset = (clickBeat - beat) * framesPerBeat;
+    if (offset >= static_cast<double>(nframes)) {
+      break;
+    }
+    Grain type = Subdivision;
+    if (index % mSubdivision == 0) {
+      type = quantum > 0.0 &&
+                     std::abs(std::remainder(clickBeat, quantum)) <
+                         0.5 / subdivision
+                 ? Accent
+                 : Beat;
+    }
+    start(out, nframes, std::max(0.0, offset), type);
+    mLastIndex = index;
+  }
+  mEndBeat = beat + cycleBeats;
+  mContinuous = true;
+}
+
+const float *Click::grain(Grain type, int phase) const {
+  return mGrains.data() + (type * phases + phase) * mGrainLength;
+}
+
+void Click::start(float *out, uint32_t nframes, double offset, Grain type) {
+  // the nearest precomputed fractional offset
+  auto frame = static_cast<uint32_t>(offset);
+  int phase = static_cast<int>(
+      std::lround((offset - static_cast<double>(frame)) * phases));
+  if (phase == phases) {
+    phase = 0;
+    frame++;
+  }
+  if (frame >= nframes) {
+    // rounded into the next cycle, start it there
+    frame = nframes;
+  }
+
+  const float *samples = grain(type, phase);
+  size_t n = std::min(mGrainLength, static_cast<size_t>(nframes - frame));
+  mix(out + frame, samples, n);
+  if (n < mGrainLength) {
+    auto voice = std::find_if(mVoices.begin(), mVoices.end(),
+                              [](const Voice &v) { return v.remaining == 0; });
+    if (voice != mVoices.end()) {
+      voice->samples = samples + n;
+      voice->remaining = mGrainLength - n;
+    }
+  }
+}
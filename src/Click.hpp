@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// Metronome click audio, an accent on the downbeat, a click on every beat
+/// and a quieter one on each subdivision.
+///
+/// Each click is a short enveloped sine burst, precomputed at construction for
+/// a number of fractional sample offsets so that a click can start between
+/// samples without aliasing, and mixed into the output with a loop the
+/// compiler can vectorize. Realtime safe apart from construction.
+class Click {
+public:
+  // fractional sample offsets each grain is precomputed for
+  static constexpr int phases = 16;
+  // clicks still sounding from earlier cycles, more are dropped
+  static constexpr size_t max_voices = 16;
+
+  Click(double sampleRate, int subdivision);
+
+  // overwrite out with nframes of click for the transport at beat at the
+  // start of the cycle, only clicks while rolling but lets clicks ring out
+  void process(float *out, uint32_t nframes, double sampleRate, double beat,
+               double bpm, double quantum, bool rolling);
+
+private:
+  enum Grain { Accent = 0, Beat, Subdivision, GrainCount };
+
+  struct Voice {
+    const float *samples = nullptr;
+    size_t remaining = 0;
+  };
+
+  const float *grain(Grain type, int phase) const;
+  // start a click offset frames into the cycle
+  void start(float *out, uint32_t nframes, double offset, Grain type);
+
+  int mSubdivision;
+  size_t mGrainLength;
+  // GrainCount * phases grains of mGrainLength samples
+  std::vector<float> mGrains;
+  std::array<Voice, max_voices> mVoices;
+
+  // the click index, beat * subdivision, of the last click we started and
+  // the beat the last cycle ended on, to carry on from there
+  bool mContinuous = false;
+  int64_t mLastIndex = 0;
+  double mEndBeat = 0.0;
+};
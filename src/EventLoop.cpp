@@ -0,0 +1,321 @@
+#include "EventLoop.hpp"
+
+#include <signal.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <vector>
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+void throw_errno(const char *what) {
+  throw std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+#ifndef __linux__
+void set_nonblocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+// signal handlers can only reach a global
+EventNotifier *signal_notifier = nullptr;
+volatile sig_atomic_t signal_last = 0;
+void signal_handler(int signal) {
+  signal_last = signal;
+  if (signal_notifier != nullptr) {
+    signal_notifier->notify();
+  }
+}
+#endif
+} // namespace
+
+#ifdef __linux__
+
+EventNotifier::EventNotifier() {
+  mReadFD = mWriteFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (mReadFD < 0) {
+    throw_errno("eventfd");
+  }
+}
+
+EventNotifier::~EventNotifier() { close(mReadFD); }
+
+void EventNotifier::notify() {
+  // can only fail if the counter would overflow, which is still readable
+  eventfd_write(mWriteFD, 1);
+}
+
+void EventNotifier::drain() {
+  eventfd_t value;
+  eventfd_read(mReadFD, &value);
+}
+
+SignalWatcher::SignalWatcher(std::initializer_list<int> signals) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  for (int s : signals) {
+    sigaddset(&mask, s);
+  }
+  // threads inherit the mask, so only the signalfd sees these
+  pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+  mSignalFD = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (mSignalFD < 0) {
+    throw_errno("signalfd");
+  }
+}
+
+SignalWatcher::~SignalWatcher() { close(mSignalFD); }
+
+int SignalWatcher::fd() const { return mSignalFD; }
+
+int SignalWatcher::read() {
+  int last = 0;
+  signalfd_siginfo info;
+  while (::read(mSignalFD, &info, sizeof(info)) == sizeof(info)) {
+    last = static_cast<int>(info.ssi_signo);
+  }
+  return last;
+}
+
+DirectoryWatcher::DirectoryWatcher(const std::string &path,
+                                   const std::string &prefix)
+    : mPath(path), mPrefix(prefix) {
+  mFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (mFD < 0) {
+    std::cerr << "cannot watch " << path << ": " << std::strerror(errno)
+              << std::endl;
+    return;
+  }
+  watch(path, 0);
+  if (mWatches.empty()) {
+    close(mFD);
+    mFD = -1;
+  }
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+  if (mFD >= 0) {
+    close(mFD);
+  }
+}
+
+bool DirectoryWatcher::watch(const std::string &path, int depth) {
+  int wd = inotify_add_watch(mFD, path.c_str(),
+                             IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+  if (wd < 0) {
+    // it may have gone again, or not have been a directory
+    if (errno != ENOENT && errno != ENOTDIR) {
+      std::cerr << "cannot watch " << path << ": " << std::strerror(errno)
+                << std::endl;
+    }
+    return false;
+  }
+  mWatches[wd] = {path, depth};
+
+  // whatever was created before the watch was added
+  bool found = false;
+  DIR *dir = opendir(path.c_str());
+  if (dir == nullptr) {
+    return false;
+  }
+  while (auto entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    if (name.compare(0, mPrefix.size(), mPrefix) == 0) {
+      found = true;
+    }
+    if ((entry->d_type == DT_DIR || entry->d_type == DT_UNKNOWN) &&
+        descend(name, depth)) {
+      found = watch(path + "/" + name, depth + 1) || found;
+    }
+  }
+  closedir(dir);
+  return found;
+}
+
+bool DirectoryWatcher::descend(const std::string &name, int depth) const {
+  // jack-UID in the socket directory, then every server's directory in that
+  return depth == 0 ? name.compare(0, mPrefix.size(), mPrefix) == 0
+                    : depth == 1;
+}
+
+bool DirectoryWatcher::read() {
+  bool found = false;
+  alignas(inotify_event) char buf[4096];
+  ssize_t size;
+  while ((size = ::read(mFD, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + size;) {
+      auto event = reinterpret_cast<const inotify_event *>(p);
+      p += sizeof(inotify_event) + event->len;
+      if ((event->mask & IN_Q_OVERFLOW) != 0) {
+        // pick up any directory created while events were being lost
+        watch(mPath, 0);
+        found = true;
+        continue;
+      }
+      if ((event->mask & IN_IGNORED) != 0) {
+        mWatches.erase(event->wd);
+        continue;
+      }
+      auto it = mWatches.find(event->wd);
+      if (it == mWatches.end() || event->len == 0) {
+        continue;
+      }
+      std::string name = event->name;
+      if (name.compare(0, mPrefix.size(), mPrefix) == 0) {
+        found = true;
+      }
+      if ((event->mask & IN_ISDIR) != 0 && descend(name, it->second.depth)) {
+        Watch parent = it->second;
+        found = watch(parent.path + "/" + name, parent.depth + 1) || found;
+      }
+    }
+  }
+  return found;
+}
+
+EventLoop::EventLoop() {
+  mEpollFD = epoll_create1(EPOLL_CLOEXEC);
+  if (mEpollFD < 0) {
+    throw_errno("epoll_create1");
+  }
+}
+
+EventLoop::~EventLoop() { close(mEpollFD); }
+
+bool EventLoop::add(int fd, Handler handler) {
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(mEpollFD, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    std::cerr << "cannot add fd to event loop: " << std::strerror(errno)
+              << std::endl;
+    return false;
+  }
+  mHandlers[fd] = handler;
+  return true;
+}
+
+void EventLoop::remove(int fd) {
+  if (mHandlers.erase(fd) != 0) {
+    epoll_ctl(mEpollFD, EPOLL_CTL_DEL, fd, nullptr);
+  }
+}
+
+void EventLoop::runOnce(int timeoutMs) {
+  epoll_event events[16];
+  int count = epoll_wait(mEpollFD, events, 16, timeoutMs);
+  for (int i = 0; i < count; i++) {
+    // a handler may have removed a later fd, or may remove its own
+    auto it = mHandlers.find(events[i].data.fd);
+    if (it != mHandlers.end()) {
+      auto handler = it->second;
+      handler();
+    }
+  }
+}
+
+#else
+
+EventNotifier::EventNotifier() {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    throw_errno("pipe");
+  }
+  mReadFD = fds[0];
+  mWriteFD = fds[1];
+  set_nonblocking(mReadFD);
+  set_nonblocking(mWriteFD);
+}
+
+EventNotifier::~EventNotifier() {
+  close(mReadFD);
+  close(mWriteFD);
+}
+
+void EventNotifier::notify() {
+  // a full pipe is still readable
+  uint8_t b = 1;
+  (void)write(mWriteFD, &b, 1);
+}
+
+void EventNotifier::drain() {
+  uint8_t buf[64];
+  while (::read(mReadFD, buf, sizeof(buf)) > 0) {
+  }
+}
+
+SignalWatcher::SignalWatcher(std::initializer_list<int> signals) {
+  static EventNotifier notifier;
+  signal_notifier = &notifier;
+  for (int s : signals) {
+    ::signal(s, signal_handler);
+  }
+}
+
+SignalWatcher::~SignalWatcher() {}
+
+int SignalWatcher::fd() const { return signal_notifier->fd(); }
+
+int SignalWatcher::read() {
+  signal_notifier->drain();
+  int last = signal_last;
+  signal_last = 0;
+  return last;
+}
+
+DirectoryWatcher::DirectoryWatcher(const std::string &path,
+                                   const std::string &prefix)
+    : mPath(path), mPrefix(prefix) {}
+DirectoryWatcher::~DirectoryWatcher() {}
+
+bool DirectoryWatcher::read() { return false; }
+
+EventLoop::EventLoop() {}
+EventLoop::~EventLoop() {}
+
+bool EventLoop::add(int fd, Handler handler) {
+  mHandlers[fd] = handler;
+  return true;
+}
+
+void EventLoop::remove(int fd) { mHandlers.erase(fd); }
+
+void EventLoop::runOnce(int timeoutMs) {
+  std::vector<pollfd> fds;
+  for (auto &h : mHandlers) {
+    fds.push_back({h.first, POLLIN, 0});
+  }
+  if (poll(fds.data(), fds.size(), timeoutMs) <= 0) {
+    return;
+  }
+  for (auto &p : fds) {
+    if (p.revents != 0) {
+      auto it = mHandlers.find(p.fd);
+      if (it != mHandlers.end()) {
+        auto handler = it->second;
+        handler();
+      }
+    }
+  }
+}
+
+#endif
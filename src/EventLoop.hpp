@@ -0,0 +1,103 @@
+#pragma once
+
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <string>
+
+/// Wakes an EventLoop from any thread, including the realtime thread and
+/// signal handlers, never blocks. An eventfd on linux, a pipe elsewhere.
+class EventNotifier {
+public:
+  EventNotifier();
+  ~EventNotifier();
+  EventNotifier(const EventNotifier &) = delete;
+  EventNotifier &operator=(const EventNotifier &) = delete;
+
+  void notify();
+  // clear pending notifications
+  void drain();
+  int fd() const { return mReadFD; }
+
+private:
+  int mReadFD = -1;
+  int mWriteFD = -1;
+};
+
+/// Delivers signals as readable events, a signalfd on linux, a handler that
+/// writes to a notifier elsewhere. Construct before starting any threads so
+/// that the signals are blocked everywhere.
+class SignalWatcher {
+public:
+  SignalWatcher(std::initializer_list<int> signals);
+  ~SignalWatcher();
+
+  int fd() const;
+  // consume pending signals, returns the last one or 0 if there weren't any
+  int read();
+
+private:
+  int mSignalFD = -1;
+};
+
+/// Reports entries whose name starts with prefix appearing in a directory,
+/// inotify on linux. A directory in it whose name starts with prefix is
+/// watched as well, with the directories in that, which is where jack1 puts
+/// its sockets: a directory per server under jack-UID. Where the directory
+/// can't be watched, or elsewhere, fd is -1 and callers have to poll for
+/// whatever they are waiting on.
+class DirectoryWatcher {
+public:
+  DirectoryWatcher(const std::string &path, const std::string &prefix);
+  ~DirectoryWatcher();
+  DirectoryWatcher(const DirectoryWatcher &) = delete;
+  DirectoryWatcher &operator=(const DirectoryWatcher &) = delete;
+
+  int fd() const { return mFD; }
+  // consume pending events, returns true if an entry whose name starts with
+  // prefix was created or moved in, or if events were lost
+  bool read();
+
+private:
+  struct Watch {
+    std::string path;
+    // 0 for the directory we were given
+    int depth;
+  };
+
+  // watch path and the directories in it that descend allows, returns true
+  // if an entry whose name starts with prefix is already there
+  bool watch(const std::string &path, int depth);
+  // whether a directory called name, at depth, is watched too
+  bool descend(const std::string &name, int depth) const;
+
+  int mFD = -1;
+  std::string mPath;
+  std::string mPrefix;
+  // by watch descriptor
+  std::map<int, Watch> mWatches;
+};
+
+/// A single threaded loop that dispatches readable file descriptors, epoll
+/// on linux, poll elsewhere.
+class EventLoop {
+public:
+  typedef std::function<void()> Handler;
+
+  EventLoop();
+  ~EventLoop();
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  // call handler whenever fd is readable, a handler may remove itself
+  bool add(int fd, Handler handler);
+  void remove(int fd);
+
+  // wait for events, up to timeoutMs (negative waits forever), and dispatch
+  // them
+  void runOnce(int timeoutMs = -1);
+
+private:
+  int mEpollFD = -1;
+  std::map<int, Handler> mHandlers;
+};
@@ -0,0 +1,172 @@
+#include "JackBackend.hpp"
+#include "JackTransportLink.hpp"
+
+#include <jack/metadata.h>
+#include <jack/midiport.h>
+#include <jack/uuid.h>
+
+#include <algorithm>
+#include <iostream>
+
+JackBackend::JackBackend(jack_client_t *client) : mJackClient(client) {
+  char *uuids;
+  if ((uuids = jack_get_uuid_for_client_name(
+           mJackClient, jack_get_client_name(mJackClient))) != nullptr) {
+    mHaveUUID = jack_uuid_parse(uuids, &mJackClientUUID) == 0;
+    jack_free(uuids);
+  }
+  if (!mHaveUUID) {
+    std::cerr << "cannot get client uuid, property based settings won't work"
+              << std::endl;
+  }
+}
+
+JackBackend::~JackBackend() { jack_client_close(mJackClient); }
+
+void JackBackend::activate(JackTransportLink *link) {
+  if (mHaveUUID) {
+    jack_set_property_change_callback(
+        mJackClient, JackTransportLink::propertyChangeCallback, link);
+  }
+
+  jack_set_sample_rate_callback(
+      mJackClient, JackTransportLink::sampleRateCallback, link);
+  jack_set_buffer_size_callback(
+      mJackClient, JackTransportLink::bufferSizeCallback, link);
+  jack_set_latency_callback(mJackClient, JackTransportLink::latencyCallback,
+                            link);
+  jack_set_xrun_callback(mJackClient, JackTransportLink::xrunCallback, link);
+
+  // become the timebase master, unconditionally
+  jack_set_process_callback(mJackClient, JackTransportLink::processCallback,
+                            link);
+  jack_set_timebase_callback(mJackClient, 0,
+                             JackTransportLink::timeBaseCallback, link);
+  jack_set_sync_callback(mJackClient, JackTransportLink::syncCallback, link);
+  jack_activate(mJackClient);
+}
+
+void JackBackend::deactivate() {
+  jack_set_sync_callback(mJackClient, nullptr, nullptr);
+  jack_release_timebase(mJackClient);
+  jack_deactivate(mJackClient);
+}
+
+jack_port_t *JackBackend::portRegister(const char *name, const char *type,
+                                       unsigned long flags) {
+  return jack_port_register(mJackClient, name, type, flags, 0);
+}
+
+void *JackBackend::portGetBuffer(jack_port_t *port, jack_nframes_t nframes) {
+  return jack_port_get_buffer(port, nframes);
+}
+
+jack_nframes_t JackBackend::portPlaybackLatency(jack_port_t *port) {
+  jack_latency_range_t range;
+  jack_port_get_latency_range(port, JackPlaybackLatency, &range);
+  return range.max;
+}
+
+jack_nframes_t JackBackend::systemPlaybackLatency() {
+  const char **names =
+      jack_get_ports(mJackClient, nullptr, JACK_DEFAULT_AUDIO_TYPE,
+                     JackPortIsPhysical | JackPortIsInput);
+  if (names == nullptr) {
+    return 0;
+  }
+  jack_nframes_t latency = 0;
+  for (size_t i = 0; names[i] != nullptr; i++) {
+    jack_port_t *port = jack_port_by_name(mJackClient, names[i]);
+    if (port == nullptr) {
+      continue;
+    }
+    jack_latency_range_t range;
+    jack_port_get_latency_range(port, JackPlaybackLatency, &range);
+    latency = std::max(latency, range.max);
+  }
+  jack_free(names);
+  return latency;
+}
+
+int JackBackend::getCycleTimes(jack_nframes_t *currentFrames,
+                               jack_time_t *currentUsecs,
+                               jack_time_t *nextUsecs, float *periodUsecs) {
+  return jack_get_cycle_times(mJackClient, currentFrames, currentUsecs,
+                              nextUsecs, periodUsecs);
+}
+
+std::chrono::microseconds JackBackend::sampleTimeToHostTime(double sampleTime) {
+  return mHostTimeFilter.sampleTimeToHostTime(sampleTime);
+}
+
+jack_nframes_t JackBackend::sampleRate() {
+  return jack_get_sample_rate(mJackClient);
+}
+
+jack_nframes_t JackBackend::estimatedFrameTime() {
+  return jack_frame_time(mJackClient);
+}
+
+jack_nframes_t JackBackend::bufferSize() {
+  return jack_get_buffer_size(mJackClient);
+}
+
+jack_transport_state_t JackBackend::transportQuery(jack_position_t *pos) {
+  return jack_transport_query(mJackClient, pos);
+}
+
+void JackBackend::midiClearBuffer(void *portBuffer) {
+  jack_midi_clear_buffer(portBuffer);
+}
+
+int JackBackend::midiEventWrite(void *portBuffer, jack_nframes_t time,
+                                const jack_midi_data_t *data, size_t size) {
+  return jack_midi_event_write(portBuffer, time, data, size);
+}
+
+uint32_t JackBackend::midiEventCount(void *portBuffer) {
+  return jack_midi_get_event_count(portBuffer);
+}
+
+int JackBackend::midiEventGet(jack_midi_event_t *event, void *portBuffer,
+                              uint32_t index) {
+  return jack_midi_event_get(event, portBuffer, index);
+}
+
+void JackBackend::transportStart() { jack_transport_start(mJackClient); }
+
+void JackBackend::transportStop() { jack_transport_stop(mJackClient); }
+
+int JackBackend::transportReposition(const jack_position_t *pos) {
+  return jack_transport_reposition(mJackClient, pos);
+}
+
+bool JackBackend::clientUUID(jack_uuid_t &uuid) {
+  if (mHaveUUID) {
+    uuid = mJackClientUUID;
+  }
+  return mHaveUUID;
+}
+
+// helper to deal with dealloc and std::string
+bool JackBackend::getProperty(jack_uuid_t subject, const std::string &key,
+                              std::string &valueOut, std::string &typeOut) {
+  char *values = nullptr;
+  char *types = nullptr;
+  if (jack_get_property(subject, key.c_str(), &values, &types) != 0)
+    return false;
+  if (values) {
+    valueOut = std::string(values);
+    jack_free(values);
+  }
+  if (types) {
+    typeOut = std::string(types);
+    jack_free(types);
+  }
+  return true;
+}
+
+int JackBackend::setProperty(jack_uuid_t subject, const char *key,
+                             const char *value, const char *type) {
+  return jack_set_property(mJackClient, subject, key, value, type);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Backend.hpp"
+
+#include <jack/jack.h>
+
+#include <ableton/link/HostTimeFilter.hpp>
+#include <ableton/platforms/Config.hpp>
+
+/// Backend that talks to a real JACK server, owns (and closes) the client.
+class JackBackend : public Backend {
+public:
+  JackBackend(jack_client_t *client);
+  ~JackBackend();
+
+  void activate(JackTransportLink *link) override;
+  void deactivate() override;
+
+  jack_port_t *portRegister(const char *name, const char *type,
+                            unsigned long flags) override;
+  void *portGetBuffer(jack_port_t *port, jack_nframes_t nframes) override;
+  jack_nframes_t portPlaybackLatency(jack_port_t *port) override;
+  jack_nframes_t systemPlaybackLatency() override;
+
+  int getCycleTimes(jack_nframes_t *currentFrames, jack_time_t *currentUsecs,
+                    jack_time_t *nextUsecs, float *periodUsecs) override;
+  std::chrono::microseconds sampleTimeToHostTime(double sampleTime) override;
+  jack_nframes_t sampleRate() override;
+  jack_nframes_t estimatedFrameTime() override;
+  jack_nframes_t bufferSize() override;
+  jack_transport_state_t transportQuery(jack_position_t *pos) override;
+  void midiClearBuffer(void *portBuffer) override;
+  int midiEventWrite(void *portBuffer, jack_nframes_t time,
+                     const jack_midi_data_t *data, size_t size) override;
+  uint32_t midiEventCount(void *portBuffer) override;
+  int midiEventGet(jack_midi_event_t *event, void *portBuffer,
+                   uint32_t index) override;
+
+  void transportStart() override;
+  void transportStop() override;
+  int transportReposition(const jack_position_t *pos) override;
+
+  bool clientUUID(jack_uuid_t &uuid) override;
+  bool getProperty(jack_uuid_t subject, const std::string &key,
+                   std::string &valueOut, std::string &typeOut) override;
+  int setProperty(jack_uuid_t subject, const char *key, const char *value,
+                  const char *type) override;
+
+private:
+  jack_client_t *mJackClient;
+  jack_uuid_t mJackClientUUID = 0;
+  bool mHaveUUID = false;
+  ableton::link::HostTimeFilter<ableton::link::platform::Clock>
+      mHostTimeFilter;
+};
@@ -1,14 +1,13 @@
 #include "JackTransportLink.hpp"
+#include "OscPublisher.hpp"
+#include "RTCheck.hpp"
+#include "TimelineWriter.hpp"
 
-#include <jack/midiport.h>
 #include <jack/uuid.h>
-#include <optional>
 #include <string>
 
 // debugging defines
 
-// #define DO_CLICK_OUT
-
 // send midi start at the start of every bar
 // #define MIDI_SEND_REPEATED_STARTS
 
@@ -25,28 +24,26 @@ const std::string
 const std::string
     start_stop_key("http://www.x37v.info/jack/metadata/link/start-stop-sync");
 const std::array<std::string, 2> true_values = {"true", "1"};
+// shortest time between writes of one property, peers churning or
+// controllers sending tempo changes otherwise flood the server
+const auto property_min_interval = std::chrono::milliseconds(100);
 
 const std::array<uint8_t, 1> midi_clock_buf = {248};
 const std::array<uint8_t, 1> midi_start_buf = {250};
+const std::array<uint8_t, 1> midi_continue_buf = {251};
 const std::array<uint8_t, 1> midi_stop_buf = {252};
-
-// helper to deal with dealloc and std::string
-bool get_property(jack_uuid_t subject, const std::string &key,
-                  std::string &value_out, std::string &type_out) {
-  char *values = nullptr;
-  char *types = nullptr;
-  if (jack_get_property(subject, key.c_str(), &values, &types) != 0)
-    return false;
-  if (values) {
-    value_out = std::string(values);
-    jack_free(values);
-  }
-  if (types) {
-    type_out = std::string(types);
-    jack_free(types);
-  }
-  return true;
-}
+const uint8_t midi_quarter_frame = 0xF1;
+const uint8_t midi_song_position = 0xF2;
+// song position pointer counts 16th notes
+const int midi_clocks_per_sixteenth = MIDI_PPQ / 4;
+const int midi_song_position_max = 0x3FFF;
+// smallest followed tempo change that we pass on to jack and link
+const double follow_bpm_resolution = 0.01;
+// osc time tags are ntp times, seconds since 1900 and a 32 bit fraction, 1
+// means immediately
+const uint64_t osc_immediate = 1;
+const int64_t ntp_unix_offset_seconds = 2208988800;
+} // namespace
 
 std::optional<double>
 GetOscDouble(const oscpack::ReceivedMessageArgument &arg) {
@@ -65,110 +62,508 @@ GetOscDouble(const oscpack::ReceivedMessageArgument &arg) {
   return std::nullopt;
 }
 
-} // namespace
-
-JackTransportLink::JackTransportLink(jack_client_t *client,
-                                     bool enableStartStopSync,
-                                     double initialBPM, double initialQuantum,
-                                     float initialTimeSigDenom,
-                                     double initialTicksPerBeat)
-    : mJackClient(client), mBPM(initialBPM), mQuantum(initialQuantum),
-      mInitialQuantum(initialQuantum),
-      mInitialTimeSigDenom(initialTimeSigDenom),
-      mInitialTicksPerBeat(initialTicksPerBeat), mLink(initialBPM),
-      mJackClientUUID(0) {
+JackTransportLink::JackTransportLink(std::unique_ptr<Backend> backend,
+                                     const Settings &settings,
+                                     std::shared_ptr<LinkSession> session)
+    : mBackend(std::move(backend)),
+      mSession(session ? std::move(session)
+                       : std::make_shared<LinkSession>(
+                             settings.initialBPM, settings.enableStartStopSync,
+                             settings.enableLink)),
+      mFollowStartStop(settings.enableStartStopSync),
+      mBPM(settings.initialBPM), mLinkBPM(settings.initialBPM),
+      mQuantum(settings.initialQuantum),
+      mInitialQuantum(settings.initialQuantum),
+      mInitialTimeSigDenom(settings.initialTimeSigDenom),
+      mInitialTicksPerBeat(settings.initialTicksPerBeat),
+      mRawHostTime(settings.rawHostTime),
+      mMaxStartHoldSeconds(settings.maxStartHoldSeconds), mJackClientUUID(0) {
   // setup listener
 
-  // setup link
-  mLink.setTempoCallback([this](double bpm) {
-    mLinkBPM = bpm;
-    if (mSyncLink) {
-      mBPM.store(bpm, std::memory_order_release);
-      mReportBPM = true;
-    }
-  });
-  if (enableStartStopSync) {
-    mLink.setStartStopCallback([this](bool isPlaying) {
-      if (mLink.isStartStopSyncEnabled() && mSyncLink) {
-        if (isPlaying) {
-          jack_transport_start(mJackClient);
-        } else {
-          jack_transport_stop(mJackClient);
-        }
-      }
-    });
+  // setup link, the session calls us back from here on
+  mSessionSlot = mSession->attach(this);
+  if (mSessionSlot < 0) {
+    std::cerr << "too many jack servers for one link session" << std::endl;
   }
-  mLink.enableStartStopSync(enableStartStopSync);
-  mLink.setNumPeersCallback(
-      [this](std::size_t numPeers) { setNumPeersProperty(numPeers); });
-  mLink.enable(true);
+  // a session shared with other servers may be well under way
+  mBPM = mLinkBPM = mSession->link().captureAppSessionState().tempo();
+  mJournalBPM = mBPM;
+  mNumPeers.store(mSession->link().numPeers());
 
   // intialize our properties
-  {
-    // try to get our uuid, if we can get it, we set the property and property
-    // callback
-    char *uuids;
-    if ((uuids = jack_get_uuid_for_client_name(
-             mJackClient, jack_get_client_name(mJackClient))) != nullptr &&
-        jack_uuid_parse(uuids, &mJackClientUUID) == 0) {
-      setBPMProperty(mBPM.load(std::memory_order_acquire));
-      setEnableStartStopProperty(mLink.isStartStopSyncEnabled());
-      setSyncProperty(mSyncLink);
-      setNumPeersProperty(mLink.numPeers());
-      jack_set_property_change_callback(
-          mJackClient, JackTransportLink::propertyChangeCallback, this);
-    } else {
-      std::cerr << "cannot get client uuid, property based settings won't work"
+  // try to get our uuid, if we can get it, we set the property and the
+  // backend sets up the property callback
+  if (mBackend->clientUUID(mJackClientUUID)) {
+    mProperties = std::make_unique<PropertyPublisher>(
+        *mBackend, mJackClientUUID, property_min_interval, mEvents,
+        mNotificationStats.propertyWrites,
+        mNotificationStats.propertyWritesSuppressed);
+    mBPMProperty = mProperties->add(bpm_key.c_str(), decimal_type,
+                                    PropertyPublisher::Type::Decimal);
+    mStartStopProperty = mProperties->add(start_stop_key.c_str(), bool_type,
+                                          PropertyPublisher::Type::Boolean);
+    mSyncProperty = mProperties->add(linksync_key.c_str(), bool_type,
+                                     PropertyPublisher::Type::Boolean);
+    mNumPeersProperty = mProperties->add(linknumpeers_key.c_str(), int_type,
+                                         PropertyPublisher::Type::Integer);
+    setBPMProperty(mBPM);
+    setEnableStartStopProperty(mSession->link().isStartStopSyncEnabled());
+    setSyncProperty(mControlSyncLink);
+    setNumPeersProperty(mSession->link().numPeers());
+  }
+
+  mSampleRate.store(mBackend->sampleRate());
+  mTempoMap.reset(static_cast<double>(mSampleRate.load()), mBPM);
+  mBufferSize.store(mBackend->bufferSize());
+
+  for (auto &clockPort : settings.clockPorts) {
+    auto out = std::make_unique<MIDIClockOutput>();
+    out->trimMs = clockPort.trimMs;
+    out->port = mBackend->portRegister(clockPort.name.c_str(),
+                                       JACK_DEFAULT_MIDI_TYPE,
+                                       JackPortFlags::JackPortIsOutput);
+    if (out->port == nullptr) {
+      std::cerr << "cannot register midi clock port " << clockPort.name
                 << std::endl;
+      continue;
     }
-    if (uuids) {
-      jack_free(uuids);
+    out->index = static_cast<int>(mClockOutputs.size());
+    mClockOutputs.push_back(std::move(out));
+  }
+  if (settings.mtcRate) {
+    mMTC.rate = *settings.mtcRate;
+    mMTC.port = mBackend->portRegister("mtc", JACK_DEFAULT_MIDI_TYPE,
+                                       JackPortFlags::JackPortIsOutput);
+  }
+  if (settings.followMIDIClock) {
+    mClockInPort = mBackend->portRegister("clock_in", JACK_DEFAULT_MIDI_TYPE,
+                                          JackPortFlags::JackPortIsInput);
+    if (mClockInPort == nullptr) {
+      std::cerr << "cannot register midi clock input port" << std::endl;
     }
   }
 
-  mMIDIClockOut =
-      jack_port_register(mJackClient, "clock", JACK_DEFAULT_MIDI_TYPE,
-                         JackPortFlags::JackPortIsOutput, 0);
+  if (settings.clickSubdivision > 0) {
+    mClickPort = mBackend->portRegister("click", JACK_DEFAULT_AUDIO_TYPE,
+                                        JackPortFlags::JackPortIsOutput);
+    if (mClickPort == nullptr) {
+      std::cerr << "cannot register click port" << std::endl;
+    } else {
+      mClick = std::make_unique<Click>(
+          static_cast<double>(mSampleRate.load()), settings.clickSubdivision);
+    }
+  }
 
-#ifdef DO_CLICK_OUT
-  mClickPort =
-      jack_port_register(mJackClient, "clickout", JACK_DEFAULT_AUDIO_TYPE,
-                         JackPortFlags::JackPortIsOutput, 0);
-#endif
+  if (settings.phaseCVDivision > 0) {
+    auto reg = [this](const char *name) {
+      auto port = mBackend->portRegister(name, JACK_DEFAULT_AUDIO_TYPE,
+                                         JackPortFlags::JackPortIsOutput);
+      if (port == nullptr) {
+        std::cerr << "cannot register " << name << " port" << std::endl;
+      }
+      return port;
+    };
+    mBeatPhasePort = reg("beat_phase");
+    mBarPhasePort = reg("bar_phase");
+    mGatePort = reg("gate");
+    mTriggerPort = reg("trigger");
+    mPhaseCV = std::make_unique<PhaseCV>(settings.phaseCVDivision);
+  }
+
+  // the session may have been playing since before this server came up,
+  // join in on its phase, like a peer would
+  mJoiningSession = mFollowStartStop &&
+                    mSession->link().isStartStopSyncEnabled() &&
+                    mSession->link().captureAppSessionState().isPlaying();
 
   // setup jack, become the timebase master, unconditionally
-  jack_set_process_callback(mJackClient, JackTransportLink::processCallback,
-                            this);
-  jack_set_timebase_callback(mJackClient, 0,
-                             JackTransportLink::timeBaseCallback, this);
-  jack_set_sync_callback(mJackClient, JackTransportLink::syncCallback, this);
-  jack_activate(mJackClient);
+  mBackend->activate(this);
+  // the graph may not change, ask once for the latency it has now
+  mSystemLatency.store(mBackend->systemPlaybackLatency(),
+                       std::memory_order_relaxed);
+  if (mJoiningSession) {
+    mBackend->transportStart();
+  }
 }
 
 JackTransportLink::~JackTransportLink() {
-  jack_set_sync_callback(mJackClient, nullptr, nullptr);
-  jack_release_timebase(mJackClient);
-  jack_deactivate(mJackClient);
-  jack_client_close(mJackClient);
+  mBackend->deactivate();
+  mSession->detach(mSessionSlot);
 }
 
 void JackTransportLink::processEvents() {
-  if (mReportBPM) {
-    mReportBPM = false;
-    setBPMProperty(mBPM.load(std::memory_order_acquire));
+  mEvents.drain();
+  if (unsigned changed = mPropertiesChanged.exchange(0)) {
+    readProperties(changed);
+  }
+  if (unsigned deleted = mPropertiesDeleted.exchange(0)) {
+    for (int property : {mBPMProperty, mStartStopProperty, mSyncProperty}) {
+      if ((deleted & (1u << property)) != 0) {
+        mProperties->invalidate(property);
+      }
+    }
+  }
+  if (mReportBPM.exchange(false)) {
+    setBPMProperty(snapshot().bpm);
+  }
+  if (mReportLinkSync.exchange(false)) {
+    bool sync;
+    {
+      std::lock_guard<std::mutex> lock(mControlMutex);
+      sync = mControlSyncLink;
+    }
+    setSyncProperty(sync);
+  }
+  if (mReportStartStopEnable.exchange(false)) {
+    setEnableStartStopProperty(mSession->link().isStartStopSyncEnabled());
+  }
+}
+
+int JackTransportLink::publishProperties() {
+  return mProperties ? mProperties->publish() : -1;
+}
+
+void JackTransportLink::linkTempoChanged(double bpm) {
+  std::lock_guard<std::mutex> lock(mControlMutex);
+  pushCommand(ControlCommand::Type::LinkTempo, bpm);
+}
+
+void JackTransportLink::linkStartStopChanged(bool isPlaying) {
+  if (!mFollowStartStop) {
+    return;
+  }
+  bool sync;
+  {
+    std::lock_guard<std::mutex> lock(mControlMutex);
+    sync = mControlSyncLink;
+  }
+  if (mSession->link().isStartStopSyncEnabled() && sync) {
+    if (isPlaying) {
+      mBackend->transportStart();
+    } else {
+      mBackend->transportStop();
+    }
+  }
+}
+
+void JackTransportLink::linkNumPeersChanged(size_t numPeers) {
+  mNumPeers.store(numPeers, std::memory_order_relaxed);
+  journalNow(JournalEvent::Type::LinkPeers, static_cast<double>(numPeers));
+  setNumPeersProperty(numPeers);
+}
+
+void JackTransportLink::linkStartStopSyncChanged() {
+  mReportStartStopEnable = true;
+  notifyEvents();
+}
+
+void JackTransportLink::setBPM(double bpm) {
+  std::lock_guard<std::mutex> lock(mControlMutex);
+  pushCommand(ControlCommand::Type::SetBPM, bpm);
+}
+
+void JackTransportLink::setSyncLink(bool sync) {
+  std::lock_guard<std::mutex> lock(mControlMutex);
+  mControlSyncLink = sync;
+  pushCommand(ControlCommand::Type::SetSyncLink, sync ? 1.0 : 0.0);
+}
+
+JackTransportLink::RTSnapshot JackTransportLink::snapshot() const {
+  return mSnapshot.read();
+}
+
+std::optional<std::chrono::steady_clock::time_point>
+JackTransportLink::firstProcessTime() const {
+  int64_t nanos = mFirstProcessNanos.load(std::memory_order_relaxed);
+  if (nanos == 0) {
+    return std::nullopt;
+  }
+  return std::chrono::steady_clock::time_point(
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::nanoseconds(nanos)));
+}
+
+void JackTransportLink::setOscPublisher(OscPublisher *publisher) {
+  mOscPublisher = publisher;
+}
+
+void JackTransportLink::setTimelineWriter(TimelineWriter *writer) {
+  mTimelineWriter.store(writer, std::memory_order_release);
+}
+
+void JackTransportLink::setJournal(Journal *journal, uint16_t source) {
+  mJournalSource.store(source, std::memory_order_relaxed);
+  mJournal.store(journal, std::memory_order_release);
+}
+
+void JackTransportLink::setOutputLatencyOffset(double ms) {
+  mOutputLatencyOffsetMs.store(ms, std::memory_order_relaxed);
+}
+
+bool JackTransportLink::pushCommand(ControlCommand::Type type, double value,
+                                    bool report) {
+  ControlCommand cmd;
+  cmd.type = type;
+  cmd.value = value;
+  cmd.report = report;
+  cmd.cycle = mPublishedCycle.load(std::memory_order_relaxed);
+  if (!mCommands.push(cmd)) {
+    std::cerr << "control command queue full, dropping command" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void JackTransportLink::applyCommands() {
+  ControlCommand cmd;
+  while (mCommands.pop(cmd)) {
+    mMaxCommandLatency = std::max(mMaxCommandLatency, mCycle - cmd.cycle);
+    switch (cmd.type) {
+    case ControlCommand::Type::SetBPM:
+      mBPM = cmd.value;
+      break;
+    case ControlCommand::Type::SetSyncLink: {
+      bool sync = cmd.value != 0.0;
+      if (sync && !mSyncLink) {
+        mBPM = mLinkBPM;
+      }
+      mSyncLink = sync;
+    } break;
+    case ControlCommand::Type::Locate: {
+      jack_position_t pos;
+      mBackend->transportQuery(&pos);
+      pos.frame = locateFrame(cmd.value);
+      mBackend->transportReposition(&pos);
+    } break;
+    case ControlCommand::Type::LinkTempo:
+      mRTStats.linkTempoChanges.increment();
+      mLinkBPM = cmd.value;
+      // the clock we follow sets the tempo, not link
+      if (!mSyncLink || mClockInPort != nullptr) {
+        continue;
+      }
+      mBPM = cmd.value;
+      break;
+    }
+    if (cmd.report) {
+      mBPMToReport = true;
+    }
+  }
+}
+
+bool JackTransportLink::schedule(ScheduledEvent::Type type, double value) {
+  if (!mOscTime) {
+    return false;
   }
-  if (mReportLinkSync) {
-    mReportLinkSync = false;
-    setSyncProperty(mSyncLink);
+  ScheduledEvent event;
+  event.type = type;
+  event.value = value;
+  event.time = *mOscTime;
+  if (!mScheduleQueue.push(event)) {
+    std::cerr << "osc schedule full, applying message now" << std::endl;
+    return false;
   }
-  if (mReportStartStopEnable) {
-    mReportStartStopEnable = false;
-    setEnableStartStopProperty(mLink.isStartStopSyncEnabled());
+  return true;
+}
+
+void JackTransportLink::applyScheduled(jack_nframes_t nframes,
+                                       std::chrono::microseconds &tempoTime) {
+  mTempoOffset = 0;
+  // keep them in time order, anything that doesn't fit waits in the queue
+  ScheduledEvent event;
+  while (mScheduledCount < mScheduled.size() && mScheduleQueue.pop(event)) {
+    size_t i = mScheduledCount++;
+    for (; i > 0 && mScheduled[i - 1].time > event.time; i--) {
+      mScheduled[i] = mScheduled[i - 1];
+    }
+    mScheduled[i] = event;
   }
+  if (mScheduledCount == 0) {
+    return;
+  }
+
+  const double sr =
+      static_cast<double>(mSampleRate.load(std::memory_order_relaxed));
+  const auto period = mTimeNext - mTime;
+  size_t kept = 0;
+  for (size_t i = 0; i < mScheduledCount; i++) {
+    const auto &e = mScheduled[i];
+    // a tempo change takes effect within the next cycle, the one the
+    // timebase callback fills in the position for. Jack only moves the
+    // transport at the start of a cycle so starts, stops and locates are
+    // sent the cycle before
+    auto due = mTimeNext + period;
+    if (e.time >= due) {
+      mScheduled[kept++] = e;
+      continue;
+    }
+    switch (e.type) {
+    case ScheduledEvent::Type::SetBPM: {
+      // on the frame the tag falls on, late ones at the start of the cycle
+      auto start = mTimeNext;
+      double offset = std::round(
+          std::max(0.0, static_cast<double>((e.time - start).count()) * sr /
+                            1e6));
+      mTempoOffset = static_cast<jack_nframes_t>(
+          std::min(offset, static_cast<double>(nframes - 1)));
+      tempoTime =
+          start + std::chrono::microseconds(std::llround(
+                      static_cast<double>(mTempoOffset) * 1e6 / sr));
+      mBPM = e.value;
+      mBPMToReport = true;
+    } break;
+    case ScheduledEvent::Type::Rolling:
+      if (e.value != 0.0) {
+        mBackend->transportStart();
+      } else {
+        mBackend->transportStop();
+      }
+      break;
+    case ScheduledEvent::Type::Locate: {
+      jack_position_t pos;
+      auto state = mBackend->transportQuery(&pos);
+      pos.frame = locateFrame(e.value);
+      mBackend->transportReposition(&pos);
+      // stopped, the beat simply waits there
+      if (state == jack_transport_state_t::JackTransportRolling) {
+        mLocateBeat = e.value;
+        mLocateTime = e.time;
+      }
+    } break;
+    }
+  }
+  mScheduledCount = kept;
+}
+
+jack_nframes_t JackTransportLink::locateFrame(double beat) const {
+  return static_cast<jack_nframes_t>(
+      std::max(0.0, std::round(mTempoMap.frameAt(beat))));
+}
+
+void JackTransportLink::notifyEvents() {
+  // a single non blocking eventfd write, only made when a report flag is
+  // raised and on the first cycle, the one syscall the realtime callbacks are
+  // allowed
+  RT_CHECK_WAKEUP();
+  mEvents.notify();
 }
 
 int JackTransportLink::processCallback(jack_nframes_t nframes, void *arg) {
-  return reinterpret_cast<JackTransportLink *>(arg)->processCallback(nframes);
+  auto self = reinterpret_cast<JackTransportLink *>(arg);
+  auto start = std::chrono::steady_clock::now();
+  if (self->mFirstProcessNanos.load(std::memory_order_relaxed) == 0) {
+    self->mFirstProcessNanos.store(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            start.time_since_epoch())
+            .count(),
+        std::memory_order_relaxed);
+    self->notifyEvents();
+  }
+  int r = self->processCallback(nframes);
+  self->mRTStats.processNanos.record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+  return r;
+}
+
+int JackTransportLink::sampleRateCallback(jack_nframes_t nframes, void *arg) {
+  reinterpret_cast<JackTransportLink *>(arg)->mSampleRate.store(
+      nframes, std::memory_order_relaxed);
+  return 0;
+}
+
+int JackTransportLink::bufferSizeCallback(jack_nframes_t nframes, void *arg) {
+  reinterpret_cast<JackTransportLink *>(arg)->mBufferSize.store(
+      nframes, std::memory_order_relaxed);
+  return 0;
+}
+
+int JackTransportLink::xrunCallback(void *arg) {
+  auto self = reinterpret_cast<JackTransportLink *>(arg);
+  self->mNotificationStats.xruns.increment();
+  self->journalNow(
+      JournalEvent::Type::Xrun,
+      static_cast<double>(self->mNotificationStats.xruns.value()));
+  return 0;
+}
+
+void JackTransportLink::latencyCallback(jack_latency_callback_mode_t mode,
+                                        void *arg) {
+  reinterpret_cast<JackTransportLink *>(arg)->latencyCallback(mode);
+}
+
+void JackTransportLink::latencyCallback(jack_latency_callback_mode_t mode) {
+  if (mode != JackPlaybackLatency) {
+    return;
+  }
+  mSystemLatency.store(mBackend->systemPlaybackLatency(),
+                       std::memory_order_relaxed);
+  for (auto &out : mClockOutputs) {
+    out->portLatency.store(mBackend->portPlaybackLatency(out->port),
+                           std::memory_order_relaxed);
+  }
+  if (mMTC.port != nullptr) {
+    mMTC.portLatency.store(mBackend->portPlaybackLatency(mMTC.port),
+                           std::memory_order_relaxed);
+  }
+}
+
+void JackTransportLink::ClockConstants::update(double bpm, double ticksPerBeat,
+                                               double sampleRate) {
+  if (bpm == this->bpm && ticksPerBeat == this->ticksPerBeat &&
+      sampleRate == this->sampleRate) {
+    return;
+  }
+  this->bpm = bpm;
+  this->ticksPerBeat = ticksPerBeat;
+  this->sampleRate = sampleRate;
+
+  const double clocksPerBeat = MIDI_PPQ;
+  framesPerTick = 60.0 * sampleRate / (ticksPerBeat * bpm);
+  ticksPerClock = ticksPerBeat / clocksPerBeat;
+  framesPerClock = framesPerTick * ticksPerClock;
+
+  // delay clock 1ms or half a clock period
+  // http://midi.teragonaudio.com/tech/midispec.htm
+  startDelayFrames = std::min(framesPerClock / 2.0, sampleRate / 1000.0);
+}
+
+void JackTransportLink::CycleTimeError::add(double usecs, double periodUsecs) {
+  if (last >= 0.0) {
+    double error = std::abs(usecs - last - periodUsecs);
+    sumSquares += error * error;
+    max = std::max(max, error);
+    count++;
+  }
+  last = usecs;
+}
+
+double JackTransportLink::CycleTimeError::rms() const {
+  return count > 0 ? std::sqrt(sumSquares / static_cast<double>(count)) : 0.0;
+}
+
+double JackTransportLink::FreeRunTimeline::advance(
+    double beat, double bpm, jack_nframes_t sampleRate, jack_nframes_t nframes,
+    jack_nframes_t tempoOffset) {
+  // re-anchor if the beat was set (locate, resync, link) or the rate changed
+  if (beat != this->beat || sampleRate != this->sampleRate) {
+    anchorFrame = frames;
+    anchorBeat = beat;
+    this->bpm = bpm;
+    this->sampleRate = sampleRate;
+  } else if (bpm != this->bpm) {
+    // rolled at the old tempo up to the change
+    tempoOffset = std::min(tempoOffset, nframes);
+    anchorBeat = beat + static_cast<double>(tempoOffset) * this->bpm /
+                            (60.0 * static_cast<double>(sampleRate));
+    anchorFrame = frames + tempoOffset;
+    this->bpm = bpm;
+  }
+  frames += nframes;
+  this->beat = anchorBeat + static_cast<double>(frames - anchorFrame) * bpm /
+                                (60.0 * static_cast<double>(sampleRate));
+  return this->beat;
 }
 
 void updateBBT(int32_t &bar, int32_t &beat, double &tick, double ticks_per_beat,
@@ -184,20 +579,57 @@ void updateBBT(int32_t &bar, int32_t &beat, double &tick, double ticks_per_beat,
 }
 
 int JackTransportLink::processCallback(jack_nframes_t nframes) {
+  RT_CHECK_SCOPE();
+
+  // control changes are applied at the cycle boundary
+  mCycle++;
+  mPublishedCycle.store(mCycle, std::memory_order_relaxed);
+  applyCommands();
+  mSession->beginCycle(mSessionSlot, mQuantum);
+
   // compute the time, the timeBaseCallback is called right after this
-  // processCallback
+  // processCallback. Link wants times on its own clock, the backend maps our
+  // frame count onto it and filters out the scheduling jitter.
   {
+    const double periodUsecs =
+        1e6 * static_cast<double>(nframes) /
+        static_cast<double>(mSampleRate.load(std::memory_order_relaxed));
+    auto hostTime =
+        mBackend->sampleTimeToHostTime(static_cast<double>(mSampleTime));
+    mTime = hostTime;
+    mTimeNext = hostTime + std::chrono::microseconds(std::llround(periodUsecs));
+    mFilteredTimeError.add(static_cast<double>(hostTime.count()), periodUsecs);
+
     jack_nframes_t frameTime;
     jack_time_t cur, next;
     float period;
-    if (jack_get_cycle_times(mJackClient, &frameTime, &cur, &next, &period) ==
-        0) {
-      mTime = std::chrono::microseconds(cur);
-      mTimeNext = std::chrono::microseconds(next);
+    if (mBackend->getCycleTimes(&frameTime, &cur, &next, &period) == 0) {
+      mCycleFrameTime = frameTime;
+      mRawTimeError.add(static_cast<double>(cur), periodUsecs);
+      if (mRawHostTime) {
+        mTime = std::chrono::microseconds(cur);
+        mTimeNext = std::chrono::microseconds(next);
+      }
     } else {
       // report?
     }
+
+    // link's time is when the audio is heard, after the system outputs'
+    // playback latency and whatever the user adds for the outboard gear.
+    // Clients render the position we give jack, so what our speakers play
+    // lines up with what the peers play
+    const double sr =
+        static_cast<double>(mSampleRate.load(std::memory_order_relaxed));
+    mOutputLatencyFrames =
+        static_cast<double>(mSystemLatency.load(std::memory_order_relaxed)) +
+        mOutputLatencyOffsetMs.load(std::memory_order_relaxed) * sr / 1000.0;
+    mOutputLatency = std::chrono::microseconds(
+        std::llround(mOutputLatencyFrames * 1e6 / sr));
+    mTime += mOutputLatency;
+    mTimeNext += mOutputLatency;
   }
+  auto tempoTime = mTimeNext;
+  applyScheduled(nframes, tempoTime);
 
   jack_position_t pos;
 
@@ -216,17 +648,51 @@ int JackTransportLink::processCallback(jack_nframes_t nframes) {
 
   // when the session state is stopped, timeBaseCallback isn't called, so we
   // report start/stop in the processCallback
-  auto transportState = jack_transport_query(mJackClient, &pos);
+  auto transportState = mBackend->transportQuery(&pos);
+  if (transportState != mJournalState) {
+    journal(JournalEvent::Type::TransportState,
+            static_cast<double>(transportState),
+            static_cast<double>(pos.frame));
+    mJournalState = transportState;
+  }
+  // the sync callback holds starts from stopped, the timebase callback
+  // measures the phase of the first rolling cycle
+  if (transportState == jack_transport_state_t::JackTransportStopped) {
+    mStartFromStopped = true;
+  }
+  mMeasureStartPhase = false;
+  if (transportState == jack_transport_state_t::JackTransportRolling) {
+    mMeasureStartPhase = mStartFromStopped;
+    mStartFromStopped = false;
+  }
+  if (transportState != jack_transport_state_t::JackTransportStarting) {
+    mStartHeldFrames = 0;
+  }
+  if (mClockInPort != nullptr) {
+    double clockBeat = readMIDIClock(transportState, nframes);
+    if (clockBeat >= 0.0) {
+      mInternalBeat = clockBeat;
+      if (mSyncLink) {
+        beatrequest = clockBeat;
+      } else {
+        resyncMIDIClock();
+      }
+    }
+  }
+  if (mBPM != mJournalBPM) {
+    journal(JournalEvent::Type::Tempo, mBPM, mJournalBPM);
+    mJournalBPM = mBPM;
+  }
   bool bbtValid = pos.valid & JackPositionBBT;
   // always considered "playing" if it isn't stopped
   auto rolling = transportState != jack_transport_state_t::JackTransportStopped;
   bool stateChange = transportState != mTransportStateReportedLast;
-  double bpm = mBPM.load(std::memory_order_acquire);
+  double bpm = mBPM;
   bool bpmChange = bbtValid && pos.beats_per_minute != bpm;
-  auto linkTime = mTimeNext; // now plus some latency
+  auto linkTime = mTimeNext; // the next cycle, as heard
   if (mSyncLink && (stateChange || bpmChange || beatrequest >= 0.0)) {
-    bool havePeers = mLink.numPeers() > 0;
-    auto sessionState = mLink.captureAudioSessionState();
+    bool havePeers = keepSessionPhase();
+    auto sessionState = mSession->captureAudioSessionState(mSessionSlot);
     if (stateChange) {
       sessionState.setIsPlaying(rolling, linkTime);
       // request beat while starting (or if we missed staring somehow)
@@ -235,265 +701,539 @@ int JackTransportLink::processCallback(jack_nframes_t nframes) {
            mTransportStateReportedLast !=
                jack_transport_state_t::JackTransportStarting)) {
         if (havePeers) {
-          sessionState.requestBeatAtStartPlayingTime(mInternalBeat, mQuantum);
+          // we just started playing at linkTime
+          mSession->requestBeatAtTime(mSessionSlot, sessionState,
+                                      mInternalBeat, linkTime, mQuantum);
         } else {
-          sessionState.forceBeatAtTime(mInternalBeat, linkTime, mQuantum);
+          mSession->forceBeatAtTime(mSessionSlot, sessionState, mInternalBeat,
+                                    linkTime, mQuantum);
           beatrequest = -1.0;
         }
       }
       mTransportStateReportedLast = transportState;
     }
     if (bpmChange) {
-      sessionState.setTempo(bpm, linkTime);
+      sessionState.setTempo(bpm, tempoTime);
     }
 
     if (beatrequest >= 0) {
       if (havePeers) {
-        sessionState.requestBeatAtTime(mInternalBeat, linkTime, mQuantum);
+        mSession->requestBeatAtTime(mSessionSlot, sessionState, mInternalBeat,
+                                    linkTime, mQuantum);
       } else {
-        sessionState.forceBeatAtTime(mInternalBeat, linkTime, mQuantum);
+        mSession->forceBeatAtTime(mSessionSlot, sessionState, mInternalBeat,
+                                  linkTime, mQuantum);
       }
     }
-    mLink.commitAudioSessionState(sessionState);
+    mSession->commitAudioSessionState(mSessionSlot, sessionState);
+  }
+  if (transportState == jack_transport_state_t::JackTransportRolling) {
+    mJoiningSession = false;
   }
 
   if (beatrequest >= 0.0) {
-    mMIDIClockRunState = MIDIClockRunState::NeedsSync;
-    invalidateClockSyncBBT();
+    resyncMIDIClock();
   }
 
-#ifndef DO_CLICK_OUT
   // write midi sync
-  auto midi_buf = jack_port_get_buffer(mMIDIClockOut, nframes);
-  jack_midi_clear_buffer(midi_buf);
-
-  if (bbtValid) {
-    if (rolling) {
-      const double clocksPerBeat = MIDI_PPQ;
-      const double sr = static_cast<double>(jack_get_sample_rate(mJackClient));
-
-      int32_t beat = pos.beat - 1;
-      int32_t bar = pos.bar - 1;
-      double tick = static_cast<double>(pos.tick);
-
-      double framesPerTick =
-          60.0 * sr / (pos.ticks_per_beat * pos.beats_per_minute);
-      double ticksPerClock = pos.ticks_per_beat / clocksPerBeat;
-      double framesPerClock = framesPerTick * ticksPerClock;
-
-      // offset from buffer tick start to the tick where we should issue the
-      // first clock
-      double offsetTicks = std::fmod(tick, ticksPerClock);
-      offsetTicks = offsetTicks <= 0.0 ? 0.0 : (ticksPerClock - offsetTicks);
-
-      // update the tick
-      tick = tick + offsetTicks;
-      const int beatsPerBar = static_cast<int>(pos.beats_per_bar);
+  if (bbtValid && rolling) {
+    mClockConstants.update(
+        pos.beats_per_minute, pos.ticks_per_beat,
+        static_cast<double>(mSampleRate.load(std::memory_order_relaxed)));
+  }
+  for (auto &out : mClockOutputs) {
+    writeMIDIClock(*out, pos, transportState, nframes);
+  }
+
+  if (mClick || mPhaseCV) {
+    // the exact beat we put in this position, the BBT has whole ticks
+    double beat = 0.0;
+    if (bbtValid) {
+      beat = pos.frame == mPositionFrame
+                 ? mPositionBeat
+                 : (pos.bar - 1) * static_cast<double>(pos.beats_per_bar) +
+                       (pos.beat - 1) + pos.tick / pos.ticks_per_beat;
+    }
+    double sampleRate =
+        static_cast<double>(mSampleRate.load(std::memory_order_relaxed));
+    bool rolling =
+        bbtValid &&
+        transportState == jack_transport_state_t::JackTransportRolling;
+    if (mClick) {
+      mClick->process(reinterpret_cast<jack_default_audio_sample_t *>(
+                          mBackend->portGetBuffer(mClickPort, nframes)),
+                      nframes, sampleRate, beat, pos.beats_per_minute,
+                      pos.beats_per_bar, rolling);
+    }
+    if (mPhaseCV) {
+      auto buffer = [this, nframes](jack_port_t *port) {
+        return port == nullptr
+                   ? nullptr
+                   : reinterpret_cast<jack_default_audio_sample_t *>(
+                         mBackend->portGetBuffer(port, nframes));
+      };
+      PhaseCV::Outputs outputs;
+      outputs.beatPhase = buffer(mBeatPhasePort);
+      outputs.barPhase = buffer(mBarPhasePort);
+      outputs.gate = buffer(mGatePort);
+      outputs.trigger = buffer(mTriggerPort);
+      mPhaseCV->process(outputs, nframes, sampleRate, beat,
+                        pos.beats_per_minute, pos.beats_per_bar, rolling);
+    }
+  }
+
+  if (mMTC.port != nullptr) {
+    writeMTC(pos, transportState, nframes);
+  }
+
+  // the timeBaseCallback publishes while rolling
+  if (!rolling) {
+    publishTimeline(false);
+  }
+
+  {
+    RTSnapshot snapshot;
+    snapshot.cycle = mCycle;
+    snapshot.bpm = mBPM;
+    snapshot.quantum = mQuantum;
+    snapshot.beat = mInternalBeat;
+    if (bbtValid) {
+      snapshot.bar = pos.bar;
+      snapshot.barBeat = pos.beat;
+      snapshot.tick = pos.tick;
+    }
+    snapshot.syncLink = mSyncLink;
+    snapshot.transportState = transportState;
+    snapshot.numPeers = static_cast<uint32_t>(
+        mNumPeers.load(std::memory_order_relaxed));
+    snapshot.maxCommandLatency = mMaxCommandLatency;
+    snapshot.rawTimeErrorRms = mRawTimeError.rms();
+    snapshot.rawTimeErrorMax = mRawTimeError.max;
+    snapshot.filteredTimeErrorRms = mFilteredTimeError.rms();
+    snapshot.filteredTimeErrorMax = mFilteredTimeError.max;
+    mSnapshot.write(snapshot);
+  }
+  // only now that processEvents reads the new tempo from the snapshot
+  if (mBPMToReport) {
+    mBPMToReport = false;
+    if (!mReportBPM.exchange(true)) {
+      notifyEvents();
+    }
+  }
+
+  mSampleTime += nframes;
+
+  return 0;
+}
+
+void JackTransportLink::writeMIDIClock(MIDIClockOutput &out,
+                                       const jack_position_t &pos,
+                                       jack_transport_state_t transportState,
+                                       jack_nframes_t nframes) {
+  auto midi_buf = mBackend->portGetBuffer(out.port, nframes);
+  mBackend->midiClearBuffer(midi_buf);
+
+  if (!(pos.valid & JackPositionBBT)) {
+    return;
+  }
+
+  if (transportState != jack_transport_state_t::JackTransportStopped) {
+    int32_t beat = pos.beat - 1;
+    int32_t bar = pos.bar - 1;
+    double tick = static_cast<double>(pos.tick);
+
+    const double framesPerTick = mClockConstants.framesPerTick;
+    const double ticksPerClock = mClockConstants.ticksPerClock;
+    const double framesPerClock = mClockConstants.framesPerClock;
+    const int beatsPerBar = static_cast<int>(pos.beats_per_bar);
+
+    // generate the clock for the timeline this port's latency ahead of us, so
+    // that it is heard at the same time as the audio of this position, which
+    // is the output latency away. Look ahead, or behind when the port is
+    // quicker than the audio, by whole ticks, like the position we start
+    // from, and write the events the remainder earlier.
+    double latency =
+        static_cast<double>(out.portLatency.load(std::memory_order_relaxed)) +
+        out.trimMs * mClockConstants.sampleRate / 1000.0 -
+        mOutputLatencyFrames;
+    double earlyFrames = 0.0;
+    if (latency != 0.0) {
+      double lookaheadTicks = std::floor(latency / framesPerTick);
+      earlyFrames = latency - lookaheadTicks * framesPerTick;
+      tick += lookaheadTicks;
+      double beats = std::floor(tick / pos.ticks_per_beat);
+      tick -= beats * pos.ticks_per_beat;
+      // behind the start of the timeline the bar goes negative, no start or
+      // continue is sent until it is back to 0
+      int32_t total = bar * beatsPerBar + beat + static_cast<int32_t>(beats);
+      bar = total / beatsPerBar - (total % beatsPerBar < 0 ? 1 : 0);
+      beat = total - bar * beatsPerBar;
+    }
+
+    // offset from buffer tick start to the tick where we should issue the
+    // first clock
+    double offsetTicks = std::fmod(tick, ticksPerClock);
+    offsetTicks = offsetTicks <= 0.0 ? 0.0 : (ticksPerClock - offsetTicks);
+
+    // update the tick
+    tick = tick + offsetTicks;
+    updateBBT(bar, beat, tick, pos.ticks_per_beat, beatsPerBar);
+    double nextClockFrame = offsetTicks * framesPerTick;
+
+    // skip dupes
+    if (out.barLast == bar && out.beatLast == beat &&
+        std::abs(out.tickLast - tick) < 0.5) {
+      tick += ticksPerClock;
+      nextClockFrame += ticksPerClock * framesPerTick;
       updateBBT(bar, beat, tick, pos.ticks_per_beat, beatsPerBar);
-      double nextClockFrame = offsetTicks * framesPerTick;
-
-      // skip dupes
-      if (mBarLast == bar && mBeatLast == beat &&
-          std::abs(mTickLast - tick) < 0.5) {
-        // std::cout << "dupe found: " << bar << ":" << beat << ":" << tick <<
-        // std::endl;
-        tick += ticksPerClock;
-        nextClockFrame += ticksPerClock * framesPerTick;
-        updateBBT(bar, beat, tick, pos.ticks_per_beat, beatsPerBar);
-      }
+    }
 
-      if (mMIDIClockRunState == MIDIClockRunState::NeedsSync) {
-        jack_midi_event_write(midi_buf, 0, midi_stop_buf.data(),
-                              midi_stop_buf.size());
-        mMIDIClockRunState = MIDIClockRunState::Stopped;
-      }
+    if (out.runState == MIDIClockRunState::NeedsSync) {
+      mBackend->midiEventWrite(midi_buf, 0, midi_stop_buf.data(),
+                               midi_stop_buf.size());
+      out.runState = MIDIClockRunState::NeedsContinue;
+      journal(JournalEvent::Type::MIDIResync, out.index);
+    }
 
-      double frame = nextClockFrame;
-      while (floor(frame + mClockFrameDelay) < static_cast<double>(nframes)) {
-        if (mMIDIClockRunState == MIDIClockRunState::Running) {
-          jack_nframes_t f =
-              static_cast<jack_nframes_t>(frame + mClockFrameDelay);
-          mClockFrameDelay = 0;
-
-          // verify that we're keeping in sync with 24 clocks per quarter note
-          bool resync = false;
-          if (mMIDIClockCount == 0) {
-            resync = tick >= ticksPerClock;
-          } else if (tick < ticksPerClock) {
-            resync = true;
-          }
-
-          if (resync) {
-            // std::cout << "clock out of sync? bar: " << bar << " beat: " <<
-            // beat << " tick: " << tick << " clock count: " << mMIDIClockCount
-            // << std::endl; std::cout << "\tframes per clock: " <<
-            // framesPerClock << " ticks per clock:" <<  ticksPerClock << "
-            // frames per tick: " << framesPerTick << std::endl;
-            // TODO could we be smarter and simply issue some extra or skip some
-            // clocks?
-            mMIDIClockRunState = MIDIClockRunState::NeedsSync;
-            jack_midi_event_write(midi_buf, f, midi_stop_buf.data(),
-                                  midi_stop_buf.size());
-            break;
-          }
+    auto eventFrame = [earlyFrames](double frame) {
+      return static_cast<jack_nframes_t>(std::max(0.0, frame - earlyFrames));
+    };
+
+    // written early, the clocks just past the end of the cycle are in it
+    double frame = nextClockFrame;
+    while (std::floor(frame + out.clockFrameDelay - earlyFrames) <
+           static_cast<double>(nframes)) {
+      if (out.runState == MIDIClockRunState::Running) {
+        jack_nframes_t f = eventFrame(frame + out.clockFrameDelay);
+        out.clockFrameDelay = 0;
+
+        // verify that we're keeping in sync with 24 clocks per quarter note
+        bool resync = false;
+        if (out.clockCount == 0) {
+          resync = tick >= ticksPerClock;
+        } else if (tick < ticksPerClock) {
+          resync = true;
+        }
+
+        if (resync) {
+          // TODO could we be smarter and simply issue some extra or skip some
+          // clocks?
+          mRTStats.clockResyncs.increment();
+          journal(JournalEvent::Type::MIDIResync, out.index);
+          out.runState = MIDIClockRunState::NeedsContinue;
+          mBackend->midiEventWrite(midi_buf, f, midi_stop_buf.data(),
+                                   midi_stop_buf.size());
+          break;
+        }
 
 #ifdef MIDI_SEND_REPEATED_STARTS
-          if (beat == 0 && mMIDIClockCount == 0) {
-            jack_midi_event_write(midi_buf, frame, midi_start_buf.data(),
-                                  midi_start_buf.size());
-          }
+        if (beat == 0 && out.clockCount == 0) {
+          mBackend->midiEventWrite(midi_buf, f, midi_start_buf.data(),
+                                   midi_start_buf.size());
+        }
 #endif
 
-          jack_midi_event_write(midi_buf, f, midi_clock_buf.data(),
-                                midi_clock_buf.size());
-          mMIDIClockCount = (mMIDIClockCount + 1) % MIDI_PPQ;
-        } else if (beat == 0 && tick < ticksPerClock && tick >= 0 && bar >= 0) {
-          // see if we need to send a start
-          mMIDIClockRunState = MIDIClockRunState::Running;
+        mBackend->midiEventWrite(midi_buf, f, midi_clock_buf.data(),
+                                 midi_clock_buf.size());
+        out.clockCount = (out.clockCount + 1) % MIDI_PPQ;
+      } else if (out.runState == MIDIClockRunState::NeedsContinue &&
+                 tick >= 0 && bar >= 0 &&
+                 writeMIDIContinue(out, midi_buf, eventFrame(frame), bar, beat,
+                                   beatsPerBar, tick)) {
+        journal(JournalEvent::Type::MIDIContinue, out.index,
+                bar * beatsPerBar + beat + tick / pos.ticks_per_beat);
+        out.clockFrameDelay = mClockConstants.startDelayFrames;
+        continue; // restart loop
+      } else if (beat == 0 && tick < ticksPerClock && tick >= 0 && bar >= 0) {
+        // see if we need to send a start
+        out.runState = MIDIClockRunState::Running;
+        journal(JournalEvent::Type::MIDIStart, out.index);
 #ifndef MIDI_SEND_REPEATED_STARTS
-          jack_midi_event_write(midi_buf, static_cast<jack_nframes_t>(frame),
-                                midi_start_buf.data(), midi_start_buf.size());
+        mBackend->midiEventWrite(midi_buf, eventFrame(frame),
+                                 midi_start_buf.data(), midi_start_buf.size());
 #endif
 
-          // std::cout << "start " << frame << " tick: " << tick << std::endl;
-
-          // delay clock 1ms or half a clock period
-          // http://midi.teragonaudio.com/tech/midispec.htm
-          mClockFrameDelay = std::min(framesPerClock / 2.0, sr / 1000.0);
-          mMIDIClockCount = 0;
-          continue; // restart loop
-        }
+        out.clockFrameDelay = mClockConstants.startDelayFrames;
+        out.clockCount = 0;
+        continue; // restart loop
+      }
 
-        mTickLast = tick;
-        mBeatLast = beat;
-        mBarLast = bar;
+      out.tickLast = tick;
+      out.beatLast = beat;
+      out.barLast = bar;
 
-        tick += ticksPerClock;
-        frame = frame + framesPerClock;
-        updateBBT(bar, beat, tick, pos.ticks_per_beat, beatsPerBar);
-      }
-    } else if (transportState == JackTransportStopped &&
-               mMIDIClockRunState != MIDIClockRunState::Stopped) {
-      mClockFrameDelay = 0;
-      mMIDIClockRunState = MIDIClockRunState::Stopped;
-      jack_midi_event_write(midi_buf, 0, midi_stop_buf.data(),
-                            midi_stop_buf.size());
-      invalidateClockSyncBBT();
-    }
-  }
-#else
-  if (mClickPort != nullptr) {
-    jack_default_audio_sample_t *buf =
-        reinterpret_cast<jack_default_audio_sample_t *>(
-            jack_port_get_buffer(mClickPort, nframes));
-
-    // zero out
-    std::memset(buf, 0, nframes * sizeof(jack_default_audio_sample_t));
-    if (bbtValid && rolling) {
-
-      const double clicksPerBeat = 4;
-      const double sr = static_cast<double>(jack_get_sample_rate(mJackClient));
-
-      int32_t beat = pos.beat - 1;
-      int32_t bar = pos.bar - 1;
-      double tick = static_cast<double>(pos.tick);
-
-      double framesPerTick =
-          60.0 * sr / (pos.ticks_per_beat * pos.beats_per_minute);
-      double ticksPerClick = pos.ticks_per_beat / clicksPerBeat;
-      double framesPerClick = framesPerTick * ticksPerClick;
-
-      const int beatsPerBar = static_cast<int>(pos.beats_per_bar);
-      double offsetTicks = std::fmod(tick, ticksPerClick);
-      offsetTicks = offsetTicks <= 0.0 ? 0.0 : ticksPerClick - offsetTicks;
-      tick = tick + offsetTicks;
+      tick += ticksPerClock;
+      frame = frame + framesPerClock;
       updateBBT(bar, beat, tick, pos.ticks_per_beat, beatsPerBar);
+    }
+  } else if (out.runState != MIDIClockRunState::Stopped) {
+    // waiting to continue has already sent a stop
+    if (out.runState != MIDIClockRunState::NeedsContinue) {
+      mBackend->midiEventWrite(midi_buf, 0, midi_stop_buf.data(),
+                               midi_stop_buf.size());
+    }
+    journal(JournalEvent::Type::MIDIStop, out.index);
+    out.clockFrameDelay = 0;
+    out.runState = MIDIClockRunState::Stopped;
+    out.invalidateBBT();
+  }
+}
 
-      // skip dupes
-      if (mBarLast == bar && mBeatLast == beat && mTickLast == tick) {
-        // std::cout << bar << ":" << beat << ":" << tick << " last: " <<
-        // mBarLast << ":" << mBeatLast << ":" << mTickLast << std::endl;
-        tick += ticksPerClick;
-        offsetTicks += ticksPerClick;
-        updateBBT(bar, beat, tick, pos.ticks_per_beat, beatsPerBar);
-      }
+void JackTransportLink::writeMTC(const jack_position_t &pos,
+                                 jack_transport_state_t transportState,
+                                 jack_nframes_t nframes) {
+  auto midi_buf = mBackend->portGetBuffer(mMTC.port, nframes);
+  mBackend->midiClearBuffer(midi_buf);
 
-      double nextClickFrame = offsetTicks * framesPerTick;
+  if (transportState != jack_transport_state_t::JackTransportRolling) {
+    mMTC.running = false;
+    return;
+  }
 
-      double frame = nextClickFrame;
-      while (ceil(frame) < static_cast<double>(nframes)) {
-        jack_nframes_t f = static_cast<jack_nframes_t>(frame);
-        buf[f] = 1.0; // 0.5 + 0.5 *
-                      // static_cast<jack_default_audio_sample_t>(beat) / 4.0;
+  // the transport frame timeline, ahead by our latency less the output
+  // latency like the clock ports
+  const double sr =
+      static_cast<double>(mSampleRate.load(std::memory_order_relaxed));
+  const double start =
+      static_cast<double>(pos.frame) +
+      static_cast<double>(mMTC.portLatency.load(std::memory_order_relaxed)) -
+      mOutputLatencyFrames;
+  const double framesPerQuarter =
+      sr / (4.0 * mtcFramesPerSecond(mMTC.rate));
+  auto quarter = static_cast<uint64_t>(
+      std::ceil(std::max(0.0, start) / framesPerQuarter));
+
+  // locate the receiver when we start or the transport jumps
+  if (!mMTC.running || pos.frame != mMTC.nextFrame) {
+    auto full = mtcFullFrame(mtcTimecode(quarter / 4, mMTC.rate), mMTC.rate);
+    mBackend->midiEventWrite(midi_buf, 0, full.data(), full.size());
+    mMTC.running = true;
+  }
+  mMTC.nextFrame = pos.frame + nframes;
 
-        mTickLast = tick;
-        mBeatLast = beat;
-        mBarLast = bar;
+  while (true) {
+    double frame = static_cast<double>(quarter) * framesPerQuarter - start;
+    if (frame >= static_cast<double>(nframes)) {
+      break;
+    }
+    // the 8 pieces carry the timecode of the frame where piece 0 went out
+    int piece = static_cast<int>(quarter % 8);
+    Timecode tc = mtcTimecode((quarter - piece) / 4, mMTC.rate);
+    const std::array<uint8_t, 2> message = {
+        midi_quarter_frame, mtcQuarterFrame(piece, tc, mMTC.rate)};
+    mBackend->midiEventWrite(midi_buf, static_cast<jack_nframes_t>(frame),
+                             message.data(), message.size());
+    quarter++;
+  }
+}
 
-        tick += ticksPerClick;
-        frame = frame + framesPerClick;
-        updateBBT(bar, beat, tick, pos.ticks_per_beat, beatsPerBar);
-      }
+double JackTransportLink::readMIDIClock(jack_transport_state_t transportState,
+                                        jack_nframes_t nframes) {
+  const double sr =
+      static_cast<double>(mSampleRate.load(std::memory_order_relaxed));
+  auto midi_buf = mBackend->portGetBuffer(mClockInPort, nframes);
+  uint32_t count = mBackend->midiEventCount(midi_buf);
+  for (uint32_t i = 0; i < count; i++) {
+    jack_midi_event_t event;
+    if (mBackend->midiEventGet(&event, midi_buf, i) != 0) {
+      continue;
+    }
+    double seconds = static_cast<double>(mSampleTime + event.time) / sr;
+    auto what = mClockFollower.process(event.buffer, event.size, seconds);
+    if (what == MIDIClockFollower::Event::None) {
+      continue;
+    }
+    if (what == MIDIClockFollower::Event::Stop) {
+      journal(JournalEvent::Type::MIDIInStop);
+      mBackend->transportStop();
+      continue;
+    }
+    auto type = JournalEvent::Type::MIDIInLocate;
+    if (what == MIDIClockFollower::Event::Start) {
+      type = JournalEvent::Type::MIDIInStart;
+    } else if (what == MIDIClockFollower::Event::Continue) {
+      type = JournalEvent::Type::MIDIInContinue;
+    }
+    journal(type, mClockFollower.position());
+    if (what == MIDIClockFollower::Event::Start ||
+        what == MIDIClockFollower::Event::SongPosition) {
+      // the timebase callback turns the frame back into this beat through
+      // the tempo map
+      jack_position_t located = {};
+      located.frame = locateFrame(mClockFollower.position());
+      mBackend->transportReposition(&located);
+    }
+    if (what != MIDIClockFollower::Event::SongPosition) {
+      mBackend->transportStart();
     }
   }
-#endif
+  // input is what arrived during the previous period, so the end of this one
+  // in the follower's time is the start of the cycle
+  double now = static_cast<double>(mSampleTime + nframes) / sr;
+  mClockFollower.timeout(now);
 
-  return 0;
+  if (!mClockFollower.locked()) {
+    return -1.0;
+  }
+  double bpm = mClockFollower.bpm();
+  if (std::abs(bpm - mBPM) >= follow_bpm_resolution) {
+    mBPM = bpm;
+    mBPMToReport = true;
+  }
+
+  // correct our phase if it has wandered more than half a clock from the
+  // clock we follow, modulo a bar as link only aligns phase. Every correction
+  // restarts the clock outputs so while the tempo catches up with a jump we
+  // only correct once a beat.
+  if (!mClockFollower.running() ||
+      transportState != jack_transport_state_t::JackTransportRolling ||
+      (mClockInCorrected >= 0.0 && now - mClockInCorrected < 60.0 / bpm)) {
+    return -1.0;
+  }
+  double beat = mInternalBeat;
+  if (mSyncLink) {
+    // link is asked for beats at the next cycle time
+    beat = mSession->beatAtTime(
+        mSessionSlot, mSession->captureAudioSessionState(mSessionSlot),
+        mTimeNext, mQuantum);
+    now += std::chrono::duration<double>(mTimeNext - mTime).count();
+  }
+  double error =
+      std::remainder(mClockFollower.beatAt(now) - beat, mQuantum);
+  if (std::abs(error) <= 0.5 / MIDI_PPQ) {
+    return -1.0;
+  }
+  mClockInCorrected = now;
+  return beat + error;
+}
+
+bool JackTransportLink::writeMIDIContinue(MIDIClockOutput &out, void *midiBuf,
+                                          jack_nframes_t frame, int32_t bar,
+                                          int32_t beat, int beatsPerBar,
+                                          double tick) {
+  // only on a 16th note, tick is on the clock grid
+  int clock = static_cast<int>(
+      std::lround(tick / mClockConstants.ticksPerClock));
+  if (clock % midi_clocks_per_sixteenth != 0) {
+    return false;
+  }
+  int64_t sixteenths =
+      (static_cast<int64_t>(bar) * beatsPerBar + beat) * 4 +
+      clock / midi_clocks_per_sixteenth;
+  if (sixteenths > midi_song_position_max) {
+    // can't point there, wait for a downbeat and start instead
+    return false;
+  }
+
+  // the clock after the continue plays the position we point at
+  const std::array<uint8_t, 3> position = {
+      midi_song_position, static_cast<uint8_t>(sixteenths & 0x7F),
+      static_cast<uint8_t>((sixteenths >> 7) & 0x7F)};
+  mBackend->midiEventWrite(midiBuf, frame, position.data(), position.size());
+  mBackend->midiEventWrite(midiBuf, frame, midi_continue_buf.data(),
+                           midi_continue_buf.size());
+  out.runState = MIDIClockRunState::Running;
+  out.clockCount = clock % MIDI_PPQ;
+  return true;
 }
 
 void JackTransportLink::timeBaseCallback(jack_transport_state_t state,
                                          jack_nframes_t nframes,
                                          jack_position_t *pos, int new_pos,
                                          void *arg) {
-  reinterpret_cast<JackTransportLink *>(arg)->timeBaseCallback(state, nframes,
-                                                               pos, new_pos);
+  auto self = reinterpret_cast<JackTransportLink *>(arg);
+  auto start = std::chrono::steady_clock::now();
+  self->timeBaseCallback(state, nframes, pos, new_pos);
+  self->mRTStats.timeBaseNanos.record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
 }
 
 // timebase callback, only called while transport is running or starting
 void JackTransportLink::timeBaseCallback(jack_transport_state_t transportState,
                                          jack_nframes_t nframes,
                                          jack_position_t *pos, bool posIsNew) {
-  auto sessionState = mLink.captureAudioSessionState();
+  RT_CHECK_SCOPE();
+
+  auto sessionState = mSession->captureAudioSessionState(mSessionSlot);
   bool bbtValid = pos->valid & JackPositionBBT;
 
-  double bpm = mBPM.load(std::memory_order_acquire);
+  double bpm = mBPM;
+  // frames mean something else at another rate
+  auto sampleRate =
+      static_cast<double>(mSampleRate.load(std::memory_order_relaxed));
+  if (mTempoMap.sampleRate() != sampleRate) {
+    mTempoMap.reset(sampleRate, bpm);
+  }
   mQuantum = bbtValid ? pos->beats_per_bar : mInitialQuantum;
   double ticksPerBeat = bbtValid ? pos->ticks_per_beat : mInitialTicksPerBeat;
 
-  auto linkTime = mTime;
+  // the position is for the next cycle, heard from mTimeNext on
+  auto linkTime = mTimeNext;
   auto sync = mSyncLink;
 
   if (sync) {
-    mInternalBeat = sessionState.beatAtTime(linkTime, mQuantum);
+    mInternalBeat =
+        mSession->beatAtTime(mSessionSlot, sessionState, linkTime, mQuantum);
+    // what we told jack last cycle, advanced by a cycle at the tempo we told
+    // it, is where the other clients think we are
+    if (bbtValid && !posIsNew &&
+        transportState == jack_transport_state_t::JackTransportRolling &&
+        mTimeBaseStateLast == jack_transport_state_t::JackTransportRolling) {
+      double jackBeat =
+          (pos->bar - 1) * static_cast<double>(pos->beats_per_bar) +
+          (pos->beat - 1) + pos->tick / pos->ticks_per_beat +
+          pos->beats_per_minute * static_cast<double>(nframes) /
+              (static_cast<double>(
+                   mSampleRate.load(std::memory_order_relaxed)) *
+               60.0);
+      mRTStats.phaseErrorBeats.add(mInternalBeat - jackBeat);
+    }
   }
+  mTimeBaseStateLast = transportState;
 
   if (posIsNew) {
-    /*
-     *  copied from transport.c -- JACK transport master example client.
-     *
-     *  Copyright (C) 2003 Jack O'Quin.
-     */
-
-    // beat/tick etc after a seek are simply based on frame and the current bpm
-    double min = pos->frame / ((double)pos->frame_rate * 60.0);
-    double abs_tick = min * pos->beats_per_minute * pos->ticks_per_beat;
-    double abs_beat = abs_tick / pos->ticks_per_beat;
+    mRTStats.repositions.increment();
+    // the beat after a seek is where the transport played that frame, from
+    // the tempos it has rolled at
+    double abs_beat = mTempoMap.beatAt(static_cast<double>(pos->frame));
+    if (mLocateBeat >= 0.0) {
+      // a scheduled locate, put the beat exactly on its time whenever jack
+      // got round to moving. The position might not have BBT yet (first call
+      // as timebase master)
+      double posBPM = bbtValid ? pos->beats_per_minute : bpm;
+      abs_beat = mLocateBeat + static_cast<double>(
+                                   (linkTime - mLocateTime).count()) *
+                                   posBPM / 60e6;
+      mLocateBeat = -1.0;
+    }
 
     mInternalBeat = abs_beat;
 
     if (sync) {
-      if (mLink.numPeers() > 0) {
-        sessionState.requestBeatAtTime(mInternalBeat, linkTime, mQuantum);
+      if (keepSessionPhase()) {
+        mSession->requestBeatAtTime(mSessionSlot, sessionState, mInternalBeat,
+                                    linkTime, mQuantum);
       } else {
-        sessionState.forceBeatAtTime(mInternalBeat, linkTime, mQuantum);
+        mSession->forceBeatAtTime(mSessionSlot, sessionState, mInternalBeat,
+                                  linkTime, mQuantum);
       }
-      mLink.commitAudioSessionState(sessionState);
-      mInternalBeat = sessionState.beatAtTime(linkTime, mQuantum);
+      mSession->commitAudioSessionState(mSessionSlot, sessionState);
+      mInternalBeat =
+          mSession->beatAtTime(mSessionSlot, sessionState, linkTime, mQuantum);
     }
 
+    journal(JournalEvent::Type::Reposition, static_cast<double>(pos->frame),
+            mInternalBeat);
     // need to sync again since we repositioned
-    mMIDIClockRunState = MIDIClockRunState::NeedsSync;
-    invalidateClockSyncBBT();
+    resyncMIDIClock();
+  }
+
+  // the frame we started rolling on got its beat from the last cycle
+  if (sync && mMeasureStartPhase && !posIsNew) {
+    mRTStats.startPhaseErrorBeats.add(
+        mPositionBeat - std::round(mPositionBeat / mQuantum) * mQuantum);
   }
 
   // what if quantum changes? Does link keep track of that or should we compute
@@ -512,11 +1252,24 @@ void JackTransportLink::timeBaseCallback(jack_transport_state_t transportState,
   pos->beat_type = beatType;
   pos->ticks_per_beat = ticksPerBeat;
   pos->beats_per_minute = bpm;
+  mPositionFrame = pos->frame;
+  mPositionBeat = mInternalBeat;
+
+  // starting doesn't move the beat yet
+  publishTimeline(transportState ==
+                  jack_transport_state_t::JackTransportRolling);
+
+  // a scheduled tempo change takes over part way into the cycle
+  if (transportState == jack_transport_state_t::JackTransportRolling &&
+      !mTempoMap.record(static_cast<double>(pos->frame) + mTempoOffset,
+                        bpm)) {
+    mRTStats.tempoMapFull.increment();
+  }
 
   if (!sync && transportState == jack_transport_state_t::JackTransportRolling) {
-    mInternalBeat +=
-        bpm * static_cast<double>(nframes) /
-        (static_cast<double>(jack_get_sample_rate(mJackClient)) * 60.0);
+    mInternalBeat = mFreeRun.advance(
+        mInternalBeat, bpm, mSampleRate.load(std::memory_order_relaxed),
+        nframes, mTempoOffset);
   }
 }
 
@@ -525,10 +1278,43 @@ int JackTransportLink::syncCallback(jack_transport_state_t state,
   return reinterpret_cast<JackTransportLink *>(arg)->syncCallback(state, pos);
 }
 
-int JackTransportLink::syncCallback(jack_transport_state_t /*transportState*/,
+int JackTransportLink::syncCallback(jack_transport_state_t transportState,
                                     jack_position_t * /*pos*/) {
-  // TODO delay start to sync with time from session?
-  return 1;
+  RT_CHECK_SCOPE();
+
+  // hold a start from stopped until the next quantum boundary of the link
+  // session, so we roll in phase with the peers instead of jumping to their
+  // phase once rolling. Jack's sync timeout, 2 seconds by default, also ends
+  // the hold.
+  if (transportState != jack_transport_state_t::JackTransportStarting ||
+      !mStartFromStopped || !mSyncLink || !keepSessionPhase()) {
+    return 1;
+  }
+  const double sr =
+      static_cast<double>(mSampleRate.load(std::memory_order_relaxed));
+  const auto nframes = mBufferSize.load(std::memory_order_relaxed);
+  if (static_cast<double>(mStartHeldFrames) >= mMaxStartHoldSeconds * sr) {
+    return 1;
+  }
+
+  // mTimeNext, from the last process callback, is when this cycle starts,
+  // roll in the cycle that starts closest to the boundary. Before the first
+  // process callback we don't know when that is, so wait a cycle.
+  if (mCycle > 0) {
+    auto sessionState = mSession->captureAudioSessionState(mSessionSlot);
+    double halfCycleBeats =
+        sessionState.tempo() * static_cast<double>(nframes) / (sr * 120.0);
+    double phase =
+        mSession->phaseAtTime(mSessionSlot, sessionState, mTimeNext, mQuantum);
+    if (phase < halfCycleBeats || mQuantum - phase <= halfCycleBeats) {
+      return 1;
+    }
+  }
+  if (mStartHeldFrames == 0) {
+    mRTStats.heldStarts.increment();
+  }
+  mStartHeldFrames += nframes;
+  return 0;
 }
 
 void JackTransportLink::propertyChangeCallback(jack_uuid_t subject,
@@ -542,84 +1328,195 @@ void JackTransportLink::propertyChangeCallback(jack_uuid_t subject,
 void JackTransportLink::propertyChangeCallback(jack_uuid_t subject,
                                                const char *key,
                                                jack_property_change_t change) {
-  // if the subject is all or us and the key is all (empty) or bpm
-  if ((jack_uuid_empty(subject) || subject == mJackClientUUID)) {
-    bool isbpm = !key || bpm_key.compare(key) == 0;
-    bool islinksync = !key || linksync_key.compare(key) == 0;
-    bool isenable = !key || start_stop_key.compare(key) == 0;
-    if (change == jack_property_change_t::PropertyChanged) {
-      std::string values;
-      std::string types;
-      if (isbpm && get_property(mJackClientUUID, bpm_key, values, types)) {
-        // convert to double and store if success
-        char *pEnd = nullptr;
-        double bpm = std::strtod(values.c_str(), &pEnd);
-        if (*pEnd == 0)
-          mBPM.store(bpm, std::memory_order_release);
-      } else if (isenable &&
-                 get_property(mJackClientUUID, start_stop_key, values, types)) {
-        bool set = std::find(true_values.begin(), true_values.end(), values) !=
-                   true_values.end();
-        mLink.enableStartStopSync(set);
-      } else if (islinksync &&
-                 get_property(mJackClientUUID, linksync_key, values, types)) {
-
-        bool was = mSyncLink;
-        mSyncLink = std::find(true_values.begin(), true_values.end(), values) !=
-                    true_values.end();
-
-        if (mSyncLink && !was) {
-          mBPM.store(mLinkBPM, std::memory_order_release);
-          mReportBPM = true;
-        }
-      }
-    } else if (change == jack_property_change_t::PropertyDeleted) {
-      if (isbpm)
-        mReportBPM = true;
-      if (isenable)
-        mReportStartStopEnable = true;
-      if (islinksync)
-        mReportLinkSync = true;
+  // if the subject is all or us and the key is all (empty) or one of ours.
+  // Reading the properties is a round trip to the server, leave it to
+  // processEvents rather than holding up jack's notification thread
+  if (!mProperties ||
+      !(jack_uuid_empty(subject) || subject == mJackClientUUID)) {
+    return;
+  }
+  bool isbpm = !key || bpm_key.compare(key) == 0;
+  bool islinksync = !key || linksync_key.compare(key) == 0;
+  bool isenable = !key || start_stop_key.compare(key) == 0;
+  if (change == jack_property_change_t::PropertyChanged) {
+    unsigned changed = 0;
+    if (isbpm)
+      changed |= 1u << mBPMProperty;
+    if (isenable)
+      changed |= 1u << mStartStopProperty;
+    if (islinksync)
+      changed |= 1u << mSyncProperty;
+    if (changed != 0) {
+      mPropertiesChanged.fetch_or(changed);
+      notifyEvents();
     }
+  } else if (change == jack_property_change_t::PropertyDeleted) {
+    // write them again, even though they haven't changed
+    unsigned deleted = 0;
+    if (isbpm) {
+      deleted |= 1u << mBPMProperty;
+      mReportBPM = true;
+    }
+    if (isenable) {
+      deleted |= 1u << mStartStopProperty;
+      mReportStartStopEnable = true;
+    }
+    if (islinksync) {
+      deleted |= 1u << mSyncProperty;
+      mReportLinkSync = true;
+    }
+    mPropertiesDeleted.fetch_or(deleted);
+    notifyEvents();
+  }
+}
+
+void JackTransportLink::readProperties(unsigned changed) {
+  // our own writes come back as changes too, only act on other clients'
+  std::string values;
+  std::string types;
+  auto read = [&](int property, const std::string &key) {
+    return (changed & (1u << property)) != 0 &&
+           mBackend->getProperty(mJackClientUUID, key, values, types) &&
+           !mProperties->isOwnValue(property, values.c_str());
+  };
+  if (read(mBPMProperty, bpm_key)) {
+    // convert to double and store if success
+    char *pEnd = nullptr;
+    double bpm = std::strtod(values.c_str(), &pEnd);
+    if (*pEnd == 0) {
+      // already in the property, don't report it back
+      std::lock_guard<std::mutex> lock(mControlMutex);
+      pushCommand(ControlCommand::Type::SetBPM, bpm, false);
+    }
+  }
+  if (read(mStartStopProperty, start_stop_key)) {
+    bool set = std::find(true_values.begin(), true_values.end(), values) !=
+               true_values.end();
+    mSession->enableStartStopSync(set);
+  }
+  if (read(mSyncProperty, linksync_key)) {
+    setSyncLink(std::find(true_values.begin(), true_values.end(), values) !=
+                true_values.end());
   }
 }
 
 void JackTransportLink::setBPMProperty(double bpm) {
-  if (!jack_uuid_empty(mJackClientUUID)) {
-    std::string bpms = std::to_string(bpm);
-    jack_set_property(mJackClient, mJackClientUUID, bpm_key.c_str(),
-                      bpms.c_str(), decimal_type);
+  if (mProperties) {
+    mProperties->set(mBPMProperty, bpm);
   }
 }
 
 void JackTransportLink::setEnableStartStopProperty(bool enable) {
-  if (!jack_uuid_empty(mJackClientUUID)) {
-    std::string enables = enable ? "true" : "false";
-    jack_set_property(mJackClient, mJackClientUUID, start_stop_key.c_str(),
-                      enables.c_str(), bool_type);
+  if (mProperties) {
+    mProperties->set(mStartStopProperty, enable ? 1.0 : 0.0);
   }
 }
 
 void JackTransportLink::setSyncProperty(bool sync) {
-  if (!jack_uuid_empty(mJackClientUUID)) {
-    std::string s = sync ? "true" : "false";
-    jack_set_property(mJackClient, mJackClientUUID, linksync_key.c_str(),
-                      s.c_str(), bool_type);
+  if (mProperties) {
+    mProperties->set(mSyncProperty, sync ? 1.0 : 0.0);
   }
 }
 
 void JackTransportLink::setNumPeersProperty(size_t peers) {
-  if (!jack_uuid_empty(mJackClientUUID)) {
-    std::string s = std::to_string(peers);
-    jack_set_property(mJackClient, mJackClientUUID, linknumpeers_key.c_str(),
-                      s.c_str(), int_type);
+  if (mProperties) {
+    mProperties->set(mNumPeersProperty, static_cast<double>(peers));
+  }
+}
+
+void JackTransportLink::publishTimeline(bool playing) {
+  auto writer = mTimelineWriter.load(std::memory_order_acquire);
+  if (writer == nullptr) {
+    return;
   }
+  TimelineRecord record;
+  // the beat is the one for the next cycle
+  record.hostTime = mTimeNext.count();
+  record.beat = mInternalBeat;
+  record.bpm = mBPM;
+  record.quantum = mQuantum;
+  record.playing = playing ? 1 : 0;
+  record.numPeers =
+      static_cast<uint32_t>(mNumPeers.load(std::memory_order_relaxed));
+  writer->publish(record);
 }
 
-void JackTransportLink::invalidateClockSyncBBT() {
-  mBeatLast = -1;
-  mBarLast = -1;
-  mTickLast = -1.0;
+void JackTransportLink::journal(JournalEvent::Type type, double a,
+                                double b) {
+  auto sink = mJournal.load(std::memory_order_acquire);
+  if (sink == nullptr) {
+    return;
+  }
+  JournalEvent e;
+  // when it happened, rather than when it is heard
+  e.hostTime = (mTime - mOutputLatency).count();
+  e.frameTime = mCycleFrameTime;
+  e.type = type;
+  e.source = mJournalSource.load(std::memory_order_relaxed);
+  e.a = a;
+  e.b = b;
+  sink->record(e);
+}
+
+void JackTransportLink::journalNow(JournalEvent::Type type, double a,
+                                   double b) {
+  auto sink = mJournal.load(std::memory_order_acquire);
+  if (sink == nullptr) {
+    return;
+  }
+  JournalEvent e;
+  e.hostTime = Journal::now();
+  e.frameTime = mBackend->estimatedFrameTime();
+  e.type = type;
+  e.source = mJournalSource.load(std::memory_order_relaxed);
+  e.a = a;
+  e.b = b;
+  sink->record(e);
+}
+
+bool JackTransportLink::keepSessionPhase() const {
+  return mJoiningSession || mNumPeers.load(std::memory_order_relaxed) > 0 ||
+         mSession->bridgeCount() > 1;
+}
+
+void JackTransportLink::resyncMIDIClock() {
+  for (auto &out : mClockOutputs) {
+    out->runState = MIDIClockRunState::NeedsSync;
+    out->invalidateBBT();
+  }
+}
+
+void JackTransportLink::MIDIClockOutput::invalidateBBT() {
+  beatLast = -1;
+  barLast = -1;
+  tickLast = -1.0;
+}
+
+void JackTransportLink::ProcessBundle(
+    const oscpack::ReceivedBundle &b,
+    const oscpack::IpEndpointName &remoteEndpoint) {
+  // a nested bundle can't be earlier than the one it is in, an immediate one
+  // takes the outer time
+  auto outer = mOscTime;
+  if (b.TimeTag() != osc_immediate) {
+    auto tag = b.TimeTag();
+    auto tagMicros =
+        (static_cast<int64_t>(tag >> 32) - ntp_unix_offset_seconds) *
+            1000000 +
+        static_cast<int64_t>(((tag & 0xFFFFFFFF) * 1000000) >> 32);
+    auto unixMicros = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count();
+    mOscTime = mSession->link().clock().micros() +
+               std::chrono::microseconds(tagMicros - unixMicros);
+  }
+  try {
+    oscpack::OscPacketListener::ProcessBundle(b, remoteEndpoint);
+  } catch (...) {
+    mOscTime = outer;
+    throw;
+  }
+  mOscTime = outer;
 }
 
 void JackTransportLink::ProcessMessage(
@@ -632,46 +1529,40 @@ void JackTransportLink::ProcessMessage(
     if (std::strcmp("/jacklink/bpm", m.AddressPattern()) == 0) {
       if (arg != m.ArgumentsEnd()) {
         std::optional<double> v = GetOscDouble(*arg);
-        if (v && *v > 0.0) {
-          mBPM.store(*v);
-          mReportBPM = true;
+        if (v && *v > 0.0 &&
+            !schedule(ScheduledEvent::Type::SetBPM, *v)) {
+          setBPM(*v);
         }
       }
     } else if (std::strcmp("/jacklink/beattime", m.AddressPattern()) == 0) {
       if (arg != m.ArgumentsEnd()) {
         std::optional<double> v = GetOscDouble(*arg);
-        if (v && *v >= 0.0) {
-          jack_position_t pos;
-          jack_transport_query(mJackClient, &pos);
-
-          const double tpb = static_cast<double>(pos.ticks_per_beat);
-          double abs_tick = *v * tpb;
-          double minute =
-              abs_tick / (static_cast<double>(pos.beats_per_minute) * tpb);
-          pos.frame = minute * static_cast<double>(pos.frame_rate) * 60.0;
-
-          jack_transport_reposition(mJackClient, &pos);
+        // the realtime thread owns the tempo map
+        if (v && *v >= 0.0 &&
+            !schedule(ScheduledEvent::Type::Locate, *v)) {
+          std::lock_guard<std::mutex> lock(mControlMutex);
+          pushCommand(ControlCommand::Type::Locate, *v, false);
         }
       }
     } else if (std::strcmp("/jacklink/sync", m.AddressPattern()) == 0) {
       if (arg != m.ArgumentsEnd() && arg->IsBool()) {
-        bool was = mSyncLink;
-        mSyncLink = arg->AsBoolUnchecked();
-        if (mSyncLink && !was) {
-          mBPM.store(mLinkBPM, std::memory_order_release);
-          mReportBPM = true;
-        }
-        setSyncProperty(mSyncLink);
+        bool sync = arg->AsBoolUnchecked();
+        setSyncLink(sync);
+        setSyncProperty(sync);
       }
     } else if (std::strcmp("/jacklink/rolling", m.AddressPattern()) == 0) {
       if (arg != m.ArgumentsEnd() && arg->IsBool()) {
         bool rolling = arg->AsBoolUnchecked();
-        if (rolling) {
-          jack_transport_start(mJackClient);
+        if (schedule(ScheduledEvent::Type::Rolling, rolling ? 1.0 : 0.0)) {
+          // applied by the realtime thread
+        } else if (rolling) {
+          mBackend->transportStart();
         } else {
-          jack_transport_stop(mJackClient);
+          mBackend->transportStop();
         }
       }
+    } else if (mOscPublisher != nullptr) {
+      mOscPublisher->processMessage(m, remoteEndpoint);
     }
   } catch (oscpack::Exception &e) {
     std::cerr << "error while parsing message: " << m.AddressPattern() << ": "
@@ -1,7 +1,26 @@
 #pragma once
 
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Backend.hpp"
+#include "Click.hpp"
+#include "EventLoop.hpp"
+#include "Journal.hpp"
+#include "LinkSession.hpp"
+#include "LockFree.hpp"
+#include "MIDIClockFollower.hpp"
+#include "MIDITimecode.hpp"
+#include "PhaseCV.hpp"
+#include "PropertyPublisher.hpp"
+#include "RTStats.hpp"
+#include "TempoMap.hpp"
 
 #include <jack/jack.h>
 #include <jack/metadata.h>
@@ -14,6 +33,16 @@
 #include <osc/OscPacketListener.h>
 #include <osc/OscReceivedElements.h>
 
+// advance bar and beat if tick has wrapped past a beat
+void updateBBT(int32_t &bar, int32_t &beat, double &tick, double ticks_per_beat,
+               int beats_per_bar);
+
+// any numeric osc argument as a double
+std::optional<double> GetOscDouble(const oscpack::ReceivedMessageArgument &arg);
+
+class OscPublisher;
+class TimelineWriter;
+
 /// XXX OSC CONTROL??
 ///
 /// position
@@ -23,15 +52,111 @@
 
 class JackTransportLink : public oscpack::OscPacketListener {
 public:
-  enum class MIDIClockRunState { Running, Stopped, NeedsSync };
+  // NeedsSync sends a stop, then NeedsContinue waits for the next 16th note
+  // to send a song position and continue
+  enum class MIDIClockRunState { Running, Stopped, NeedsSync, NeedsContinue };
+
+  // state published by the realtime thread at the end of every cycle
+  struct RTSnapshot {
+    uint64_t cycle = 0;
+    double bpm = 0.0;
+    double quantum = 0.0;
+    double beat = 0.0;
+    // jack bar, beat and tick, 1 based, 0 if the position has no BBT
+    int32_t bar = 0;
+    int32_t barBeat = 0;
+    int32_t tick = 0;
+    bool syncLink = true;
+    jack_transport_state_t transportState = JackTransportStopped;
+    uint32_t numPeers = 0;
+    // max cycles between a control change and the realtime thread applying it
+    uint64_t maxCommandLatency = 0;
+    // deviation of the cycle to cycle time from the period, in microseconds,
+    // for jack's cycle times and the filtered host time
+    double rawTimeErrorRms = 0.0;
+    double rawTimeErrorMax = 0.0;
+    double filteredTimeErrorRms = 0.0;
+    double filteredTimeErrorMax = 0.0;
+  };
 
-  JackTransportLink(jack_client_t *client, bool enableStartStopSync = true,
-                    double initialBPM = 100., double initialQuantum = 4.,
-                    float initialTimeSigDenom = 4.,
-                    double initialTicksPerBeat = 1920.);
+  // a midi clock output port
+  struct MIDIClockPort {
+    std::string name;
+    // added to the port's playback latency, positive sends the clock earlier
+    double trimMs = 0.0;
+  };
+
+  // how a bridge starts out, the defaults are the service's
+  struct Settings {
+    bool enableStartStopSync = true;
+    double initialBPM = 100.0;
+    double initialQuantum = 4.0;
+    float initialTimeSigDenom = 4.0f;
+    double initialTicksPerBeat = 1920.0;
+    // only used for a session of our own
+    bool enableLink = true;
+    std::vector<MIDIClockPort> clockPorts = {{"clock", 0.0}};
+    // send midi timecode at this rate
+    std::optional<MTCRate> mtcRate;
+    // follow a midi clock on a clock_in port instead of running the transport
+    bool followMIDIClock = false;
+    // give link the cycle times instead of the filtered host time
+    bool rawHostTime = false;
+    // longest a start is held for link's quantum boundary
+    double maxStartHoldSeconds = 2.0;
+    // clicks per beat on a click port, 0 for none
+    int clickSubdivision = 0;
+    // gates and triggers per beat on the phase cv ports, 0 for no ports
+    int phaseCVDivision = 0;
+  };
+
+  // without a session the bridge makes a link session of its own
+  JackTransportLink(std::unique_ptr<Backend> backend, const Settings &settings,
+                    std::shared_ptr<LinkSession> session = nullptr);
   ~JackTransportLink();
 
+  // readable when processEvents has something to do
+  int eventFD() const { return mEvents.fd(); }
   void processEvents();
+  // write the metadata properties that are due, from the thread that calls
+  // processEvents, returns the milliseconds until the next one is, -1 if
+  // none are waiting
+  int publishProperties();
+
+  // request a new tempo, same as the bpm property or /jacklink/bpm
+  void setBPM(double bpm);
+  // follow link or run from our internal timeline
+  void setSyncLink(bool sync);
+
+  // from the link session, the first three on link's thread
+  void linkTempoChanged(double bpm);
+  void linkStartStopChanged(bool isPlaying);
+  void linkNumPeersChanged(size_t numPeers);
+  void linkStartStopSyncChanged();
+
+  // the latest state from the realtime thread, safe from any thread
+  RTSnapshot snapshot() const;
+  // when the first process callback started, nullopt until it has, safe from
+  // any thread. processEvents is woken for it
+  std::optional<std::chrono::steady_clock::time_point> firstProcessTime() const;
+  // instrumentation, safe to read from any thread
+  const RTStats &rtStats() const { return mRTStats; }
+  const NotificationStats &notificationStats() const {
+    return mNotificationStats;
+  }
+
+  // hand subscribe and query messages to publisher, set from the thread
+  // that processes osc
+  void setOscPublisher(OscPublisher *publisher);
+  // publish the timeline to shared memory every cycle, the writer must
+  // outlive us or be unset first, nullptr to stop
+  void setTimelineWriter(TimelineWriter *writer);
+  // record transport events from every thread as coming from source, the
+  // journal must outlive us or be unset first, nullptr to stop
+  void setJournal(Journal *journal, uint16_t source);
+  // added to the playback latency of the system outputs, for latency jack
+  // doesn't know about, positive puts the link timeline later
+  void setOutputLatencyOffset(double ms);
 
   static int processCallback(jack_nframes_t nframes, void *arg);
   static void timeBaseCallback(jack_transport_state_t state,
@@ -39,62 +164,325 @@ public:
                                int new_pos, void *arg);
   static int syncCallback(jack_transport_state_t state, jack_position_t *pos,
                           void *arg);
+  static int sampleRateCallback(jack_nframes_t nframes, void *arg);
+  static int bufferSizeCallback(jack_nframes_t nframes, void *arg);
+  static void latencyCallback(jack_latency_callback_mode_t mode, void *arg);
+  static int xrunCallback(void *arg);
   static void propertyChangeCallback(jack_uuid_t subject, const char *key,
                                      jack_property_change_t change, void *arg);
 
 protected:
+  // a bundle with a time tag has its tempo, rolling and beattime messages
+  // applied by the realtime thread at the frame the tag falls on, the rest
+  // are applied when they arrive like messages outside a bundle
+  virtual void ProcessBundle(const oscpack::ReceivedBundle &b,
+                             const oscpack::IpEndpointName &remoteEndpoint);
   virtual void ProcessMessage(const oscpack::ReceivedMessage &m,
                               const oscpack::IpEndpointName &remoteEndpoint);
 
 private:
+  // control -> realtime changes, applied at the start of a cycle
+  struct ControlCommand {
+    enum class Type { SetBPM, SetSyncLink, LinkTempo, Locate } type;
+    double value = 0.0;
+    // report the resulting bpm through the metadata property
+    bool report = true;
+    // realtime cycle the command was submitted during
+    uint64_t cycle = 0;
+  };
+
+  // a midi clock output, owned by the realtime thread apart from the latency
+  struct MIDIClockOutput {
+    jack_port_t *port = nullptr;
+    // of the clock ports registered, for the journal
+    int index = 0;
+    double trimMs = 0.0;
+    // downstream playback latency in frames, from the latency callback
+    std::atomic<jack_nframes_t> portLatency = 0;
+
+    MIDIClockRunState runState = MIDIClockRunState::Stopped;
+    int clockCount = 0;
+    // first clock tick gets a delay, track it across process calls
+    double clockFrameDelay = 0;
+    int32_t beatLast = -1;
+    int32_t barLast = -1;
+    double tickLast = -1.0;
+
+    void invalidateBBT();
+  };
+
+  // midi time code output, owned by the realtime thread apart from the
+  // latency
+  struct MTCOutput {
+    jack_port_t *port = nullptr;
+    MTCRate rate = MTCRate::FPS30;
+    std::atomic<jack_nframes_t> portLatency = 0;
+    bool running = false;
+    // the transport frame we expect next cycle, anything else is a locate
+    jack_nframes_t nextFrame = 0;
+  };
+
+  // cycle to cycle time error statistics
+  struct CycleTimeError {
+    double last = -1.0; // usecs
+    double sumSquares = 0.0;
+    double max = 0.0;
+    uint64_t count = 0;
+
+    void add(double usecs, double periodUsecs);
+    double rms() const;
+  };
+
+  // the beat while we aren't synced to link, computed from whole frames
+  // since the last tempo change rather than accumulated every cycle, so it
+  // doesn't drift and lands on the same beat whatever the period size
+  struct FreeRunTimeline {
+    // frames rolled since activation
+    uint64_t frames = 0;
+    uint64_t anchorFrame = 0;
+    double anchorBeat = 0.0;
+    double bpm = 0.0;
+    jack_nframes_t sampleRate = 0;
+    // what advance returned last, anything else means the beat was set
+    double beat = 0.0;
+
+    // roll nframes from beat, returns the new beat. A tempo change takes
+    // effect tempoOffset frames into the cycle
+    double advance(double beat, double bpm, jack_nframes_t sampleRate,
+                   jack_nframes_t nframes, jack_nframes_t tempoOffset = 0);
+  };
+
+  // an osc message from a bundle with a time tag, waiting for its time
+  struct ScheduledEvent {
+    enum class Type { SetBPM, Rolling, Locate } type;
+    double value = 0.0;
+    // on link's clock
+    std::chrono::microseconds time;
+  };
+  static constexpr size_t max_scheduled = 64;
+  // tempo changes the transport remembers for seeking, a link tempo drag
+  // adds one a cycle, older ones are merged as it fills up
+  static constexpr size_t tempo_map_segments = 1 << 17;
+
+  // midi clock timing derived from the tempo, ticks per beat and sample rate
+  struct ClockConstants {
+    double bpm = 0.0;
+    double ticksPerBeat = 0.0;
+    double sampleRate = 0.0;
+
+    double framesPerTick = 0.0;
+    double ticksPerClock = 0.0;
+    double framesPerClock = 0.0;
+    // delay between a start and the first clock
+    double startDelayFrames = 0.0;
+
+    // recompute only if something changed
+    void update(double bpm, double ticksPerBeat, double sampleRate);
+  };
+
+  // any control thread, mControlMutex must be held, returns false if the
+  // queue is full
+  bool pushCommand(ControlCommand::Type type, double value,
+                   bool report = true);
+  // realtime thread only
+  void applyCommands();
+  // the thread that processes osc, schedule for the time tag of the bundle
+  // being processed, returns false if there isn't one or the queue is full
+  bool schedule(ScheduledEvent::Type type, double value);
+  // realtime thread, after the cycle's times are known, apply the scheduled
+  // events that are due. tempoTime is set to when a tempo change is due
+  void applyScheduled(jack_nframes_t nframes,
+                      std::chrono::microseconds &tempoTime);
+  // realtime thread, the transport frame beat was played at, through the
+  // tempo map
+  jack_nframes_t locateFrame(double beat) const;
+  // any thread, wake up whoever is waiting on eventFD
+  void notifyEvents();
+
   int processCallback(jack_nframes_t nframes);
   void timeBaseCallback(jack_transport_state_t state, jack_nframes_t nframes,
                         jack_position_t *pos, bool posIsNew);
   int syncCallback(jack_transport_state_t state, jack_position_t *pos);
+  void latencyCallback(jack_latency_callback_mode_t mode);
+  void writeMIDIClock(MIDIClockOutput &out, const jack_position_t &pos,
+                      jack_transport_state_t transportState,
+                      jack_nframes_t nframes);
+  void writeMTC(const jack_position_t &pos,
+                jack_transport_state_t transportState, jack_nframes_t nframes);
+  // feed the clock input to the follower, start/stop/locate the transport and
+  // take its tempo, returns a beat to correct our phase to or -1
+  double readMIDIClock(jack_transport_state_t transportState,
+                       jack_nframes_t nframes);
+  // song position and continue if tick is on a 16th note, returns false if
+  // it isn't or the position is out of range
+  bool writeMIDIContinue(MIDIClockOutput &out, void *midiBuf,
+                         jack_nframes_t frame, int32_t bar, int32_t beat,
+                         int beatsPerBar, double tick);
   void propertyChangeCallback(jack_uuid_t subject, const char *key,
                               jack_property_change_t change);
+  // from processEvents, apply the properties jack reported changed
+  void readProperties(unsigned changed);
   void setBPMProperty(double bpm);
   void setEnableStartStopProperty(bool enable);
   void setSyncProperty(bool sync);
   void setNumPeersProperty(size_t peers);
+  // realtime thread, the timeline as of mTime
+  void publishTimeline(bool playing);
+  // journal an event, at the cycle's frame and host time from the realtime
+  // thread, at the time it is called from any other
+  void journal(JournalEvent::Type type, double a = 0.0, double b = 0.0);
+  void journalNow(JournalEvent::Type type, double a = 0.0, double b = 0.0);
 
-  void invalidateClockSyncBBT();
+  // realtime thread, start and jump on the session's phase rather than
+  // forcing our beat on it: there are link peers or bridges to other
+  // servers, which we treat the same, or we are joining a session that was
+  // playing before we came up
+  bool keepSessionPhase() const;
+  // stop the clocks and wait for the next downbeat
+  void resyncMIDIClock();
 
-  jack_client_t *mJackClient;
-  ableton::Link mLink;
+  std::unique_ptr<Backend> mBackend;
+  // shared with the bridges to other servers, our own if there are none
+  std::shared_ptr<LinkSession> mSession;
+  int mSessionSlot = -1;
+  bool mFollowStartStop = true;
+  // set before activation, the realtime thread clears it once we have
+  // started rolling
+  bool mJoiningSession = false;
 
-  jack_port_t *mMIDIClockOut = nullptr;
-  MIDIClockRunState mMIDIClockRunState = MIDIClockRunState::Stopped;
-  int mMIDIClockCount = 0;
-  // first clock tick gets a delay, track it across process calls
-  double mClockFrameDelay = 0;
+  OscPublisher *mOscPublisher = nullptr;
+  // the thread that processes osc, the time tag of the bundle being
+  // processed, on link's clock, nullopt outside a bundle or for immediately
+  std::optional<std::chrono::microseconds> mOscTime;
+  std::atomic<TimelineWriter *> mTimelineWriter = nullptr;
+  std::atomic<Journal *> mJournal = nullptr;
+  std::atomic<uint16_t> mJournalSource = 0;
 
+  std::vector<std::unique_ptr<MIDIClockOutput>> mClockOutputs;
+  MTCOutput mMTC;
+  jack_port_t *mClockInPort = nullptr;
   jack_port_t *mClickPort = nullptr;
+  std::unique_ptr<Click> mClick;
+  jack_port_t *mBeatPhasePort = nullptr;
+  jack_port_t *mBarPhasePort = nullptr;
+  jack_port_t *mGatePort = nullptr;
+  jack_port_t *mTriggerPort = nullptr;
+  std::unique_ptr<PhaseCV> mPhaseCV;
+
+  // owned by the realtime thread, only touched from the jack process and
+  // timebase callbacks
+  alignas(cacheline_size) uint64_t mCycle = 0;
+  uint64_t mMaxCommandLatency = 0;
+  // the tempo changed this cycle, reported after the snapshot is written
+  bool mBPMToReport = false;
+  ClockConstants mClockConstants;
+  // frames processed since activation
+  uint64_t mSampleTime = 0;
+  // jack's frame time at the start of the cycle
+  jack_nframes_t mCycleFrameTime = 0;
+  // the transport state and tempo last journaled
+  jack_transport_state_t mJournalState = JackTransportStopped;
+  double mJournalBPM = 0.0;
+  // the state the last timebase callback saw, to know if the BBT it gets
+  // has advanced a cycle
+  jack_transport_state_t mTimeBaseStateLast = JackTransportStopped;
+  CycleTimeError mRawTimeError;
+  CycleTimeError mFilteredTimeError;
+  FreeRunTimeline mFreeRun;
+  TempoMap mTempoMap{tempo_map_segments};
+  MIDIClockFollower mClockFollower;
+  // follower time of the last phase correction, -1 if there hasn't been one
+  double mClockInCorrected = -1.0;
+  // a start from stopped, the sync callback holds it for link's quantum
+  // boundary and the first rolling cycle measures how close it got
+  bool mStartFromStopped = true;
+  bool mMeasureStartPhase = false;
+  uint64_t mStartHeldFrames = 0;
+  // scheduled osc events in time order
+  std::array<ScheduledEvent, max_scheduled> mScheduled;
+  size_t mScheduledCount = 0;
+  // frames into this cycle a scheduled tempo change takes effect
+  jack_nframes_t mTempoOffset = 0;
+  // a scheduled locate puts this beat at this time, rather than at the
+  // frame jack was sent to, -1 if there isn't one
+  double mLocateBeat = -1.0;
+  std::chrono::microseconds mLocateTime;
+
   double mInternalBeat = 0.0;
   bool mSyncLink = true;
   bool mWasSyncLink = true;
 
-  int32_t mBeatLast = -1;
-  int32_t mBarLast = -1;
-  double mTickLast = -1.0;
+  // the frame of the position the last timebase callback filled in and the
+  // beat it computed the BBT from
+  jack_nframes_t mPositionFrame = 0;
+  double mPositionBeat = 0.0;
 
+  // when the audio of this cycle and the next is heard, the host time of the
+  // cycle plus the output latency. Link, the timebase and everything
+  // scheduled on link's clock go by these
   std::chrono::microseconds mTime;
   std::chrono::microseconds mTimeNext;
+  // the output latency this cycle, in frames and on link's clock
+  double mOutputLatencyFrames = 0.0;
+  std::chrono::microseconds mOutputLatency{0};
 
   jack_transport_state_t mTransportStateReportedLast =
       jack_transport_state_t::JackTransportStopped;
 
-  std::atomic<double> mBPM;
+  double mBPM;
   double mLinkBPM;
-  double mBPMLast;
   double mQuantum;
+
+  // written once in the constructor
   double mInitialQuantum; // time sig num, called quantum in link
   float mInitialTimeSigDenom;
   double mInitialTicksPerBeat;
-
+  // give link jack's cycle times rather than the filtered host time
+  bool mRawHostTime;
+  // longest the sync callback holds a start, 0 doesn't hold
+  double mMaxStartHoldSeconds;
   jack_uuid_t mJackClientUUID;
 
-  bool mReportBPM = false;
-  bool mReportLinkSync = false;
-  bool mReportStartStopEnable = false;
+  // written from the jack notification and link threads, read in the
+  // realtime callbacks
+  alignas(cacheline_size) std::atomic<jack_nframes_t> mSampleRate;
+  std::atomic<jack_nframes_t> mBufferSize;
+  std::atomic<size_t> mNumPeers = 0;
+  // playback latency of the system outputs, in frames, and the user's
+  // offset on top of it
+  std::atomic<jack_nframes_t> mSystemLatency = 0;
+  std::atomic<double> mOutputLatencyOffsetMs = 0.0;
+  NotificationStats mNotificationStats;
+
+  // written by the realtime thread, read by any
+  alignas(cacheline_size) RTStats mRTStats;
+
+  // realtime -> control
+  alignas(cacheline_size) std::atomic<uint64_t> mPublishedCycle = 0;
+  // steady clock nanoseconds, 0 until the first process callback
+  std::atomic<int64_t> mFirstProcessNanos = 0;
+  std::atomic<bool> mReportBPM = false;
+  EventNotifier mEvents;
+  DoubleBuffer<RTSnapshot> mSnapshot;
+  SPSCQueue<ControlCommand, 64> mCommands;
+  SPSCQueue<ScheduledEvent, max_scheduled> mScheduleQueue;
+
+  // owned by the control threads (osc, jack notifications, link callbacks and
+  // processEvents), guarded by mControlMutex
+  alignas(cacheline_size) std::mutex mControlMutex;
+  bool mControlSyncLink = true;
+  std::atomic<bool> mReportLinkSync = false;
+  std::atomic<bool> mReportStartStopEnable = false;
+
+  // our metadata, written from the thread that calls processEvents, nullptr
+  // if the backend has no metadata
+  std::unique_ptr<PropertyPublisher> mProperties;
+  int mBPMProperty = -1;
+  int mStartStopProperty = -1;
+  int mSyncProperty = -1;
+  int mNumPeersProperty = -1;
+  // properties jack reported changed or deleted, bits of the property
+  // indices, read from processEvents
+  std::atomic<unsigned> mPropertiesChanged = 0;
+  std::atomic<unsigned> mPropertiesDeleted = 0;
 };
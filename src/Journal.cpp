@@ -0,0 +1,181 @@
+#include "Journal.hpp"
+
+#include <ableton/platforms/Config.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace {
+struct EventName {
+  JournalEvent::Type type;
+  const char *name;
+};
+
+const std::array<EventName, 16> event_names = {{
+    {JournalEvent::Type::TransportState, "transport"},
+    {JournalEvent::Type::Reposition, "reposition"},
+    {JournalEvent::Type::Tempo, "tempo"},
+    {JournalEvent::Type::LinkPeers, "peers"},
+    {JournalEvent::Type::MIDIStart, "midi-start"},
+    {JournalEvent::Type::MIDIStop, "midi-stop"},
+    {JournalEvent::Type::MIDIContinue, "midi-continue"},
+    {JournalEvent::Type::MIDIResync, "midi-resync"},
+    {JournalEvent::Type::MIDIInStart, "midi-in-start"},
+    {JournalEvent::Type::MIDIInContinue, "midi-in-continue"},
+    {JournalEvent::Type::MIDIInStop, "midi-in-stop"},
+    {JournalEvent::Type::MIDIInLocate, "midi-in-locate"},
+    {JournalEvent::Type::Xrun, "xrun"},
+    {JournalEvent::Type::ServerUp, "server-up"},
+    {JournalEvent::Type::ServerDown, "server-down"},
+    {JournalEvent::Type::Dropped, "dropped"},
+}};
+} // namespace
+
+const char *journalEventName(JournalEvent::Type type) {
+  for (auto &e : event_names) {
+    if (e.type == type) {
+      return e.name;
+    }
+  }
+  return nullptr;
+}
+
+bool parseJournalEventType(const std::string &name, JournalEvent::Type &type) {
+  for (auto &e : event_names) {
+    if (name == e.name) {
+      type = e.type;
+      return true;
+    }
+  }
+  return false;
+}
+
+Journal::Journal(const std::string &path, size_t maxFileBytes, size_t files)
+    : mPath(path),
+      mMaxFileBytes(std::max(maxFileBytes, sizeof(JournalHeader) +
+                                               sizeof(JournalEvent))),
+      mFiles(std::max<size_t>(files, 1)) {
+  mOpen = rotate();
+  if (mOpen) {
+    mThread = std::thread([this]() { run(); });
+  }
+}
+
+Journal::~Journal() {
+  if (mThread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStop = true;
+    }
+    mWake.notify_one();
+    mThread.join();
+  }
+  if (mFile != nullptr) {
+    std::fclose(mFile);
+  }
+}
+
+bool Journal::record(const JournalEvent &event) {
+  if (!mQueue.push(event)) {
+    mDropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+int64_t Journal::now() {
+  return ableton::link::platform::Clock().micros().count();
+}
+
+void Journal::run() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  while (!mStop) {
+    mWake.wait_for(lock, drain_interval);
+    lock.unlock();
+    drain();
+    lock.lock();
+  }
+  lock.unlock();
+  drain();
+}
+
+void Journal::drain() {
+  JournalEvent event;
+  bool wrote = false;
+  while (mQueue.pop(event)) {
+    write(event);
+    wrote = true;
+  }
+  auto dropped = mDropped.load(std::memory_order_relaxed);
+  if (dropped != mDroppedWritten) {
+    JournalEvent e;
+    e.hostTime = now();
+    e.type = JournalEvent::Type::Dropped;
+    e.a = static_cast<double>(dropped - mDroppedWritten);
+    write(e);
+    mDroppedWritten = dropped;
+    wrote = true;
+  }
+  if (wrote && mFile != nullptr) {
+    std::fflush(mFile);
+  }
+}
+
+void Journal::write(const JournalEvent &event) {
+  if (mFile != nullptr && mFileBytes + sizeof(event) > mMaxFileBytes) {
+    rotate();
+  }
+  if (mFile == nullptr) {
+    return;
+  }
+  if (std::fwrite(&event, sizeof(event), 1, mFile) != 1) {
+    if (!mWriteFailed) {
+      std::cerr << "error writing journal " << mPath << " "
+                << std::strerror(errno) << std::endl;
+      mWriteFailed = true;
+    }
+    return;
+  }
+  mWriteFailed = false;
+  mFileBytes += sizeof(event);
+}
+
+bool Journal::rotate() {
+  if (mFile != nullptr) {
+    std::fclose(mFile);
+    mFile = nullptr;
+  }
+  // the oldest falls off the end
+  for (size_t i = mFiles - 1; i > 0; i--) {
+    std::string from = i == 1 ? mPath : mPath + "." + std::to_string(i - 1);
+    std::rename(from.c_str(), (mPath + "." + std::to_string(i)).c_str());
+  }
+
+  mFile = std::fopen(mPath.c_str(), "wb");
+  if (mFile == nullptr) {
+    std::cerr << "cannot write journal " << mPath << " "
+              << std::strerror(errno) << std::endl;
+    return false;
+  }
+  JournalHeader header = {};
+  std::memcpy(header.magic, journal_magic, sizeof(header.magic));
+  header.version = journal_version;
+  header.recordSize = sizeof(JournalEvent);
+  header.hostTime = now();
+  header.wallTime = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count();
+  if (std::fwrite(&header, sizeof(header), 1, mFile) != 1) {
+    std::cerr << "cannot write journal " << mPath << " "
+              << std::strerror(errno) << std::endl;
+    std::fclose(mFile);
+    mFile = nullptr;
+    return false;
+  }
+  std::fflush(mFile);
+  mFileBytes = sizeof(header);
+  return true;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "LockFree.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// Something that happened to the transport, as it goes into the journal and
+/// as a record in the journal file.
+struct JournalEvent {
+  // what a and b hold is next to each
+  enum class Type : uint16_t {
+    // a jack_transport_state_t, b the transport frame
+    TransportState = 1,
+    // a the transport frame, b the beat there
+    Reposition,
+    // a the new bpm, b the one before
+    Tempo,
+    // a the number of peers
+    LinkPeers,
+    // a the midi clock port, counted from 0
+    MIDIStart,
+    MIDIStop,
+    // a the port, b the beat of the song position sent with it
+    MIDIContinue,
+    // a the port, the clocks were stopped to sync up again
+    MIDIResync,
+    // from the clock we follow, a the beat of its song position
+    MIDIInStart,
+    MIDIInContinue,
+    MIDIInStop,
+    MIDIInLocate,
+    // a the xruns so far
+    Xrun,
+    // the jack server came up or went away
+    ServerUp,
+    ServerDown,
+    // a events that didn't fit in the queue since the last of these
+    Dropped,
+  };
+
+  // on link's clock, in microseconds
+  int64_t hostTime = 0;
+  // jack's frame time, which wraps
+  uint32_t frameTime = 0;
+  Type type = Type::TransportState;
+  // the jack server, in the order they were given
+  uint16_t source = 0;
+  double a = 0.0;
+  double b = 0.0;
+};
+static_assert(sizeof(JournalEvent) == 32, "journal records are 32 bytes");
+
+/// The start of every journal file, records follow in the byte order of the
+/// machine that wrote them.
+struct JournalHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  // the same moment on link's clock and as unix time, in microseconds, to
+  // put wall clock times on the records
+  int64_t hostTime;
+  int64_t wallTime;
+};
+static_assert(sizeof(JournalHeader) == 32, "journal header is 32 bytes");
+
+constexpr char journal_magic[8] = {'J', 'T', 'L', 'J', 'R', 'N', 'L', '\0'};
+constexpr uint32_t journal_version = 1;
+
+// the name the dump tool prints and filters on, nullptr for an unknown type
+const char *journalEventName(JournalEvent::Type type);
+// the type called name, returns false if there isn't one
+bool parseJournalEventType(const std::string &name, JournalEvent::Type &type);
+
+/// Records transport events from any thread, the realtime threads included,
+/// into a lock free queue, and writes them to a binary file from a thread of
+/// its own. The file is rotated once it reaches maxFileBytes, keeping
+/// path.1 up to path.(files - 1) as well, and an existing journal is rotated
+/// away on start so a restart doesn't lose what led up to it.
+///
+/// Events that don't fit in the queue are counted and the count written to
+/// the file in their place.
+class Journal {
+public:
+  static constexpr size_t queue_size = 4096;
+  static constexpr std::chrono::milliseconds drain_interval{100};
+
+  Journal(const std::string &path, size_t maxFileBytes, size_t files);
+  // writes out whatever is still queued
+  ~Journal();
+  Journal(const Journal &) = delete;
+  Journal &operator=(const Journal &) = delete;
+
+  // the first file could be created, nothing is recorded if it couldn't
+  bool isOpen() const { return mOpen; }
+
+  // realtime safe, any thread. Returns false if the queue is full
+  bool record(const JournalEvent &event);
+  // link's clock, for events recorded off the realtime threads
+  static int64_t now();
+
+  // events that didn't fit in the queue
+  uint64_t dropped() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+  void run();
+  // write out everything queued
+  void drain();
+  void write(const JournalEvent &event);
+  // move the files along and start a new one at mPath
+  bool rotate();
+
+  std::string mPath;
+  size_t mMaxFileBytes;
+  size_t mFiles;
+  bool mOpen = false;
+
+  MPSCQueue<JournalEvent, queue_size> mQueue;
+  std::atomic<uint64_t> mDropped = 0;
+
+  // the writer thread
+  FILE *mFile = nullptr;
+  size_t mFileBytes = 0;
+  uint64_t mDroppedWritten = 0;
+  bool mWriteFailed = false;
+
+  std::mutex mMutex;
+  std::condition_variable mWake;
+  bool mStop = false;
+  std::thread mThread;
+};
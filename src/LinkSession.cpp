@@ -0,0 +1,226 @@
+#include "LinkSession.hpp"
+#include "JackTransportLink.hpp"
+
+#include <cmath>
+
+LinkSession::LinkSession(double bpm, bool enableStartStopSync,
+                         bool enableLink)
+    : mLink(bpm), mBase(mLink.captureAppSessionState()),
+      mPublished(publish(mBase, 1.0)) {
+  // link calls back from its own thread, hand it to every bridge
+  mLink.setTempoCallback([this](double bpm) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto &slot : mSlots) {
+      if (slot.bridge != nullptr) {
+        slot.bridge->linkTempoChanged(bpm);
+      }
+    }
+  });
+  mLink.setStartStopCallback([this](bool isPlaying) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto &slot : mSlots) {
+      if (slot.bridge != nullptr) {
+        slot.bridge->linkStartStopChanged(isPlaying);
+      }
+    }
+  });
+  mLink.setNumPeersCallback([this](std::size_t numPeers) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto &slot : mSlots) {
+      if (slot.bridge != nullptr) {
+        slot.bridge->linkNumPeersChanged(numPeers);
+      }
+    }
+  });
+  mLink.enableStartStopSync(enableStartStopSync);
+  mLink.enable(enableLink);
+}
+
+LinkSession::~LinkSession() {
+  // no more callbacks from the network once disabled
+  mLink.enable(false);
+}
+
+int LinkSession::attach(JackTransportLink *bridge) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (size_t i = 0; i < mSlots.size(); i++) {
+    auto &slot = mSlots[i];
+    if (slot.bridge != nullptr) {
+      continue;
+    }
+    slot.bridge = bridge;
+    slot.last.reset();
+    slot.beatOffset = 0.0;
+    mBridgeCount.fetch_add(1, std::memory_order_relaxed);
+    int index = static_cast<int>(i);
+    if (mOwner.load(std::memory_order_relaxed) < 0) {
+      mOwner.store(index, std::memory_order_release);
+    }
+    return index;
+  }
+  return -1;
+}
+
+void LinkSession::detach(int slot) {
+  if (slot < 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mMutex);
+  mSlots[static_cast<size_t>(slot)].bridge = nullptr;
+  mBridgeCount.fetch_sub(1, std::memory_order_relaxed);
+  if (mOwner.load(std::memory_order_relaxed) != slot) {
+    return;
+  }
+  // the next cycle of the new owner applies anything still queued
+  int owner = -1;
+  for (size_t i = 0; i < mSlots.size(); i++) {
+    if (mSlots[i].bridge != nullptr) {
+      owner = static_cast<int>(i);
+      break;
+    }
+  }
+  mOwner.store(owner, std::memory_order_release);
+}
+
+void LinkSession::beginCycle(int slot, double quantum) {
+  if (slot < 0 || mOwner.load(std::memory_order_acquire) != slot) {
+    return;
+  }
+  for (size_t i = 0; i < mSlots.size(); i++) {
+    Commit commit;
+    while (mSlots[i].commits.pop(commit)) {
+      if (commit) {
+        mLink.commitAudioSessionState(*commit);
+      }
+      mApplied[i]++;
+    }
+  }
+  auto published = publish(mLink.captureAudioSessionState(), quantum);
+  published.applied = mApplied;
+  mPublished.write(published);
+}
+
+ableton::Link::SessionState
+LinkSession::captureAudioSessionState(int slot) const {
+  if (slot >= 0 && mOwner.load(std::memory_order_acquire) == slot) {
+    return mLink.captureAudioSessionState();
+  }
+  auto published = mPublished.read();
+  if (slot >= 0) {
+    // our own commit until the owner has applied it, so we see what we set
+    // straight away like the owner does
+    auto &s = mSlots[static_cast<size_t>(slot)];
+    if (s.last && published.applied[static_cast<size_t>(slot)] != s.pushed) {
+      return *s.last;
+    }
+  }
+  return rebuild(published);
+}
+
+void LinkSession::commitAudioSessionState(
+    int slot, const ableton::Link::SessionState &state) {
+  if (slot < 0) {
+    return;
+  }
+  if (mOwner.load(std::memory_order_acquire) == slot) {
+    mLink.commitAudioSessionState(state);
+    return;
+  }
+  auto &s = mSlots[static_cast<size_t>(slot)];
+  if (s.commits.push(state)) {
+    s.pushed++;
+    s.last = state;
+  }
+}
+
+double LinkSession::beatAtTime(int slot,
+                               const ableton::Link::SessionState &state,
+                               std::chrono::microseconds time,
+                               double quantum) const {
+  double beat = state.beatAtTime(time, quantum);
+  if (slot >= 0) {
+    beat += mSlots[static_cast<size_t>(slot)].beatOffset;
+  }
+  return beat;
+}
+
+double LinkSession::phaseAtTime(int slot,
+                                const ableton::Link::SessionState &state,
+                                std::chrono::microseconds time,
+                                double quantum) const {
+  double beat = beatAtTime(slot, state, time, quantum);
+  return beat - quantum * std::floor(beat / quantum);
+}
+
+void LinkSession::requestBeatAtTime(int slot,
+                                    ableton::Link::SessionState &state,
+                                    double beat,
+                                    std::chrono::microseconds time,
+                                    double quantum) {
+  if (slot < 0 || (bridgeCount() < 2 && mLink.numPeers() > 0)) {
+    if (slot >= 0) {
+      mSlots[static_cast<size_t>(slot)].beatOffset = 0.0;
+    }
+    state.requestBeatAtTime(beat, time, quantum);
+    return;
+  }
+  // link would force the beat without peers. Our beat at the next time, at
+  // or after time, that the session is at beat's phase, like link does for a
+  // peer
+  double sessionBeat = state.beatAtTime(time, quantum);
+  double delta = (beat - quantum * std::floor(beat / quantum)) -
+                 (sessionBeat - quantum * std::floor(sessionBeat / quantum));
+  if (delta < 0.0) {
+    delta += quantum;
+  }
+  mSlots[static_cast<size_t>(slot)].beatOffset = beat - delta - sessionBeat;
+}
+
+void LinkSession::forceBeatAtTime(int slot, ableton::Link::SessionState &state,
+                                  double beat, std::chrono::microseconds time,
+                                  double quantum) {
+  if (slot >= 0) {
+    mSlots[static_cast<size_t>(slot)].beatOffset = 0.0;
+  }
+  state.forceBeatAtTime(beat, time, quantum);
+}
+
+LinkSession::Published
+LinkSession::publish(const ableton::Link::SessionState &state,
+                     double quantum) const {
+  Published published;
+  auto time = mLink.clock().micros();
+  published.tempo = state.tempo();
+  published.beat = state.beatAtTime(time, quantum);
+  published.time = time.count();
+  published.quantum = quantum;
+  published.isPlaying = state.isPlaying();
+  published.timeForIsPlaying = state.timeForIsPlaying().count();
+  return published;
+}
+
+ableton::Link::SessionState
+LinkSession::rebuild(const Published &published) const {
+  auto state = mBase;
+  std::chrono::microseconds time(published.time);
+  state.setTempo(published.tempo, time);
+  // link keeps the phase in the beat, so the owner's quantum puts it back
+  state.forceBeatAtTime(published.beat, time, published.quantum);
+  state.setIsPlaying(published.isPlaying,
+                     std::chrono::microseconds(published.timeForIsPlaying));
+  return state;
+}
+
+void LinkSession::enableStartStopSync(bool enable) {
+  // the property we set on the other servers comes back through here
+  if (mLink.isStartStopSyncEnabled() == enable) {
+    return;
+  }
+  mLink.enableStartStopSync(enable);
+  std::lock_guard<std::mutex> lock(mMutex);
+  for (auto &slot : mSlots) {
+    if (slot.bridge != nullptr) {
+      slot.bridge->linkStartStopSyncChanged();
+    }
+  }
+}
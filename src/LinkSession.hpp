@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+#include "LockFree.hpp"
+
+#include <ableton/Link.hpp>
+
+class JackTransportLink;
+
+/// A Link session shared by the bridges to one or more jack servers, so a
+/// single process shows up as a single peer whatever the number of servers.
+///
+/// Link's audio session state may only be used from one realtime thread. The
+/// first bridge to attach owns it, the others read a copy the owner publishes
+/// every cycle and queue their commits for the owner to apply, so no server's
+/// realtime thread ever waits on another's. Ownership passes to another
+/// bridge when the owner detaches, after its realtime thread has stopped.
+class LinkSession {
+public:
+  // jack servers one session can bridge
+  static constexpr size_t max_bridges = 8;
+
+  LinkSession(double bpm, bool enableStartStopSync, bool enableLink);
+  ~LinkSession();
+
+  ableton::Link &link() { return mLink; }
+  const ableton::Link &link() const { return mLink; }
+
+  // not realtime safe, attach before the bridge activates and detach after
+  // it deactivates. attach returns the bridge's slot, -1 if there is none
+  // left, in which case the bridge can read the session but not change it
+  int attach(JackTransportLink *bridge);
+  void detach(int slot);
+  // any thread, the bridges attached
+  size_t bridgeCount() const {
+    return mBridgeCount.load(std::memory_order_relaxed);
+  }
+
+  // realtime, from the bridge in slot. beginCycle, at the start of every
+  // cycle, lets the owner apply the other bridges' commits and publish the
+  // session at its quantum
+  void beginCycle(int slot, double quantum);
+  ableton::Link::SessionState captureAudioSessionState(int slot) const;
+  void commitAudioSessionState(int slot,
+                               const ableton::Link::SessionState &state);
+
+  // realtime, from the bridge in slot, the session state's beat methods with
+  // the bridge's own beats. Like link peers the bridges share tempo and
+  // phase, and unless link has peers to do it for us, a request only moves
+  // the bridge's own beats by whole quanta, it never moves the other servers
+  // or the session's phase
+  double beatAtTime(int slot, const ableton::Link::SessionState &state,
+                    std::chrono::microseconds time, double quantum) const;
+  double phaseAtTime(int slot, const ableton::Link::SessionState &state,
+                     std::chrono::microseconds time, double quantum) const;
+  void requestBeatAtTime(int slot, ableton::Link::SessionState &state,
+                         double beat, std::chrono::microseconds time,
+                         double quantum);
+  void forceBeatAtTime(int slot, ableton::Link::SessionState &state,
+                       double beat, std::chrono::microseconds time,
+                       double quantum);
+
+  // from a bridge, every bridge reports the change on its server
+  void enableStartStopSync(bool enable);
+
+private:
+  typedef std::optional<ableton::Link::SessionState> Commit;
+
+  struct Slot {
+    // guarded by mMutex
+    JackTransportLink *bridge = nullptr;
+    // commits from a bridge that doesn't own the audio session state
+    SPSCQueue<Commit, 16> commits;
+    // the bridge's realtime thread only: commits pushed ever, and the last
+    // one, which it reads back until the owner has published it
+    alignas(cacheline_size) uint64_t pushed = 0;
+    Commit last;
+    // added to the session's beats to get the bridge's
+    double beatOffset = 0.0;
+  };
+
+  // what the owner publishes every cycle. Link's session state has no
+  // default constructor and isn't trivially copyable, so it goes out as the
+  // values it is rebuilt from
+  struct Published {
+    double tempo = 0.0;
+    // the beat at time, at quantum
+    double beat = 0.0;
+    int64_t time = 0;
+    double quantum = 1.0;
+    bool isPlaying = false;
+    int64_t timeForIsPlaying = 0;
+    // commits popped from each slot ever, up to date in the above
+    std::array<uint64_t, max_bridges> applied = {};
+  };
+
+  Published publish(const ableton::Link::SessionState &state,
+                    double quantum) const;
+  // the published session state, from a copy of mBase
+  ableton::Link::SessionState rebuild(const Published &published) const;
+
+  ableton::Link mLink;
+  // a state to rebuild the published one on, never committed as it is
+  const ableton::Link::SessionState mBase;
+
+  std::mutex mMutex;
+  std::array<Slot, max_bridges> mSlots;
+  // the slot whose bridge owns the audio session state, -1 for none
+  std::atomic<int> mOwner = -1;
+  std::atomic<size_t> mBridgeCount = 0;
+  // the owner's realtime thread only
+  std::array<uint64_t, max_bridges> mApplied = {};
+  DoubleBuffer<Published> mPublished;
+};
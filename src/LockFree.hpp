@@ -0,0 +1,167 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// keep data written by different threads on different cache lines
+constexpr size_t cacheline_size = 64;
+
+/// Single producer, single consumer, wait free ring buffer.
+/// Capacity must be a power of two, one slot is always left empty.
+template <typename T, size_t Capacity> class SPSCQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+public:
+  // producer only, returns false if the queue is full
+  bool push(const T &value) {
+    auto tail = mTail.load(std::memory_order_relaxed);
+    auto next = (tail + 1) & (Capacity - 1);
+    if (next == mHead.load(std::memory_order_acquire)) {
+      return false;
+    }
+    mItems[tail] = value;
+    mTail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only, returns false if the queue is empty
+  bool pop(T &value) {
+    auto head = mHead.load(std::memory_order_relaxed);
+    if (head == mTail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = mItems[head];
+    mHead.store((head + 1) & (Capacity - 1), std::memory_order_release);
+    return true;
+  }
+
+private:
+  alignas(cacheline_size) std::atomic<size_t> mHead = 0;
+  alignas(cacheline_size) std::atomic<size_t> mTail = 0;
+  alignas(cacheline_size) std::array<T, Capacity> mItems;
+};
+
+/// Multiple producer, single consumer, lock free ring buffer.
+/// Capacity must be a power of two, every slot can be used.
+///
+/// Each slot carries a sequence number that says whose turn it is, producers
+/// claim a slot by advancing the tail and the consumer frees it for the
+/// producer a lap later. A producer only retries if another claimed the same
+/// slot first. The consumer sees nothing past a slot that has been claimed
+/// but not yet filled.
+template <typename T, size_t Capacity> class MPSCQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+public:
+  MPSCQueue() {
+    for (size_t i = 0; i < Capacity; i++) {
+      mSlots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // any thread, returns false if the queue is full
+  bool push(const T &value) {
+    auto tail = mTail.load(std::memory_order_relaxed);
+    while (true) {
+      auto &slot = mSlots[tail & (Capacity - 1)];
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      if (sequence == tail) {
+        if (mTail.compare_exchange_weak(tail, tail + 1,
+                                        std::memory_order_relaxed)) {
+          slot.value = value;
+          slot.sequence.store(tail + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (sequence < tail) {
+        // the consumer hasn't freed it since the last lap
+        return false;
+      } else {
+        tail = mTail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // consumer only, returns false if the queue is empty
+  bool pop(T &value) {
+    auto &slot = mSlots[mHead & (Capacity - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != mHead + 1) {
+      return false;
+    }
+    value = slot.value;
+    slot.sequence.store(mHead + Capacity, std::memory_order_release);
+    mHead++;
+    return true;
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  alignas(cacheline_size) std::atomic<size_t> mTail = 0;
+  alignas(cacheline_size) size_t mHead = 0;
+  alignas(cacheline_size) std::array<Slot, Capacity> mSlots;
+};
+
+/// Single writer, multiple reader, double buffered snapshot.
+///
+/// The writer never waits, it alternates between two slots and readers copy
+/// the last completed one. A reader only retries if the writer has started
+/// to overwrite the slot it was copying, which takes a full write. The slots
+/// are copied through atomic words so there is no data race, even on a retry.
+template <typename T> class DoubleBuffer {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "snapshot type must be trivially copyable");
+  static constexpr size_t word_count =
+      (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+  typedef std::array<std::atomic<uint64_t>, word_count> Slot;
+
+public:
+  DoubleBuffer() { write(T{}); }
+  explicit DoubleBuffer(const T &initial) { write(initial); }
+
+  // writer only
+  void write(const T &value) {
+    auto n = mDone.load(std::memory_order_relaxed);
+    mWriting.store(n, std::memory_order_relaxed);
+
+    uint64_t words[word_count] = {};
+    std::memcpy(words, &value, sizeof(T));
+    auto &slot = mSlots[n & 1];
+    // a reader that sees any of these words also sees mWriting
+    for (size_t i = 0; i < word_count; i++) {
+      slot[i].store(words[i], std::memory_order_release);
+    }
+    mDone.store(n + 1, std::memory_order_release);
+  }
+
+  T read() const {
+    uint64_t words[word_count];
+    while (true) {
+      auto done = mDone.load(std::memory_order_acquire);
+      auto &slot = mSlots[(done - 1) & 1];
+      for (size_t i = 0; i < word_count; i++) {
+        words[i] = slot[i].load(std::memory_order_acquire);
+      }
+      // write number done + 1 reuses our slot
+      if (mWriting.load(std::memory_order_relaxed) <= done) {
+        break;
+      }
+    }
+    T value;
+    std::memcpy(&value, words, sizeof(T));
+    return value;
+  }
+
+private:
+  alignas(cacheline_size) std::atomic<uint64_t> mWriting = 0;
+  std::atomic<uint64_t> mDone = 0;
+  std::array<Slot, 2> mSlots = {};
+};
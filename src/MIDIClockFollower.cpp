@@ -0,0 +1,122 @@
+#include "MIDIClockFollower.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+const double clocks_per_beat = 24.0;
+const int clocks_per_sixteenth = 6;
+// clock ticks later or earlier than this, in periods, restart the loop
+const double max_error_periods = 1.5;
+// no clock for this long, in periods or seconds if that is longer, unlocks
+const double timeout_periods = 8.0;
+const double timeout_seconds = 0.5;
+} // namespace
+
+MIDIClockFollower::MIDIClockFollower(double bandwidth)
+    : mBandwidth(bandwidth) {}
+
+MIDIClockFollower::Event
+MIDIClockFollower::process(const uint8_t *data, size_t size, double seconds) {
+  if (size == 0) {
+    return Event::None;
+  }
+  switch (data[0]) {
+  case 0xF8:
+    tick(seconds);
+    if (mRunning) {
+      if (mFirstClock) {
+        mClock = mSongPosition * clocks_per_sixteenth;
+        mFirstClock = false;
+      } else {
+        mClock++;
+      }
+    }
+    return Event::None;
+  case 0xFA:
+    mSongPosition = 0;
+    mRunning = true;
+    mFirstClock = true;
+    return Event::Start;
+  case 0xFB:
+    mRunning = true;
+    mFirstClock = true;
+    return Event::Continue;
+  case 0xFC:
+    mRunning = false;
+    return Event::Stop;
+  case 0xF2:
+    if (size < 3) {
+      return Event::None;
+    }
+    mSongPosition = static_cast<int64_t>(data[1] & 0x7F) |
+                    (static_cast<int64_t>(data[2] & 0x7F) << 7);
+    mClock = mSongPosition * clocks_per_sixteenth;
+    return Event::SongPosition;
+  default:
+    return Event::None;
+  }
+}
+
+void MIDIClockFollower::timeout(double seconds) {
+  double limit = std::max(timeout_seconds, timeout_periods * mPeriod);
+  if (mTicks > 0 && seconds - mLastTick > limit) {
+    mTicks = 0;
+  }
+}
+
+double MIDIClockFollower::bpm() const {
+  return 60.0 / (mPeriod * clocks_per_beat);
+}
+
+double MIDIClockFollower::beatAt(double seconds) const {
+  double clock = static_cast<double>(mClock);
+  if (locked() && mRunning && !mFirstClock) {
+    clock += std::clamp((seconds - mT0) / mPeriod, 0.0, 1.0);
+  }
+  return clock / clocks_per_beat;
+}
+
+double MIDIClockFollower::position() const {
+  return static_cast<double>(mSongPosition * clocks_per_sixteenth) /
+         clocks_per_beat;
+}
+
+void MIDIClockFollower::tick(double seconds) {
+  mLastTick = seconds;
+  if (mTicks == 0) {
+    mT1 = seconds;
+    mTicks = 1;
+    return;
+  }
+  if (mTicks == 1) {
+    // the first interval seeds the period
+    double period = seconds - mT1;
+    if (period <= 0.0) {
+      mT1 = seconds;
+      return;
+    }
+    mPeriod = period;
+    mT0 = seconds;
+    mT1 = seconds + period;
+    mTicks = 2;
+    return;
+  }
+
+  double error = seconds - mT1;
+  if (std::abs(error) > max_error_periods * mPeriod) {
+    // dropped clocks or a tempo jump, start over from this tick
+    mT1 = seconds;
+    mTicks = 1;
+    return;
+  }
+
+  // critically damped, the coefficients follow the period
+  const double omega = 2.0 * M_PI * mBandwidth * mPeriod;
+  const double b = std::sqrt(2.0) * omega;
+  const double c = omega * omega;
+  mT0 = mT1;
+  mT1 += b * error + mPeriod;
+  mPeriod += c * error;
+  mTicks++;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Follows an external 24 PPQ MIDI clock.
+///
+/// The tempo comes from a second order delay locked loop on the clock tick
+/// times (see Fons Adriaensen, "Using a DLL to filter time"), so jitter on the
+/// incoming clock is smoothed out instead of turning into tempo changes.
+/// Start, continue, stop and song position pointer messages are reported back
+/// for the transport. Realtime safe.
+class MIDIClockFollower {
+public:
+  enum class Event { None, Start, Continue, Stop, SongPosition };
+
+  // loop bandwidth in Hz, lower is smoother but slower to follow changes
+  explicit MIDIClockFollower(double bandwidth = 0.5);
+
+  // a complete midi message received at seconds, on any monotonic time base
+  Event process(const uint8_t *data, size_t size, double seconds);
+  // forget the tempo if the clock has stopped coming
+  void timeout(double seconds);
+
+  // there is a tempo estimate
+  bool locked() const { return mTicks >= 2; }
+  double bpm() const;
+  // between a start or continue and a stop
+  bool running() const { return mRunning; }
+  // beats since the song start at seconds, extrapolated from the filtered
+  // time of the last clock, but never past the next one
+  double beatAt(double seconds) const;
+  // the position set by the last start or song position pointer, in beats
+  double position() const;
+
+private:
+  void tick(double seconds);
+
+  double mBandwidth;
+
+  // filtered time of the last tick, predicted time of the next one and the
+  // filtered period
+  double mT0 = 0.0;
+  double mT1 = 0.0;
+  double mPeriod = 0.0;
+  uint64_t mTicks = 0;
+  double mLastTick = 0.0;
+
+  bool mRunning = false;
+  // the first clock after a start or continue is at the song position
+  bool mFirstClock = false;
+  int64_t mSongPosition = 0; // 16ths
+  int64_t mClock = 0;        // song position of the last clock, in clocks
+};
@@ -0,0 +1,107 @@
+#include "MIDITimecode.hpp"
+
+bool parseMTCRate(const std::string &s, MTCRate &rate) {
+  if (s == "24") {
+    rate = MTCRate::FPS24;
+  } else if (s == "25") {
+    rate = MTCRate::FPS25;
+  } else if (s == "29.97" || s == "29.97df") {
+    rate = MTCRate::FPS2997Drop;
+  } else if (s == "30") {
+    rate = MTCRate::FPS30;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+double mtcFramesPerSecond(MTCRate rate) {
+  switch (rate) {
+  case MTCRate::FPS24:
+    return 24.0;
+  case MTCRate::FPS25:
+    return 25.0;
+  case MTCRate::FPS2997Drop:
+    return 30000.0 / 1001.0;
+  case MTCRate::FPS30:
+    break;
+  }
+  return 30.0;
+}
+
+Timecode mtcTimecode(uint64_t frame, MTCRate rate) {
+  int nominal = 30;
+  switch (rate) {
+  case MTCRate::FPS24:
+    nominal = 24;
+    break;
+  case MTCRate::FPS25:
+    nominal = 25;
+    break;
+  case MTCRate::FPS2997Drop: {
+    // frame numbers 0 and 1 are skipped every minute, except every 10th
+    const uint64_t per10Minutes = 17982;
+    const uint64_t perMinute = 1798;
+    uint64_t tens = frame / per10Minutes;
+    uint64_t rem = frame % per10Minutes;
+    frame += 18 * tens;
+    if (rem > 1) {
+      frame += 2 * ((rem - 2) / perMinute);
+    }
+  } break;
+  case MTCRate::FPS30:
+    break;
+  }
+
+  Timecode tc;
+  tc.frames = static_cast<int>(frame % nominal);
+  uint64_t seconds = frame / nominal;
+  tc.seconds = static_cast<int>(seconds % 60);
+  tc.minutes = static_cast<int>((seconds / 60) % 60);
+  tc.hours = static_cast<int>((seconds / 3600) % 24);
+  return tc;
+}
+
+uint8_t mtcQuarterFrame(int piece, const Timecode &tc, MTCRate rate) {
+  int value = 0;
+  switch (piece) {
+  case 0:
+    value = tc.frames & 0xF;
+    break;
+  case 1:
+    value = (tc.frames >> 4) & 0x1;
+    break;
+  case 2:
+    value = tc.seconds & 0xF;
+    break;
+  case 3:
+    value = (tc.seconds >> 4) & 0x3;
+    break;
+  case 4:
+    value = tc.minutes & 0xF;
+    break;
+  case 5:
+    value = (tc.minutes >> 4) & 0x3;
+    break;
+  case 6:
+    value = tc.hours & 0xF;
+    break;
+  default:
+    value = ((tc.hours >> 4) & 0x1) | (static_cast<int>(rate) << 1);
+    break;
+  }
+  return static_cast<uint8_t>((piece << 4) | value);
+}
+
+std::array<uint8_t, 10> mtcFullFrame(const Timecode &tc, MTCRate rate) {
+  return {0xF0,
+          0x7F,
+          0x7F,
+          0x01,
+          0x01,
+          static_cast<uint8_t>((static_cast<int>(rate) << 5) | tc.hours),
+          static_cast<uint8_t>(tc.minutes),
+          static_cast<uint8_t>(tc.seconds),
+          static_cast<uint8_t>(tc.frames),
+          0xF7};
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+/// MIDI time code frame rates, the values are the rate bits in the hours
+/// byte.
+enum class MTCRate : uint8_t {
+  FPS24 = 0,
+  FPS25 = 1,
+  FPS2997Drop = 2,
+  FPS30 = 3
+};
+
+struct Timecode {
+  int hours = 0;
+  int minutes = 0;
+  int seconds = 0;
+  int frames = 0;
+};
+
+// parse 24, 25, 29.97 or 30, returns false for anything else
+bool parseMTCRate(const std::string &s, MTCRate &rate);
+
+// timecode frames per second, 30000/1001 for drop frame
+double mtcFramesPerSecond(MTCRate rate);
+
+// the timecode of a count of frames since 00:00:00:00, with drop frame
+// numbering for 29.97
+Timecode mtcTimecode(uint64_t frame, MTCRate rate);
+
+// data byte of quarter frame message piece (0-7), the full message is 0xF1
+// followed by this
+uint8_t mtcQuarterFrame(int piece, const Timecode &tc, MTCRate rate);
+
+// full frame sysex that locates a receiver
+std::array<uint8_t, 10> mtcFullFrame(const Timecode &tc, MTCRate rate);
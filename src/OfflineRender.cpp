@@ -0,0 +1,524 @@
+#include "OfflineRender.hpp"
+#include "JackTransportLink.hpp"
+#include "SimBackend.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+struct TempoChange {
+  double seconds;
+  double bpm;
+};
+
+struct RenderedEvent {
+  uint64_t frame;
+  std::string port;
+  std::vector<jack_midi_data_t> data;
+};
+
+// tempo estimates are only compared once the follower has had time to settle
+const double follow_settle_seconds = 2.0;
+
+bool parseBPMScript(const std::string &script, double initialBPM,
+                    std::vector<TempoChange> &changes) {
+  changes.clear();
+  changes.push_back({0.0, initialBPM});
+  std::stringstream ss(script);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.empty()) {
+      continue;
+    }
+    auto colon = item.find(':');
+    if (colon == std::string::npos) {
+      return false;
+    }
+    try {
+      double seconds = std::stod(item.substr(0, colon));
+      double bpm = std::stod(item.substr(colon + 1));
+      if (seconds < 0.0 || bpm <= 0.0) {
+        return false;
+      }
+      changes.push_back({seconds, bpm});
+    } catch (std::exception &) {
+      return false;
+    }
+  }
+  std::stable_sort(changes.begin(), changes.end(),
+                   [](const TempoChange &a, const TempoChange &b) {
+                     return a.seconds < b.seconds;
+                   });
+  return true;
+}
+
+// the ideal timeline described by the script, used to measure drift
+class ScriptTimeline {
+public:
+  ScriptTimeline(const std::vector<TempoChange> &changes, double sr)
+      : mChanges(changes), mSampleRate(sr) {}
+
+  double bpmAtFrame(double frame) const {
+    double bpm = mChanges.front().bpm;
+    for (auto &c : mChanges) {
+      if (c.seconds * mSampleRate > frame) {
+        break;
+      }
+      bpm = c.bpm;
+    }
+    return bpm;
+  }
+
+  double beatAtFrame(double frame) const {
+    double beat = 0.0;
+    for (size_t i = 0; i < mChanges.size(); i++) {
+      double start = mChanges[i].seconds * mSampleRate;
+      double end = i + 1 < mChanges.size()
+                       ? mChanges[i + 1].seconds * mSampleRate
+                       : frame;
+      end = std::min(end, frame);
+      if (end > start) {
+        beat += (end - start) * mChanges[i].bpm / (60.0 * mSampleRate);
+      }
+    }
+    return beat;
+  }
+
+  double frameAtBeat(double beat) const {
+    double acc = 0.0;
+    for (size_t i = 0; i < mChanges.size(); i++) {
+      double start = mChanges[i].seconds * mSampleRate;
+      double framesPerBeat = 60.0 * mSampleRate / mChanges[i].bpm;
+      if (i + 1 < mChanges.size()) {
+        double end = mChanges[i + 1].seconds * mSampleRate;
+        double beats = (end - start) / framesPerBeat;
+        if (acc + beats < beat) {
+          acc += beats;
+          continue;
+        }
+      }
+      return start + (beat - acc) * framesPerBeat;
+    }
+    return 0.0;
+  }
+
+private:
+  const std::vector<TempoChange> &mChanges;
+  double mSampleRate;
+};
+
+bool hasExtension(const std::string &path, const std::string &ext) {
+  return path.size() >= ext.size() &&
+         std::equal(ext.rbegin(), ext.rend(), path.rbegin(),
+                    [](char a, char b) { return a == std::tolower(b); });
+}
+
+void writeCSV(std::ostream &out, const std::vector<RenderedEvent> &events,
+              double sr) {
+  out << "frame,seconds,port,data" << std::endl;
+  char hex[4];
+  for (auto &e : events) {
+    out << e.frame << "," << static_cast<double>(e.frame) / sr << "," << e.port
+        << ",";
+    for (size_t i = 0; i < e.data.size(); i++) {
+      std::snprintf(hex, sizeof(hex), "%02x", e.data[i]);
+      out << (i == 0 ? "" : " ") << hex;
+    }
+    out << "\n";
+  }
+}
+
+// read the events of the first port in a csv written by writeCSV
+bool readCSV(std::istream &in, std::vector<RenderedEvent> &events) {
+  std::string line;
+  if (!std::getline(in, line)) {
+    return false;
+  }
+  while (std::getline(in, line)) {
+    std::stringstream ss(line);
+    std::string frame, seconds, port, data;
+    if (!std::getline(ss, frame, ',') || !std::getline(ss, seconds, ',') ||
+        !std::getline(ss, port, ',') || !std::getline(ss, data)) {
+      return false;
+    }
+    if (!events.empty() && port != events.front().port) {
+      continue;
+    }
+    RenderedEvent e;
+    e.port = port;
+    try {
+      e.frame = std::stoull(frame);
+      std::stringstream bytes(data);
+      std::string byte;
+      while (bytes >> byte) {
+        e.data.push_back(
+            static_cast<jack_midi_data_t>(std::stoul(byte, nullptr, 16)));
+      }
+    } catch (std::exception &) {
+      return false;
+    }
+    events.push_back(std::move(e));
+  }
+  return true;
+}
+
+void writeBE(std::ostream &out, uint32_t v, int bytes) {
+  for (int i = bytes - 1; i >= 0; i--) {
+    out.put(static_cast<char>((v >> (8 * i)) & 0xFF));
+  }
+}
+
+void writeVarLen(std::vector<uint8_t> &out, uint32_t v) {
+  uint8_t bytes[5];
+  int n = 0;
+  bytes[n++] = v & 0x7F;
+  while ((v >>= 7) != 0) {
+    bytes[n++] = 0x80 | (v & 0x7F);
+  }
+  while (n > 0) {
+    out.push_back(bytes[--n]);
+  }
+}
+
+// format 0 file where one tick is exactly one frame: the division is the
+// smallest that gives an integer microseconds per quarter tempo
+bool writeSMF(std::ostream &out, const std::vector<RenderedEvent> &events,
+              uint32_t sr) {
+  const uint32_t division = sr / std::gcd(sr, 1000000u);
+  const uint64_t usPerQuarter =
+      static_cast<uint64_t>(division) * 1000000u / sr;
+  if (division > 0x7FFF || usPerQuarter > 0xFFFFFF) {
+    std::cerr << "cannot represent sample rate " << sr
+              << " frame accurately in a midi file, use csv" << std::endl;
+    return false;
+  }
+
+  std::vector<uint8_t> track;
+  // tempo
+  track.insert(track.end(), {0x00, 0xFF, 0x51, 0x03});
+  track.push_back((usPerQuarter >> 16) & 0xFF);
+  track.push_back((usPerQuarter >> 8) & 0xFF);
+  track.push_back(usPerQuarter & 0xFF);
+
+  uint64_t last = 0;
+  for (auto &e : events) {
+    writeVarLen(track, static_cast<uint32_t>(e.frame - last));
+    last = e.frame;
+    if (e.data.size() > 0 && e.data[0] == 0xF0) {
+      // sysex, the length excludes the leading status
+      track.push_back(0xF0);
+      writeVarLen(track, static_cast<uint32_t>(e.data.size() - 1));
+      track.insert(track.end(), e.data.begin() + 1, e.data.end());
+    } else if (e.data.size() > 0 && e.data[0] >= 0xF1) {
+      // system common/realtime messages are stored as escaped events
+      track.push_back(0xF7);
+      writeVarLen(track, static_cast<uint32_t>(e.data.size()));
+      track.insert(track.end(), e.data.begin(), e.data.end());
+    } else {
+      track.insert(track.end(), e.data.begin(), e.data.end());
+    }
+  }
+  track.insert(track.end(), {0x00, 0xFF, 0x2F, 0x00});
+
+  out.write("MThd", 4);
+  writeBE(out, 6, 4);
+  writeBE(out, 0, 2); // format
+  writeBE(out, 1, 2); // tracks
+  writeBE(out, division, 2);
+  out.write("MTrk", 4);
+  writeBE(out, static_cast<uint32_t>(track.size()), 4);
+  out.write(reinterpret_cast<const char *>(track.data()), track.size());
+  return true;
+}
+
+void writeLE(std::ostream &out, uint32_t v, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    out.put(static_cast<char>((v >> (8 * i)) & 0xFF));
+  }
+}
+
+void writeWAV(std::ostream &out, const std::vector<float> &samples,
+              uint32_t sr) {
+  const auto bytes = static_cast<uint32_t>(samples.size() * sizeof(float));
+  out.write("RIFF", 4);
+  writeLE(out, 36 + bytes, 4);
+  out.write("WAVEfmt ", 8);
+  writeLE(out, 16, 4);
+  writeLE(out, 3, 2); // ieee float
+  writeLE(out, 1, 2); // channels
+  writeLE(out, sr, 4);
+  writeLE(out, sr * sizeof(float), 4);
+  writeLE(out, sizeof(float), 2);
+  writeLE(out, 32, 2);
+  out.write("data", 4);
+  writeLE(out, bytes, 4);
+  out.write(reinterpret_cast<const char *>(samples.data()), bytes);
+}
+
+} // namespace
+
+int offlineRender(const RenderSettings &settings) {
+  std::vector<TempoChange> script;
+  if (!parseBPMScript(settings.bpmScript, settings.initialBPM, script)) {
+    std::cerr << "cannot parse bpm script: " << settings.bpmScript
+              << std::endl;
+    return -1;
+  }
+  const double sr = static_cast<double>(settings.sampleRate);
+  ScriptTimeline timeline(script, sr);
+
+  std::vector<RenderedEvent> events;
+
+  // clock statistics
+  uint64_t clocks = 0, starts = 0, continues = 0, stops = 0;
+  int64_t clockIndex = -1; // since last start or continue
+  uint64_t startFrame = 0, lastClockFrame = 0;
+  double startBeat = 0.0;
+  double intervalMin = 0.0, intervalMax = 0.0, intervalSum = 0.0;
+  uint64_t intervalCount = 0;
+  double maxJitter = 0.0, maxDrift = 0.0, lastDrift = 0.0;
+
+  uint64_t maxCommandLatency = 0;
+  JackTransportLink::RTSnapshot last;
+  std::ostringstream stats;
+
+  // input clock, with the arrival frames after jitter
+  std::vector<RenderedEvent> input;
+  std::vector<uint64_t> arrivals;
+  const bool follow = !settings.clockInputPath.empty();
+  if (follow) {
+    std::ifstream in(settings.clockInputPath);
+    if (!in || !readCSV(in, input)) {
+      std::cerr << "cannot read clock input " << settings.clockInputPath
+                << std::endl;
+      return -1;
+    }
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> jitter(
+        -settings.clockInputJitterUsecs, settings.clockInputJitterUsecs);
+    for (auto &e : input) {
+      double offset = settings.clockInputJitterUsecs > 0.0
+                          ? jitter(gen) * sr / 1e6
+                          : 0.0;
+      auto frame = static_cast<uint64_t>(
+          std::max(0.0, static_cast<double>(e.frame) + offset));
+      // jitter doesn't reorder messages
+      if (!arrivals.empty()) {
+        frame = std::max(frame, arrivals.back());
+      }
+      arrivals.push_back(frame);
+    }
+  }
+
+  // tempo error against the input clock's tempo over the last beat, per
+  // interval for the raw ticks and per cycle for the filtered tempo
+  double naiveErrorSum = 0.0, naiveErrorMax = 0.0;
+  uint64_t naiveCount = 0;
+  double followErrorSum = 0.0, followErrorMax = 0.0;
+  uint64_t followCount = 0;
+  auto bpmOf = [sr](uint64_t interval, size_t clocks) {
+    return 60.0 * sr * static_cast<double>(clocks) /
+           (24.0 * static_cast<double>(interval));
+  };
+  std::vector<double> inputBPM(input.size(), 0.0);
+  size_t run = 0; // consecutive clocks
+  for (size_t i = 0; i < input.size(); i++) {
+    bool isClock = input[i].data.size() == 1 && input[i].data[0] == 0xF8;
+    run = isClock ? run + 1 : 0;
+    if (run <= 24) {
+      continue;
+    }
+    inputBPM[i] = bpmOf(input[i].frame - input[i - 24].frame, 24);
+    if (static_cast<double>(input[i].frame) < follow_settle_seconds * sr ||
+        arrivals[i] == arrivals[i - 1]) {
+      continue;
+    }
+    double naive = bpmOf(arrivals[i] - arrivals[i - 1], 1);
+    double error = std::abs(naive - inputBPM[i]);
+    naiveErrorSum += error * error;
+    naiveErrorMax = std::max(naiveErrorMax, error);
+    naiveCount++;
+  }
+
+  auto backend =
+      std::make_unique<SimBackend>(settings.sampleRate, settings.bufferSize);
+  SimBackend *sim = backend.get();
+  sim->setTimeJitter(settings.timeJitterUsecs);
+  sim->setMIDISink([&](const std::string &port, uint64_t frame,
+                       const jack_midi_data_t *data, size_t size) {
+    events.push_back({frame, port, std::vector<jack_midi_data_t>(
+                                       data, data + size)});
+    if (size != 1) {
+      return;
+    }
+    switch (data[0]) {
+    case 0xFA:
+    case 0xFB:
+      (data[0] == 0xFA ? starts : continues)++;
+      clockIndex = -1;
+      startFrame = frame;
+      startBeat = timeline.beatAtFrame(static_cast<double>(frame));
+      break;
+    case 0xFC:
+      stops++;
+      clockIndex = -1;
+      break;
+    case 0xF8: {
+      clocks++;
+      clockIndex++;
+      // the first clock after a start or continue is intentionally delayed
+      if (clockIndex >= 2) {
+        double interval = static_cast<double>(frame - lastClockFrame);
+        double nominal =
+            60.0 * sr /
+            (timeline.bpmAtFrame(static_cast<double>(frame)) * 24.0);
+        if (intervalCount == 0) {
+          intervalMin = intervalMax = interval;
+        }
+        intervalMin = std::min(intervalMin, interval);
+        intervalMax = std::max(intervalMax, interval);
+        intervalSum += interval;
+        intervalCount++;
+        maxJitter = std::max(maxJitter, std::abs(interval - nominal));
+      }
+      if (clockIndex >= 1) {
+        double ideal = timeline.frameAtBeat(
+            startBeat + static_cast<double>(clockIndex) / 24.0);
+        lastDrift = static_cast<double>(frame) - ideal;
+        maxDrift = std::max(maxDrift, std::abs(lastDrift));
+      }
+      lastClockFrame = frame;
+    } break;
+    default:
+      break;
+    }
+  });
+
+  jack_nframes_t lastFrame = 0;
+  std::vector<float> click;
+  {
+    JackTransportLink::Settings bridgeSettings;
+    bridgeSettings.enableStartStopSync = settings.enableStartStopSync;
+    bridgeSettings.initialBPM = script.front().bpm;
+    bridgeSettings.initialQuantum = settings.initialQuantum;
+    bridgeSettings.initialTimeSigDenom = settings.initialTimeSigDenom;
+    bridgeSettings.initialTicksPerBeat = settings.initialTicksPerBeat;
+    bridgeSettings.enableLink = false;
+    bridgeSettings.followMIDIClock = follow;
+    bridgeSettings.rawHostTime = settings.rawHostTime;
+    bridgeSettings.maxStartHoldSeconds = settings.maxStartHoldSeconds;
+    bridgeSettings.clickSubdivision = settings.clickSubdivision;
+    JackTransportLink j(std::move(backend), bridgeSettings);
+    j.setSyncLink(settings.syncLink);
+
+    if (follow) {
+      for (size_t i = 0; i < input.size(); i++) {
+        sim->queueMIDIInput("clock_in", arrivals[i], input[i].data);
+      }
+    } else {
+      sim->transportStart();
+    }
+    const auto totalFrames = static_cast<uint64_t>(settings.seconds * sr);
+    size_t nextChange = 1;
+    size_t nextInput = 0;
+    while (sim->frameTime() < totalFrames) {
+      while (nextChange < script.size() &&
+             script[nextChange].seconds * sr <=
+                 static_cast<double>(sim->frameTime())) {
+        j.setBPM(script[nextChange++].bpm);
+      }
+      sim->cycle();
+      j.processEvents();
+      if (auto samples = sim->audioBuffer("click")) {
+        if (!settings.clickOutputPath.empty()) {
+          click.insert(click.end(), samples, samples + settings.bufferSize);
+        }
+      }
+
+      // compare with the tempo of the last interval the follower has seen
+      while (nextInput < input.size() &&
+             arrivals[nextInput] + settings.bufferSize < sim->frameTime()) {
+        nextInput++;
+      }
+      if (nextInput > 0 && inputBPM[nextInput - 1] > 0.0 &&
+          static_cast<double>(sim->frameTime()) >=
+              follow_settle_seconds * sr) {
+        double error = std::abs(j.snapshot().bpm - inputBPM[nextInput - 1]);
+        followErrorSum += error * error;
+        followErrorMax = std::max(followErrorMax, error);
+        followCount++;
+      }
+    }
+    last = j.snapshot();
+    lastFrame = sim->position().frame;
+    maxCommandLatency = last.maxCommandLatency;
+    writeStats(stats, j.rtStats(), j.notificationStats());
+  }
+
+  if (!settings.outputPath.empty()) {
+    std::ofstream out(settings.outputPath, std::ios::out | std::ios::binary);
+    if (!out) {
+      std::cerr << "cannot open " << settings.outputPath << std::endl;
+      return -1;
+    }
+    if (hasExtension(settings.outputPath, ".mid") ||
+        hasExtension(settings.outputPath, ".smf")) {
+      if (!writeSMF(out, events, settings.sampleRate)) {
+        return -1;
+      }
+    } else {
+      writeCSV(out, events, sr);
+    }
+  }
+  if (!settings.clickOutputPath.empty()) {
+    std::ofstream out(settings.clickOutputPath,
+                      std::ios::out | std::ios::binary);
+    if (!out) {
+      std::cerr << "cannot open " << settings.clickOutputPath << std::endl;
+      return -1;
+    }
+    writeWAV(out, click, settings.sampleRate);
+  }
+
+  std::cout << "sample rate: " << settings.sampleRate
+            << " buffer size: " << settings.bufferSize << std::endl;
+  std::cout << "control to realtime latency cycles max: " << maxCommandLatency
+            << std::endl;
+  std::cout << "cycle time error usecs raw rms: " << last.rawTimeErrorRms
+            << " max: " << last.rawTimeErrorMax
+            << " filtered rms: " << last.filteredTimeErrorRms
+            << " max: " << last.filteredTimeErrorMax << std::endl;
+  std::cout << "final beat: " << std::setprecision(17) << last.beat
+            << std::setprecision(6) << " at frame: " << lastFrame << std::endl;
+  std::cout << "events: " << events.size() << " clocks: " << clocks
+            << " starts: " << starts << " continues: " << continues
+            << " stops: " << stops << std::endl;
+  if (intervalCount > 0) {
+    std::cout << "clock interval frames min: " << intervalMin
+              << " mean: " << intervalSum / static_cast<double>(intervalCount)
+              << " max: " << intervalMax << std::endl;
+    std::cout << "clock jitter frames max: " << maxJitter << std::endl;
+    if (!follow) {
+      std::cout << "clock drift frames max: " << maxDrift
+                << " last: " << lastDrift << std::endl;
+    }
+  }
+  std::cout << stats.str();
+  if (naiveCount > 0 && followCount > 0) {
+    std::cout << "input tempo error bpm rms raw: "
+              << std::sqrt(naiveErrorSum / static_cast<double>(naiveCount))
+              << " max: " << naiveErrorMax << " followed rms: "
+              << std::sqrt(followErrorSum / static_cast<double>(followCount))
+              << " max: " << followErrorMax << std::endl;
+  }
+  return 0;
+}
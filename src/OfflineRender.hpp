@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+
+#include <jack/types.h>
+
+/// Settings for rendering the clock engine offline, without a JACK server.
+struct RenderSettings {
+  jack_nframes_t sampleRate = 48000;
+  jack_nframes_t bufferSize = 256;
+  double seconds = 60.0;
+  // jitter, in microseconds, added to the simulated cycle times
+  double timeJitterUsecs = 0.0;
+  // comma separated list of seconds:bpm pairs, eg: "0:120,30:140.5"
+  std::string bpmScript;
+  // .mid/.smf for a standard midi file, anything else is written as csv
+  std::string outputPath;
+  // follow the clock in a csv written by a previous render, instead of
+  // starting the transport ourselves
+  std::string clockInputPath;
+  // jitter, in microseconds, added to the arrival of the input clock
+  double clockInputJitterUsecs = 0.0;
+
+  bool enableStartStopSync = true;
+  // give link the jittered cycle times instead of the filtered host time
+  bool rawHostTime = false;
+  // false to run from the internal timeline
+  bool syncLink = true;
+  // longest a start is held for link's quantum boundary
+  double maxStartHoldSeconds = 2.0;
+  // clicks per beat on a click port, 0 for none
+  int clickSubdivision = 0;
+  // write the click port to a 32 bit float wav file
+  std::string clickOutputPath;
+  double initialBPM = 100.0;
+  double initialQuantum = 4.0;
+  float initialTimeSigDenom = 4.0f;
+  double initialTicksPerBeat = 1920.0;
+};
+
+/// Drive JackTransportLink from a SimBackend, write out every MIDI event with
+/// its absolute frame and print clock jitter/drift statistics to stdout.
+/// Returns 0 on success.
+int offlineRender(const RenderSettings &settings);
@@ -0,0 +1,280 @@
+#include "OscPublisher.hpp"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace {
+sockaddr_in to_sockaddr(const oscpack::IpEndpointName &endpoint) {
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(static_cast<uint32_t>(endpoint.address));
+  addr.sin_port = htons(static_cast<uint16_t>(endpoint.port));
+  return addr;
+}
+
+// messages from the unix domain and tcp listeners have no address
+bool has_address(const oscpack::IpEndpointName &endpoint) {
+  return endpoint.port != oscpack::IpEndpointName::ANY_PORT;
+}
+
+bool same_endpoint(const sockaddr_in &a, const sockaddr_in &b) {
+  return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+// ipv4 address for host, blocks on a name lookup so only called off the loop
+bool resolve(const char *host, sockaddr_in &addr) {
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo *result = nullptr;
+  if (getaddrinfo(host, nullptr, &hints, &result) != 0 || result == nullptr) {
+    return false;
+  }
+  addr.sin_addr =
+      reinterpret_cast<const sockaddr_in *>(result->ai_addr)->sin_addr;
+  freeaddrinfo(result);
+  return true;
+}
+} // namespace
+
+OscPublisher::OscPublisher(const JackTransportLink &link, int fd)
+    : mLink(link), mFD(fd), mLookups(std::make_shared<Lookups>()),
+      mPacket(mBuffer.data(), mBuffer.size()),
+      mStatsPacket(mStatsBuffer.data(), mStatsBuffer.size()) {
+  mSubscribers.reserve(max_subscribers);
+}
+
+void OscPublisher::processLookups() {
+  mLookups->notifier.drain();
+  std::vector<Lookup> done;
+  {
+    std::lock_guard<std::mutex> lock(mLookups->mutex);
+    done.swap(mLookups->done);
+  }
+  for (auto &l : done) {
+    if (l.resolved) {
+      subscribe(l.addr, l.rate);
+    } else {
+      std::cerr << "/jacklink/subscribe cannot resolve " << l.host
+                << std::endl;
+    }
+  }
+}
+
+bool OscPublisher::processMessage(
+    const oscpack::ReceivedMessage &m,
+    const oscpack::IpEndpointName &remoteEndpoint) {
+  if (std::strcmp("/jacklink/query", m.AddressPattern()) == 0) {
+    if (has_address(remoteEndpoint)) {
+      build();
+      send(to_sockaddr(remoteEndpoint), mPacket);
+    }
+    return true;
+  }
+  if (std::strcmp("/jacklink/stats", m.AddressPattern()) == 0) {
+    if (has_address(remoteEndpoint)) {
+      buildStats();
+      send(to_sockaddr(remoteEndpoint), mStatsPacket);
+    }
+    return true;
+  }
+  if (std::strcmp("/jacklink/subscribe", m.AddressPattern()) != 0) {
+    return false;
+  }
+
+  auto arg = m.ArgumentsBegin();
+  if (m.ArgumentCount() != 3 || !arg->IsString()) {
+    std::cerr << "usage: /jacklink/subscribe host port rate" << std::endl;
+    return true;
+  }
+  sockaddr_in addr = to_sockaddr(remoteEndpoint);
+  const char *host = (arg++)->AsStringUnchecked();
+  std::optional<double> port = GetOscDouble(*(arg++));
+  std::optional<double> rate = GetOscDouble(*arg);
+  if (!port || *port <= 0.0 || *port > 65535.0 || !rate || *rate < 0.0) {
+    std::cerr << "/jacklink/subscribe port or rate out of range" << std::endl;
+    return true;
+  }
+  if (*host == '\0' && !has_address(remoteEndpoint)) {
+    std::cerr << "/jacklink/subscribe needs a host when not sent over udp"
+              << std::endl;
+    return true;
+  }
+  addr.sin_port = htons(static_cast<uint16_t>(*port));
+  if (*host != '\0' && inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+    lookup(host, addr, *rate);
+    return true;
+  }
+  subscribe(addr, *rate);
+  return true;
+}
+
+int OscPublisher::publish() {
+  if (mSubscribers.empty()) {
+    return -1;
+  }
+
+  auto now = clock::now();
+  auto next = clock::time_point::max();
+  bool built = false;
+  for (auto &s : mSubscribers) {
+    if (s.next <= now) {
+      if (!built) {
+        build();
+        built = true;
+      }
+      send(s.addr, mPacket);
+      // don't try to catch up after a stall
+      s.next = std::max(s.next + s.period, now);
+    }
+    next = std::min(next, s.next);
+  }
+
+  // round up, a wait of 0 with the next one still due would spin the loop
+  auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+      next - clock::now());
+  return std::max(0, static_cast<int>(wait.count()) + 1);
+}
+
+void OscPublisher::publishStats() {
+  if (mSubscribers.empty()) {
+    return;
+  }
+  buildStats();
+  for (auto &s : mSubscribers) {
+    send(s.addr, mStatsPacket);
+  }
+}
+
+void OscPublisher::lookup(const std::string &host, const sockaddr_in &addr,
+                          double rate) {
+  {
+    std::lock_guard<std::mutex> lock(mLookups->mutex);
+    if (mLookups->running >= max_lookups) {
+      std::cerr << "too many pending name lookups, ignoring subscription"
+                << std::endl;
+      return;
+    }
+    ++mLookups->running;
+  }
+  // detached so that a lookup still waiting on the resolver doesn't hold up
+  // tearing the publisher down, the shared state outlives it
+  std::thread([lookups = mLookups, l = Lookup{host, addr, rate}]() mutable {
+    l.resolved = resolve(l.host.c_str(), l.addr);
+    {
+      std::lock_guard<std::mutex> lock(lookups->mutex);
+      lookups->done.push_back(std::move(l));
+      --lookups->running;
+    }
+    lookups->notifier.notify();
+  }).detach();
+}
+
+void OscPublisher::subscribe(const sockaddr_in &addr, double rate) {
+  auto it = std::find_if(
+      mSubscribers.begin(), mSubscribers.end(),
+      [&addr](const Subscriber &s) { return same_endpoint(s.addr, addr); });
+  if (rate <= 0.0) {
+    if (it != mSubscribers.end()) {
+      mSubscribers.erase(it);
+    }
+    return;
+  }
+
+  rate = std::min(rate, max_rate);
+  auto period = std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double>(1.0 / rate));
+  if (it != mSubscribers.end()) {
+    it->period = period;
+  } else if (mSubscribers.size() < max_subscribers) {
+    mSubscribers.push_back({addr, period, clock::now()});
+  } else {
+    std::cerr << "too many osc subscribers, ignoring subscription"
+              << std::endl;
+  }
+}
+
+void OscPublisher::build() {
+  auto snapshot = mLink.snapshot();
+  if (snapshot.cycle == mPacketCycle) {
+    return;
+  }
+  mPacketCycle = snapshot.cycle;
+
+  double phase = 0.0;
+  if (snapshot.quantum > 0.0) {
+    phase = snapshot.beat -
+            std::floor(snapshot.beat / snapshot.quantum) * snapshot.quantum;
+  }
+  bool playing = snapshot.transportState != JackTransportStopped;
+
+  mPacket.Clear();
+  mPacket << oscpack::BeginBundleImmediate
+          << oscpack::BeginMessage("/jacklink/state/bpm") << snapshot.bpm
+          << oscpack::EndMessage
+          << oscpack::BeginMessage("/jacklink/state/bbt") << snapshot.bar
+          << snapshot.barBeat << snapshot.tick << oscpack::EndMessage
+          << oscpack::BeginMessage("/jacklink/state/beat") << snapshot.beat
+          << oscpack::EndMessage
+          << oscpack::BeginMessage("/jacklink/state/phase") << phase
+          << snapshot.quantum << oscpack::EndMessage
+          << oscpack::BeginMessage("/jacklink/state/playing") << playing
+          << oscpack::EndMessage
+          << oscpack::BeginMessage("/jacklink/state/peers")
+          << static_cast<int32_t>(snapshot.numPeers) << oscpack::EndMessage
+          << oscpack::EndBundle;
+}
+
+void OscPublisher::buildStats() {
+  const auto &rt = mLink.rtStats();
+  const auto &notifications = mLink.notificationStats();
+  auto count = [](uint64_t v) { return static_cast<oscpack::int64>(v); };
+
+  mStatsPacket.Clear();
+  mStatsPacket << oscpack::BeginBundleImmediate
+               << oscpack::BeginMessage("/jacklink/stats/process")
+               << count(rt.processNanos.count())
+               << count(rt.processNanos.quantile(0.5))
+               << count(rt.processNanos.quantile(0.99))
+               << count(rt.processNanos.max()) << oscpack::EndMessage
+               << oscpack::BeginMessage("/jacklink/stats/timebase")
+               << count(rt.timeBaseNanos.count())
+               << count(rt.timeBaseNanos.quantile(0.5))
+               << count(rt.timeBaseNanos.quantile(0.99))
+               << count(rt.timeBaseNanos.max()) << oscpack::EndMessage
+               << oscpack::BeginMessage("/jacklink/stats/counters")
+               << count(notifications.xruns.value())
+               << count(rt.clockResyncs.value())
+               << count(rt.repositions.value())
+               << count(rt.linkTempoChanges.value()) << oscpack::EndMessage
+               << oscpack::BeginMessage("/jacklink/stats/phase")
+               << rt.phaseErrorBeats.last() << rt.phaseErrorBeats.rms()
+               << rt.phaseErrorBeats.max() << oscpack::EndMessage
+               << oscpack::BeginMessage("/jacklink/stats/start")
+               << count(rt.heldStarts.value())
+               << rt.startPhaseErrorBeats.last()
+               << rt.startPhaseErrorBeats.rms()
+               << rt.startPhaseErrorBeats.max() << oscpack::EndMessage
+               << oscpack::BeginMessage("/jacklink/stats/properties")
+               << count(notifications.propertyWrites.value())
+               << count(notifications.propertyWritesSuppressed.value())
+               << oscpack::EndMessage
+               << oscpack::BeginMessage("/jacklink/stats/tempomap")
+               << count(rt.tempoMapFull.value()) << oscpack::EndMessage
+               << oscpack::EndBundle;
+}
+
+void OscPublisher::send(const sockaddr_in &addr,
+                        const oscpack::OutboundPacketStream &packet) {
+  // a full socket buffer drops this update, the next one is coming
+  sendto(mFD, packet.Data(), packet.Size(), 0,
+         reinterpret_cast<const sockaddr *>(&addr), sizeof(addr));
+}
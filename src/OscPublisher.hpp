@@ -0,0 +1,105 @@
+#pragma once
+
+#include "EventLoop.hpp"
+#include "JackTransportLink.hpp"
+
+#include <netinet/in.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <osc/OscOutboundPacketStream.h>
+
+/// Pushes the transport state to OSC subscribers and answers queries.
+///
+/// /jacklink/subscribe host port rate
+///     send the state to host:port rate times a second, an empty host means
+///     the sender, a rate of 0 unsubscribes
+/// /jacklink/query
+///     send the state once, back to the sender
+/// /jacklink/stats
+///     send the instrumentation once, back to the sender, subscribers also get
+///     it every time publishStats is called
+///
+/// Everything goes out over udp, a sender on the unix domain or tcp socket
+/// has no address to reply to and has to subscribe with a host. A host that
+/// isn't a numeric address is looked up on a thread of its own, the
+/// subscription starts once processLookups picks up the answer.
+///
+/// The state is a bundle of /jacklink/state/... messages, built from the
+/// realtime snapshot into a preallocated buffer and only rebuilt when the
+/// snapshot changes. Only used from the thread that processes osc.
+class OscPublisher {
+public:
+  static constexpr size_t max_subscribers = 64;
+  static constexpr double max_rate = 1000.0;
+  static constexpr size_t max_lookups = 4;
+
+  // send from fd, the socket we receive osc on so replies come from our port
+  OscPublisher(const JackTransportLink &link, int fd);
+
+  // returns false if the message isn't one of ours
+  bool processMessage(const oscpack::ReceivedMessage &m,
+                      const oscpack::IpEndpointName &remoteEndpoint);
+
+  // readable when a name lookup has finished
+  int fd() const { return mLookups->notifier.fd(); }
+  // subscribe the hosts whose lookup has finished
+  void processLookups();
+
+  // send to every subscriber that is due, returns the milliseconds until the
+  // next one is, -1 if there are no subscribers
+  int publish();
+  // send the instrumentation to every subscriber
+  void publishStats();
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  struct Subscriber {
+    sockaddr_in addr;
+    clock::duration period;
+    clock::time_point next;
+  };
+
+  struct Lookup {
+    std::string host;
+    sockaddr_in addr;
+    double rate;
+    bool resolved = false;
+  };
+
+  // shared with the lookup threads, which may outlive the publisher
+  struct Lookups {
+    std::mutex mutex;
+    std::vector<Lookup> done;
+    size_t running = 0;
+    EventNotifier notifier;
+  };
+
+  // resolve host off the loop, then subscribe addr with its address
+  void lookup(const std::string &host, const sockaddr_in &addr, double rate);
+  void subscribe(const sockaddr_in &addr, double rate);
+  // rebuild mPacket if the snapshot has changed
+  void build();
+  void buildStats();
+  void send(const sockaddr_in &addr,
+            const oscpack::OutboundPacketStream &packet);
+
+  const JackTransportLink &mLink;
+  int mFD;
+  std::vector<Subscriber> mSubscribers;
+  std::shared_ptr<Lookups> mLookups;
+
+  std::array<char, 1024> mBuffer;
+  oscpack::OutboundPacketStream mPacket;
+  uint64_t mPacketCycle = UINT64_MAX;
+
+  std::array<char, 1024> mStatsBuffer;
+  oscpack::OutboundPacketStream mStatsPacket;
+};
@@ -0,0 +1,264 @@
+#include "OscSockets.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <osc/OscException.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+namespace {
+void set_nonblocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+void process(oscpack::OscPacketListener &listener, const char *data,
+             size_t size, const oscpack::IpEndpointName &remote) {
+  try {
+    listener.ProcessPacket(data, static_cast<int>(size), remote);
+  } catch (oscpack::Exception &e) {
+    std::cerr << "error parsing osc packet " << e.what() << std::endl;
+  }
+}
+
+bool unix_address(const std::string &path, sockaddr_un &addr) {
+  addr = {};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "osc unix socket path too long " << path << std::endl;
+    return false;
+  }
+  std::strcpy(addr.sun_path, path.c_str());
+  return true;
+}
+
+// true if nothing is receiving on the socket at addr
+bool is_stale(const sockaddr_un &addr) {
+  int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    return false;
+  }
+  bool stale = connect(fd, reinterpret_cast<const sockaddr *>(&addr),
+                       sizeof(addr)) != 0 &&
+               errno == ECONNREFUSED;
+  ::close(fd);
+  return stale;
+}
+} // namespace
+
+int openOscUdpSocket(int port) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    std::cerr << "error creating osc socket " << std::strerror(errno)
+              << std::endl;
+    return -1;
+  }
+  set_nonblocking(fd);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    std::cerr << "error binding osc socket " << std::strerror(errno)
+              << std::endl;
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void readOscDatagrams(int fd, oscpack::OscPacketListener &listener) {
+  char buf[osc_max_packet];
+  while (true) {
+    sockaddr_storage addr = {};
+    socklen_t addrlen = sizeof(addr);
+    // the full size even when it didn't fit, so we can tell
+    ssize_t size = recvfrom(fd, buf, sizeof(buf), MSG_TRUNC,
+                            reinterpret_cast<sockaddr *>(&addr), &addrlen);
+    if (size <= 0) {
+      return;
+    }
+    if (static_cast<size_t>(size) > sizeof(buf)) {
+      std::cerr << "dropped osc packet of " << size << " bytes" << std::endl;
+      continue;
+    }
+    oscpack::IpEndpointName remote;
+    if (addr.ss_family == AF_INET) {
+      auto in = reinterpret_cast<const sockaddr_in *>(&addr);
+      remote = oscpack::IpEndpointName(ntohl(in->sin_addr.s_addr),
+                                       ntohs(in->sin_port));
+    }
+    process(listener, buf, static_cast<size_t>(size), remote);
+  }
+}
+
+OscUnixSocket::OscUnixSocket(const std::string &path) : mPath(path) {
+  sockaddr_un addr;
+  if (!unix_address(path, addr)) {
+    return;
+  }
+  int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    std::cerr << "error creating osc unix socket " << std::strerror(errno)
+              << std::endl;
+    return;
+  }
+  set_nonblocking(fd);
+  auto bind_path = [&]() {
+    return bind(fd, reinterpret_cast<const sockaddr *>(&addr),
+                sizeof(addr)) == 0;
+  };
+  bool bound = bind_path();
+  int err = errno;
+  struct stat st;
+  if (!bound && err == EADDRINUSE && lstat(path.c_str(), &st) == 0 &&
+      S_ISSOCK(st.st_mode) && is_stale(addr)) {
+    // left behind by a process that has gone away
+    unlink(path.c_str());
+    bound = bind_path();
+    err = errno;
+  }
+  if (!bound) {
+    std::cerr << "error binding osc unix socket " << path << " "
+              << std::strerror(err) << std::endl;
+    ::close(fd);
+    return;
+  }
+  mFD = fd;
+}
+
+OscUnixSocket::~OscUnixSocket() {
+  if (mFD >= 0) {
+    ::close(mFD);
+    unlink(mPath.c_str());
+  }
+}
+
+void SlipDecoder::encode(const char *data, size_t size,
+                         std::vector<char> &out) {
+  out.push_back(static_cast<char>(end));
+  for (size_t i = 0; i < size; i++) {
+    auto c = static_cast<uint8_t>(data[i]);
+    if (c == end) {
+      out.push_back(static_cast<char>(esc));
+      out.push_back(static_cast<char>(esc_end));
+    } else if (c == esc) {
+      out.push_back(static_cast<char>(esc));
+      out.push_back(static_cast<char>(esc_esc));
+    } else {
+      out.push_back(data[i]);
+    }
+  }
+  out.push_back(static_cast<char>(end));
+}
+
+OscStreamServer::OscStreamServer(EventLoop &loop,
+                                 oscpack::OscPacketListener &listener,
+                                 int port)
+    : mLoop(loop), mListener(listener) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    std::cerr << "error creating osc tcp socket " << std::strerror(errno)
+              << std::endl;
+    return;
+  }
+  set_nonblocking(fd);
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      listen(fd, static_cast<int>(max_connections)) != 0) {
+    std::cerr << "error binding osc tcp socket " << std::strerror(errno)
+              << std::endl;
+    ::close(fd);
+    return;
+  }
+  if (!mLoop.add(fd, [this]() { accept(); })) {
+    ::close(fd);
+    return;
+  }
+  mFD = fd;
+}
+
+OscStreamServer::~OscStreamServer() {
+  while (!mConnections.empty()) {
+    close(mConnections.begin());
+  }
+  if (mFD >= 0) {
+    mLoop.remove(mFD);
+    ::close(mFD);
+  }
+}
+
+int OscStreamServer::port() const {
+  sockaddr_in addr = {};
+  socklen_t addrlen = sizeof(addr);
+  if (mFD < 0 || getsockname(mFD, reinterpret_cast<sockaddr *>(&addr),
+                             &addrlen) != 0) {
+    return 0;
+  }
+  return ntohs(addr.sin_port);
+}
+
+void OscStreamServer::accept() {
+  while (true) {
+    int fd = ::accept(mFD, nullptr, nullptr);
+    if (fd < 0) {
+      return;
+    }
+    if (mConnections.size() >= max_connections) {
+      std::cerr << "too many osc tcp connections, closing the newest"
+                << std::endl;
+      ::close(fd);
+      continue;
+    }
+    set_nonblocking(fd);
+    auto c = mConnections.emplace(mConnections.end());
+    c->fd = fd;
+    if (!mLoop.add(fd, [this, c]() { read(c); })) {
+      ::close(fd);
+      mConnections.erase(c);
+    }
+  }
+}
+
+void OscStreamServer::read(std::list<Connection>::iterator c) {
+  char buf[osc_max_packet];
+  while (true) {
+    ssize_t size = ::read(c->fd, buf, sizeof(buf));
+    if (size > 0) {
+      c->decoder.feed(buf, static_cast<size_t>(size),
+                      [this](const char *data, size_t packetSize) {
+                        process(mListener, data, packetSize,
+                                oscpack::IpEndpointName());
+                      });
+      continue;
+    }
+    if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (size < 0 && errno == EINTR) {
+      continue;
+    }
+    // closed by the other end, or broken
+    close(c);
+    return;
+  }
+}
+
+void OscStreamServer::close(std::list<Connection>::iterator c) {
+  mLoop.remove(c->fd);
+  ::close(c->fd);
+  mConnections.erase(c);
+}
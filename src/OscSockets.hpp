@@ -0,0 +1,128 @@
+#pragma once
+
+#include "EventLoop.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <osc/OscPacketListener.h>
+
+// The sockets OSC arrives on, all non blocking and read from an EventLoop,
+// all feeding the same listener. UDP from anywhere, and for controllers on
+// the same machine a unix domain datagram socket, which doesn't drop
+// packets when we fall behind but blocks the sender instead, or a TCP
+// stream with each packet SLIP framed as OSC 1.1 specifies.
+//
+// Messages that arrive other than over UDP have no address to reply to,
+// their remote endpoint is oscpack's default, any address and any port.
+
+// the largest packet we accept, on any socket
+constexpr size_t osc_max_packet = 4096;
+
+// a non blocking udp socket bound to port on any address, -1 on failure
+int openOscUdpSocket(int port);
+// hand every pending datagram on fd, udp or unix domain, to the listener
+void readOscDatagrams(int fd, oscpack::OscPacketListener &listener);
+
+/// A unix domain datagram socket bound to a path, which is removed again on
+/// destruction. A socket left at the path by a process that has gone away
+/// is replaced, one still in use is not.
+class OscUnixSocket {
+public:
+  explicit OscUnixSocket(const std::string &path);
+  ~OscUnixSocket();
+  OscUnixSocket(const OscUnixSocket &) = delete;
+  OscUnixSocket &operator=(const OscUnixSocket &) = delete;
+
+  // -1 if the socket couldn't be bound
+  int fd() const { return mFD; }
+
+private:
+  std::string mPath;
+  int mFD = -1;
+};
+
+/// Splits a SLIP (RFC 1055) encoded stream into packets. OSC 1.1 frames
+/// packets with an END byte at both ends, so empty packets are skipped, and
+/// packets longer than osc_max_packet are dropped.
+class SlipDecoder {
+public:
+  static constexpr uint8_t end = 0xC0;
+  static constexpr uint8_t esc = 0xDB;
+  static constexpr uint8_t esc_end = 0xDC;
+  static constexpr uint8_t esc_esc = 0xDD;
+
+  SlipDecoder() { mPacket.reserve(osc_max_packet); }
+
+  // calls packet(data, size) for every packet that data completes
+  template <typename F> void feed(const char *data, size_t size, F packet) {
+    for (size_t i = 0; i < size; i++) {
+      auto c = static_cast<uint8_t>(data[i]);
+      if (c == end) {
+        if (!mPacket.empty() && !mOverflow) {
+          packet(mPacket.data(), mPacket.size());
+        }
+        mPacket.clear();
+        mEscape = mOverflow = false;
+        continue;
+      }
+      if (mEscape) {
+        c = c == esc_end ? end : c == esc_esc ? esc : c;
+        mEscape = false;
+      } else if (c == esc) {
+        mEscape = true;
+        continue;
+      }
+      if (mPacket.size() == osc_max_packet) {
+        mOverflow = true;
+      } else {
+        mPacket.push_back(static_cast<char>(c));
+      }
+    }
+  }
+
+  // append data to out as a single framed packet
+  static void encode(const char *data, size_t size, std::vector<char> &out);
+
+private:
+  std::vector<char> mPacket;
+  bool mEscape = false;
+  bool mOverflow = false;
+};
+
+/// Accepts TCP connections on a port, on any address, and hands the SLIP
+/// framed packets from each to the listener. Connections are added to and
+/// removed from the loop as they come and go.
+class OscStreamServer {
+public:
+  static constexpr size_t max_connections = 16;
+
+  // port 0 binds any free port, see port()
+  OscStreamServer(EventLoop &loop, oscpack::OscPacketListener &listener,
+                  int port);
+  ~OscStreamServer();
+  OscStreamServer(const OscStreamServer &) = delete;
+  OscStreamServer &operator=(const OscStreamServer &) = delete;
+
+  bool isOpen() const { return mFD >= 0; }
+  // the port bound, 0 if none is
+  int port() const;
+
+private:
+  struct Connection {
+    int fd = -1;
+    SlipDecoder decoder;
+  };
+
+  void accept();
+  void read(std::list<Connection>::iterator c);
+  void close(std::list<Connection>::iterator c);
+
+  EventLoop &mLoop;
+  oscpack::OscPacketListener &mListener;
+  int mFD = -1;
+  std::list<Connection> mConnections;
+};
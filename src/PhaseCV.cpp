@@ -0,0 +1,78 @@
+#include "PhaseCV.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+// trigger length, shortened to half a division if that is shorter
+const double trigger_seconds = 0.001;
+
+// the offset into the period is at most a few thousand steps, floats have
+// plenty of precision for that once the whole beats are taken out in double.
+// the index goes through int32_t as there is no vector conversion from size_t
+void rampKernel(float *__restrict out, int32_t n, float start, float step) {
+  for (int32_t i = 0; i < n; i++) {
+    float p = start + static_cast<float>(i) * step;
+    // p is never negative so truncation is floor, and it vectorizes
+    out[i] = p - static_cast<float>(static_cast<int32_t>(p));
+  }
+}
+
+void pulseKernel(float *__restrict out, int32_t n, float start, float step,
+                 float width) {
+  for (int32_t i = 0; i < n; i++) {
+    float p = start + static_cast<float>(i) * step;
+    p -= static_cast<float>(static_cast<int32_t>(p));
+    out[i] = p < width ? 1.0f : 0.0f;
+  }
+}
+
+double frac(double v) { return v - std::floor(v); }
+} // namespace
+
+PhaseCV::PhaseCV(int division) : mDivision(std::max(1, division)) {}
+
+void PhaseCV::ramp(float *out, size_t n, double start, double step) {
+  rampKernel(out, static_cast<int32_t>(n), static_cast<float>(frac(start)),
+             static_cast<float>(step));
+}
+
+void PhaseCV::pulse(float *out, size_t n, double start, double step,
+                    double width) {
+  pulseKernel(out, static_cast<int32_t>(n), static_cast<float>(frac(start)),
+              static_cast<float>(step), static_cast<float>(width));
+}
+
+void PhaseCV::process(const Outputs &outputs, uint32_t nframes,
+                      double sampleRate, double beat, double bpm,
+                      double quantum, bool rolling) const {
+  // beats per sample, 0 holds the ramps
+  double step = rolling && sampleRate > 0.0 ? bpm / (60.0 * sampleRate) : 0.0;
+  if (quantum <= 0.0) {
+    quantum = 1.0;
+  }
+  // link's beats can be negative before the start, phase wraps the same way
+  if (outputs.beatPhase != nullptr) {
+    ramp(outputs.beatPhase, nframes, frac(beat), step);
+  }
+  if (outputs.barPhase != nullptr) {
+    ramp(outputs.barPhase, nframes, frac(beat / quantum), step / quantum);
+  }
+
+  const double division = static_cast<double>(mDivision);
+  for (float *out : {outputs.gate, outputs.trigger}) {
+    if (out == nullptr) {
+      continue;
+    }
+    if (step <= 0.0) {
+      std::memset(out, 0, nframes * sizeof(float));
+      continue;
+    }
+    double width = 0.5;
+    if (out == outputs.trigger) {
+      width = std::min(0.5, trigger_seconds * sampleRate * step * division);
+    }
+    pulse(out, nframes, frac(beat * division), step * division, width);
+  }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Audio rate control signals from the transport, for modular synths: the
+/// phase within the beat and within the bar as 0..1 ramps, and a gate and a
+/// trigger on every division of the beat.
+///
+/// Every sample is computed from the beat at the start of the cycle and the
+/// tempo, so nothing accumulates from cycle to cycle, with kernels the
+/// compiler can vectorize. Realtime safe.
+class PhaseCV {
+public:
+  // any of these may be nullptr
+  struct Outputs {
+    float *beatPhase = nullptr;
+    float *barPhase = nullptr;
+    float *gate = nullptr;
+    float *trigger = nullptr;
+  };
+
+  // division: gates and triggers per beat
+  explicit PhaseCV(int division);
+
+  // fill the outputs for the transport at beat at the start of the cycle, the
+  // ramps hold still and the gates are low while stopped
+  void process(const Outputs &outputs, uint32_t nframes, double sampleRate,
+               double beat, double bpm, double quantum, bool rolling) const;
+
+  // out[i] = the fractional part of start + i * step, start and step >= 0
+  static void ramp(float *out, size_t n, double start, double step);
+  // out[i] = 1 while the fractional part of start + i * step is below width
+  static void pulse(float *out, size_t n, double start, double step,
+                    double width);
+
+private:
+  int mDivision;
+};
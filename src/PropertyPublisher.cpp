@@ -0,0 +1,105 @@
+#include "PropertyPublisher.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+PropertyPublisher::PropertyPublisher(
+    Backend &backend, jack_uuid_t subject,
+    std::chrono::steady_clock::duration minInterval, EventNotifier &events,
+    Counter &writes, Counter &suppressed)
+    : mBackend(backend), mSubject(subject), mMinInterval(minInterval),
+      mEvents(events), mWrites(writes), mSuppressed(suppressed) {}
+
+int PropertyPublisher::add(const char *key, const char *typeURI, Type type) {
+  Property p;
+  p.key = key;
+  p.typeURI = typeURI;
+  p.type = type;
+  mProperties.push_back(p);
+  return static_cast<int>(mProperties.size()) - 1;
+}
+
+void PropertyPublisher::set(int property, double value) {
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto &p = mProperties[static_cast<size_t>(property)];
+    p.value = value;
+    wake = p.sets++ == 0;
+  }
+  if (wake) {
+    mEvents.notify();
+  }
+}
+
+void PropertyPublisher::invalidate(int property) {
+  mProperties[static_cast<size_t>(property)].haveWritten = false;
+}
+
+bool PropertyPublisher::isOwnValue(int property, const char *value) const {
+  auto &p = mProperties[static_cast<size_t>(property)];
+  return p.haveWritten && std::strcmp(p.written.data(), value) == 0;
+}
+
+int PropertyPublisher::publish() {
+  auto now = clock::now();
+  int wait = -1;
+  for (auto &p : mProperties) {
+    double value;
+    uint64_t sets;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (p.sets == 0) {
+        continue;
+      }
+      if (now < p.next) {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      p.next - now)
+                      .count() +
+                  1;
+        wait = wait < 0 ? static_cast<int>(ms)
+                        : std::min(wait, static_cast<int>(ms));
+        continue;
+      }
+      value = p.value;
+      sets = p.sets;
+      p.sets = 0;
+    }
+
+    format(p.formatted, p.type, value);
+    if (p.haveWritten &&
+        std::strcmp(p.formatted.data(), p.written.data()) == 0) {
+      mSuppressed.add(sets);
+      continue;
+    }
+    mSuppressed.add(sets - 1);
+    if (mBackend.setProperty(mSubject, p.key, p.formatted.data(),
+                             p.typeURI) != 0) {
+      std::cerr << "cannot set property " << p.key << std::endl;
+      continue;
+    }
+    mWrites.increment();
+    p.written = p.formatted;
+    p.haveWritten = true;
+    p.next = now + mMinInterval;
+  }
+  return wait;
+}
+
+void PropertyPublisher::format(Buffer &buf, Type type, double value) {
+  switch (type) {
+  case Type::Decimal:
+    std::snprintf(buf.data(), buf.size(), "%f", value);
+    break;
+  case Type::Integer:
+    std::snprintf(buf.data(), buf.size(), "%lld", std::llround(value));
+    break;
+  case Type::Boolean:
+    std::snprintf(buf.data(), buf.size(), "%s",
+                  value != 0.0 ? "true" : "false");
+    break;
+  }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Backend.hpp"
+#include "EventLoop.hpp"
+#include "RTStats.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include <jack/types.h>
+
+/// Writes the jack metadata properties of one subject from a single thread,
+/// whichever thread changes them.
+///
+/// set only records the latest value and wakes the publishing thread, so
+/// link, jack and osc never wait on the server. publish writes each property
+/// at most once every min interval, with the latest value set, and skips it
+/// if that is what was written last. Values are formatted into buffers
+/// allocated up front. Every set that doesn't end up as a write of its own
+/// is counted as suppressed.
+class PropertyPublisher {
+public:
+  enum class Type { Decimal, Integer, Boolean };
+
+  // events is notified when a property needs publishing
+  PropertyPublisher(Backend &backend, jack_uuid_t subject,
+                    std::chrono::steady_clock::duration minInterval,
+                    EventNotifier &events, Counter &writes,
+                    Counter &suppressed);
+
+  // before any of the others, key and typeURI must outlive us, returns the
+  // index to set the property by
+  int add(const char *key, const char *typeURI, Type type);
+
+  // any thread
+  void set(int property, double value);
+
+  // the publishing thread. invalidate forgets what was written, so the next
+  // value is written even if it hasn't changed, eg after it was deleted
+  void invalidate(int property);
+  // true if value is what we wrote last, to recognise our own writes when
+  // jack reports the change back
+  bool isOwnValue(int property, const char *value) const;
+  // write every property that is due, returns the milliseconds until the
+  // next one is, -1 if none are waiting
+  int publish();
+
+private:
+  typedef std::chrono::steady_clock clock;
+  typedef std::array<char, 32> Buffer;
+
+  struct Property {
+    const char *key = nullptr;
+    const char *typeURI = nullptr;
+    Type type = Type::Decimal;
+    // guarded by mMutex, sets since the last publish
+    double value = 0.0;
+    uint64_t sets = 0;
+    // the publishing thread only
+    Buffer formatted = {};
+    Buffer written = {};
+    bool haveWritten = false;
+    clock::time_point next;
+  };
+
+  static void format(Buffer &buf, Type type, double value);
+
+  Backend &mBackend;
+  jack_uuid_t mSubject;
+  clock::duration mMinInterval;
+  EventNotifier &mEvents;
+  Counter &mWrites;
+  Counter &mSuppressed;
+
+  std::mutex mMutex;
+  std::vector<Property> mProperties;
+};
@@ -0,0 +1,229 @@
+#include "RTCheck.hpp"
+
+#ifdef JTL_RT_CHECKS
+
+#include <dlfcn.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+// We interpose the libc functions in the executable. Allocations go to
+// glibc's __libc_* entry points, locks are forwarded through dlsym and the
+// syscall wrappers go straight to syscall() so that none of the checks
+// themselves depend on the functions they check.
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+namespace {
+thread_local int rt_depth = 0;
+thread_local int rt_suspended = 0;
+thread_local int rt_wakeup = 0;
+bool warn_only = false;
+
+__attribute__((constructor)) void rt_check_init() {
+  const char *mode = std::getenv("JTL_RT_CHECKS");
+  warn_only = mode != nullptr && std::strcmp(mode, "warn") == 0;
+}
+
+void check(const char *what) {
+  if (rt_depth == 0 || rt_suspended != 0) {
+    return;
+  }
+  rt_suspended++;
+  const char prefix[] = "realtime violation: ";
+  syscall(SYS_write, 2, prefix, sizeof(prefix) - 1);
+  syscall(SYS_write, 2, what, std::strlen(what));
+  syscall(SYS_write, 2, "\n", 1);
+  if (!warn_only) {
+    std::abort();
+  }
+  rt_suspended--;
+}
+
+template <typename F> F real(F &cache, const char *name) {
+  if (cache == nullptr) {
+    cache = reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+  }
+  return cache;
+}
+} // namespace
+
+RTCheckScope::RTCheckScope() { rt_depth++; }
+RTCheckScope::~RTCheckScope() { rt_depth--; }
+
+RTCheckSuspend::RTCheckSuspend() { rt_suspended++; }
+RTCheckSuspend::~RTCheckSuspend() { rt_suspended--; }
+
+RTCheckWakeup::RTCheckWakeup() { rt_wakeup++; }
+RTCheckWakeup::~RTCheckWakeup() { rt_wakeup--; }
+
+extern "C" {
+
+// allocation
+
+void *malloc(size_t size) {
+  check("malloc");
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  check("calloc");
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  check("realloc");
+  return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+  check("memalign");
+  return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  check("aligned_alloc");
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+  check("posix_memalign");
+  *ptr = __libc_memalign(alignment, size);
+  return *ptr == nullptr && size != 0 ? ENOMEM : 0;
+}
+
+void free(void *ptr) {
+  if (ptr != nullptr) {
+    check("free");
+  }
+  __libc_free(ptr);
+}
+
+// locks
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  static int (*fn)(pthread_mutex_t *) = nullptr;
+  check("pthread_mutex_lock");
+  return real(fn, "pthread_mutex_lock")(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+  static int (*fn)(pthread_cond_t *, pthread_mutex_t *) = nullptr;
+  check("pthread_cond_wait");
+  return real(fn, "pthread_cond_wait")(cond, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           const struct timespec *abstime) {
+  static int (*fn)(pthread_cond_t *, pthread_mutex_t *,
+                   const struct timespec *) = nullptr;
+  check("pthread_cond_timedwait");
+  return real(fn, "pthread_cond_timedwait")(cond, mutex, abstime);
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *lock) {
+  static int (*fn)(pthread_rwlock_t *) = nullptr;
+  check("pthread_rwlock_rdlock");
+  return real(fn, "pthread_rwlock_rdlock")(lock);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *lock) {
+  static int (*fn)(pthread_rwlock_t *) = nullptr;
+  check("pthread_rwlock_wrlock");
+  return real(fn, "pthread_rwlock_wrlock")(lock);
+}
+
+int sem_wait(sem_t *sem) {
+  static int (*fn)(sem_t *) = nullptr;
+  check("sem_wait");
+  return real(fn, "sem_wait")(sem);
+}
+
+// syscalls
+
+ssize_t read(int fd, void *buf, size_t count) {
+  check("read");
+  return syscall(SYS_read, fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+  if (rt_wakeup == 0) {
+    check("write");
+  }
+  return syscall(SYS_write, fd, buf, count);
+}
+
+ssize_t send(int fd, const void *buf, size_t len, int flags) {
+  check("send");
+  return syscall(SYS_sendto, fd, buf, len, flags, nullptr, 0);
+}
+
+ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+               const struct sockaddr *addr, socklen_t addrlen) {
+  check("sendto");
+  return syscall(SYS_sendto, fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t recvfrom(int fd, void *buf, size_t len, int flags,
+                 struct sockaddr *addr, socklen_t *addrlen) {
+  check("recvfrom");
+  return syscall(SYS_recvfrom, fd, buf, len, flags, addr, addrlen);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+  static int (*fn)(struct pollfd *, nfds_t, int) = nullptr;
+  check("poll");
+  return real(fn, "poll")(fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+           struct timeval *timeout) {
+  static int (*fn)(int, fd_set *, fd_set *, fd_set *, struct timeval *) =
+      nullptr;
+  check("select");
+  return real(fn, "select")(nfds, readfds, writefds, exceptfds, timeout);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+  static int (*fn)(const struct timespec *, struct timespec *) = nullptr;
+  check("nanosleep");
+  return real(fn, "nanosleep")(req, rem);
+}
+
+int clock_nanosleep(clockid_t clockid, int flags,
+                    const struct timespec *request, struct timespec *remain) {
+  static int (*fn)(clockid_t, int, const struct timespec *,
+                   struct timespec *) = nullptr;
+  check("clock_nanosleep");
+  return real(fn, "clock_nanosleep")(clockid, flags, request, remain);
+}
+
+int usleep(useconds_t usec) {
+  static int (*fn)(useconds_t) = nullptr;
+  check("usleep");
+  return real(fn, "usleep")(usec);
+}
+
+int sched_yield() {
+  static int (*fn)() = nullptr;
+  check("sched_yield");
+  return real(fn, "sched_yield")();
+}
+}
+
+#endif
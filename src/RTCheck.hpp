@@ -0,0 +1,44 @@
+#pragma once
+
+// Debug mode that traps allocations, locks and blocking syscalls made from the
+// realtime callbacks, enabled with the RT_CHECKS cmake option.
+//
+// RT_CHECK_SCOPE() marks the rest of the enclosing block as realtime code,
+// RT_CHECK_SUSPEND() lifts that for the rest of its block (for simulation
+// hooks that aren't really realtime). RT_CHECK_WAKEUP() only allows write for
+// the rest of its block, for the non blocking eventfd or pipe write that wakes
+// another thread, everything else is still checked. A violation is written to
+// stderr and aborts, set JTL_RT_CHECKS=warn in the environment to only
+// report.
+
+#ifdef JTL_RT_CHECKS
+
+class RTCheckScope {
+public:
+  RTCheckScope();
+  ~RTCheckScope();
+};
+
+class RTCheckSuspend {
+public:
+  RTCheckSuspend();
+  ~RTCheckSuspend();
+};
+
+class RTCheckWakeup {
+public:
+  RTCheckWakeup();
+  ~RTCheckWakeup();
+};
+
+#define RT_CHECK_SCOPE() RTCheckScope rt_check_scope
+#define RT_CHECK_SUSPEND() RTCheckSuspend rt_check_suspend
+#define RT_CHECK_WAKEUP() RTCheckWakeup rt_check_wakeup
+
+#else
+
+#define RT_CHECK_SCOPE()
+#define RT_CHECK_SUSPEND()
+#define RT_CHECK_WAKEUP()
+
+#endif
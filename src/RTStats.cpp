@@ -0,0 +1,114 @@
+#include "RTStats.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+void DurationHistogram::record(uint64_t nanos) {
+  auto &b = mBuckets[bucketIndex(nanos)];
+  b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  mCount.store(mCount.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+  if (nanos > mMax.load(std::memory_order_relaxed)) {
+    mMax.store(nanos, std::memory_order_relaxed);
+  }
+}
+
+uint64_t DurationHistogram::quantile(double q) const {
+  uint64_t total = count();
+  if (total == 0) {
+    return 0;
+  }
+  auto target =
+      static_cast<uint64_t>(std::ceil(q * static_cast<double>(total)));
+  target = std::clamp<uint64_t>(target, 1, total);
+  uint64_t seen = 0;
+  for (size_t i = 0; i + 1 < bucket_count; i++) {
+    seen += bucket(i);
+    if (seen >= target) {
+      return std::min(bucketLower(i + 1) - 1, max());
+    }
+  }
+  return max();
+}
+
+uint64_t DurationHistogram::bucketLower(size_t index) {
+  // the first octave is exact
+  if (index < buckets_per_octave) {
+    return index;
+  }
+  size_t octave = index / buckets_per_octave + 1;
+  uint64_t sub = index % buckets_per_octave;
+  return (buckets_per_octave + sub) << (octave - 2);
+}
+
+size_t DurationHistogram::bucketIndex(uint64_t nanos) {
+  if (nanos < buckets_per_octave) {
+    return static_cast<size_t>(nanos);
+  }
+  // the top bit picks the octave, the two below it the bucket
+  size_t octave = 63 - static_cast<size_t>(__builtin_clzll(nanos));
+  size_t sub = static_cast<size_t>(nanos >> (octave - 2)) & 3;
+  return std::min((octave - 1) * buckets_per_octave + sub, bucket_count - 1);
+}
+
+void RunningError::add(double error) {
+  mCount.store(mCount.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+  mSumSquares.store(mSumSquares.load(std::memory_order_relaxed) +
+                        error * error,
+                    std::memory_order_relaxed);
+  mLast.store(error, std::memory_order_relaxed);
+  if (std::abs(error) > mMax.load(std::memory_order_relaxed)) {
+    mMax.store(std::abs(error), std::memory_order_relaxed);
+  }
+}
+
+double RunningError::rms() const {
+  uint64_t n = count();
+  if (n == 0) {
+    return 0.0;
+  }
+  return std::sqrt(mSumSquares.load(std::memory_order_relaxed) /
+                   static_cast<double>(n));
+}
+
+namespace {
+void writeHistogram(std::ostream &out, const char *name,
+                    const DurationHistogram &h) {
+  out << name << "_count " << h.count() << "\n";
+  out << name << "_p50 " << h.quantile(0.5) << "\n";
+  out << name << "_p99 " << h.quantile(0.99) << "\n";
+  out << name << "_max " << h.max() << "\n";
+  out << name << "_histogram";
+  for (size_t i = 0; i < DurationHistogram::bucket_count; i++) {
+    if (h.bucket(i) > 0) {
+      out << " " << DurationHistogram::bucketLower(i) << ":" << h.bucket(i);
+    }
+  }
+  out << "\n";
+}
+} // namespace
+
+void writeStats(std::ostream &out, const RTStats &rt,
+                const NotificationStats &notifications) {
+  out << "xruns " << notifications.xruns.value() << "\n";
+  out << "property_writes " << notifications.propertyWrites.value() << "\n";
+  out << "property_writes_suppressed "
+      << notifications.propertyWritesSuppressed.value() << "\n";
+  out << "clock_resyncs " << rt.clockResyncs.value() << "\n";
+  out << "repositions " << rt.repositions.value() << "\n";
+  out << "tempo_map_full " << rt.tempoMapFull.value() << "\n";
+  out << "link_tempo_changes " << rt.linkTempoChanges.value() << "\n";
+  out << "phase_error_beats_last " << rt.phaseErrorBeats.last() << "\n";
+  out << "phase_error_beats_rms " << rt.phaseErrorBeats.rms() << "\n";
+  out << "phase_error_beats_max " << rt.phaseErrorBeats.max() << "\n";
+  out << "held_starts " << rt.heldStarts.value() << "\n";
+  out << "start_phase_error_beats_last " << rt.startPhaseErrorBeats.last()
+      << "\n";
+  out << "start_phase_error_beats_rms " << rt.startPhaseErrorBeats.rms()
+      << "\n";
+  out << "start_phase_error_beats_max " << rt.startPhaseErrorBeats.max()
+      << "\n";
+  writeHistogram(out, "process_ns", rt.processNanos);
+  writeHistogram(out, "timebase_ns", rt.timeBaseNanos);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "LockFree.hpp"
+
+/// A counter with a single writer, read from any thread.
+class Counter {
+public:
+  // writer only
+  void increment() { add(1); }
+  void add(uint64_t n) {
+    mValue.store(mValue.load(std::memory_order_relaxed) + n,
+                 std::memory_order_relaxed);
+  }
+  uint64_t value() const { return mValue.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> mValue = 0;
+};
+
+/// Log scaled histogram of durations in nanoseconds, with a single writer and
+/// read from any thread. Four buckets per octave, anything over ~2 seconds
+/// lands in the last one.
+class DurationHistogram {
+public:
+  static constexpr size_t buckets_per_octave = 4;
+  static constexpr size_t bucket_count = 31 * buckets_per_octave;
+
+  // writer only
+  void record(uint64_t nanos);
+
+  uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+  uint64_t max() const { return mMax.load(std::memory_order_relaxed); }
+  uint64_t bucket(size_t index) const {
+    return mBuckets[index].load(std::memory_order_relaxed);
+  }
+  // upper bound of the bucket that holds the q quantile, never more than max
+  uint64_t quantile(double q) const;
+
+  // the smallest duration that lands in bucket index
+  static uint64_t bucketLower(size_t index);
+
+private:
+  static size_t bucketIndex(uint64_t nanos);
+
+  std::array<std::atomic<uint64_t>, bucket_count> mBuckets = {};
+  std::atomic<uint64_t> mCount = 0;
+  std::atomic<uint64_t> mMax = 0;
+};
+
+/// Last, rms and max of an error, with a single writer and read from any
+/// thread.
+class RunningError {
+public:
+  // writer only
+  void add(double error);
+
+  uint64_t count() const { return mCount.load(std::memory_order_relaxed); }
+  double last() const { return mLast.load(std::memory_order_relaxed); }
+  double max() const { return mMax.load(std::memory_order_relaxed); }
+  double rms() const;
+
+private:
+  std::atomic<uint64_t> mCount = 0;
+  std::atomic<double> mSumSquares = 0.0;
+  std::atomic<double> mLast = 0.0;
+  std::atomic<double> mMax = 0.0;
+};
+
+/// Instrumentation recorded by the realtime thread.
+struct RTStats {
+  DurationHistogram processNanos;
+  DurationHistogram timeBaseNanos;
+  // the midi clock lost count of the 24 clocks in a beat and restarted
+  Counter clockResyncs;
+  Counter repositions;
+  // tempo changes the tempo map had no room for
+  Counter tempoMapFull;
+  Counter linkTempoChanges;
+  // link's beat minus the beat a jack client extrapolates from the last BBT
+  RunningError phaseErrorBeats;
+  // starts the sync callback held for link's next quantum boundary
+  Counter heldStarts;
+  // distance of the first rolling beat of a start from a quantum boundary
+  RunningError startPhaseErrorBeats;
+};
+
+/// Instrumentation recorded off the realtime thread.
+struct NotificationStats {
+  // jack's notification thread
+  Counter xruns;
+  // the thread that publishes our metadata properties: writes made, and
+  // changes that didn't get a write of their own, as they were superseded
+  // within the rate limit or didn't change the value
+  Counter propertyWrites;
+  Counter propertyWritesSuppressed;
+};
+
+// "name value" lines, histograms also get a line of lower:count pairs for the
+// buckets that aren't empty
+void writeStats(std::ostream &out, const RTStats &rt,
+                const NotificationStats &notifications);
@@ -0,0 +1,292 @@
+#include "SimBackend.hpp"
+#include "JackTransportLink.hpp"
+#include "RTCheck.hpp"
+
+#include <ableton/link/LinearRegression.hpp>
+#include <ableton/platforms/Config.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace {
+// the same window as link's host time filter
+const size_t host_time_points = 512;
+} // namespace
+
+SimBackend::SimBackend(jack_nframes_t sampleRate, jack_nframes_t bufferSize)
+    : mSampleRate(sampleRate), mBufferSize(bufferSize),
+      mStartUsecs(static_cast<jack_time_t>(
+          ableton::link::platform::Clock().micros().count())) {
+  mPos.frame_rate = mSampleRate;
+  setSyncTimeout(2.0); // jack's default
+  mHostTimePoints.reserve(host_time_points);
+}
+
+SimBackend::~SimBackend() {}
+
+void SimBackend::cycle() {
+  if (mLink == nullptr) {
+    return;
+  }
+
+  double jitter = 0.0;
+  if (mJitterUsecs > 0.0) {
+    jitter = std::uniform_real_distribution<double>(-mJitterUsecs,
+                                                    mJitterUsecs)(mJitterGen);
+  }
+  auto offset = static_cast<int64_t>(std::llround(jitter));
+  mCycleUsecs = usecsAt(mFrameTime) + offset;
+  mNextCycleUsecs = usecsAt(mFrameTime + mBufferSize) + offset;
+  mPos.usecs = mCycleUsecs;
+
+  if (mTransportState == JackTransportStarting) {
+    if (JackTransportLink::syncCallback(mTransportState, &mPos, mLink) != 0 ||
+        mStartingFrames >= mSyncTimeoutFrames) {
+      mTransportState = JackTransportRolling;
+      mStartingFrames = 0;
+    } else {
+      mStartingFrames += mBufferSize;
+    }
+  }
+
+  for (auto &p : mPorts) {
+    if (p->audio) {
+      std::memset(p->samples.data(), 0,
+                  p->samples.size() * sizeof(jack_default_audio_sample_t));
+    }
+    // like jack, input is what arrived during the previous period
+    p->inputBegin = p->inputEnd;
+    while (p->inputEnd < p->input.size() &&
+           p->input[p->inputEnd].frame < mFrameTime) {
+      p->inputEnd++;
+    }
+  }
+
+  using std::chrono::steady_clock;
+  steady_clock::time_point start;
+  auto elapsed = [&start]() -> int64_t {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               steady_clock::now() - start)
+        .count();
+  };
+
+  mProcessNanos = mTimeBaseNanos = 0;
+  if (mMeasureCallbacks) {
+    start = steady_clock::now();
+  }
+  JackTransportLink::processCallback(mBufferSize, mLink);
+  if (mMeasureCallbacks) {
+    mProcessNanos = elapsed();
+  }
+
+  // the timebase master fills in the position for the next cycle
+  if (mTransportState == JackTransportRolling) {
+    mPos.frame += mBufferSize;
+  }
+  if (mTransportState != JackTransportStopped) {
+    if (mMeasureCallbacks) {
+      start = steady_clock::now();
+    }
+    JackTransportLink::timeBaseCallback(mTransportState, mBufferSize, &mPos,
+                                        mPosIsNew ? 1 : 0, mLink);
+    if (mMeasureCallbacks) {
+      mTimeBaseNanos = elapsed();
+    }
+    mPosIsNew = false;
+  }
+
+  mFrameTime += mBufferSize;
+}
+
+void SimBackend::setMIDISink(MIDISink sink) { mMIDISink = sink; }
+
+void SimBackend::setTimeJitter(double usecs, unsigned int seed) {
+  mJitterUsecs = usecs;
+  mJitterGen.seed(seed);
+}
+
+void SimBackend::setSyncTimeout(double seconds) {
+  mSyncTimeoutFrames =
+      static_cast<uint64_t>(seconds * static_cast<double>(mSampleRate));
+}
+
+void SimBackend::setMeasureCallbacks(bool measure) {
+  mMeasureCallbacks = measure;
+}
+
+const jack_default_audio_sample_t *
+SimBackend::audioBuffer(const std::string &port) const {
+  for (auto &p : mPorts) {
+    if (p->audio && p->name == port) {
+      return p->samples.data();
+    }
+  }
+  return nullptr;
+}
+
+void SimBackend::setPlaybackLatency(const std::string &port,
+                                    jack_nframes_t frames) {
+  for (auto &p : mPorts) {
+    if (p->name == port) {
+      p->playbackLatency = frames;
+    }
+  }
+  if (mLink != nullptr) {
+    JackTransportLink::latencyCallback(JackPlaybackLatency, mLink);
+  }
+}
+
+void SimBackend::setSystemPlaybackLatency(jack_nframes_t frames) {
+  mSystemPlaybackLatency = frames;
+  if (mLink != nullptr) {
+    JackTransportLink::latencyCallback(JackPlaybackLatency, mLink);
+  }
+}
+
+void SimBackend::queueMIDIInput(const std::string &port, uint64_t frame,
+                                const std::vector<jack_midi_data_t> &data) {
+  for (auto &p : mPorts) {
+    if (p->name == port) {
+      p->input.push_back({std::max(frame, mFrameTime), data});
+    }
+  }
+}
+
+void SimBackend::activate(JackTransportLink *link) { mLink = link; }
+
+void SimBackend::deactivate() { mLink = nullptr; }
+
+jack_port_t *SimBackend::portRegister(const char *name, const char *type,
+                                      unsigned long /*flags*/) {
+  auto port = std::make_unique<Port>();
+  port->name = name;
+  port->audio = std::strcmp(type, JACK_DEFAULT_AUDIO_TYPE) == 0;
+  if (port->audio) {
+    port->samples.resize(mBufferSize, 0.0f);
+  }
+  mPorts.push_back(std::move(port));
+  // jack_port_t is opaque, we hand out our own port struct instead
+  return reinterpret_cast<jack_port_t *>(mPorts.back().get());
+}
+
+void *SimBackend::portGetBuffer(jack_port_t *port, jack_nframes_t /*nframes*/) {
+  auto p = reinterpret_cast<Port *>(port);
+  if (p->audio) {
+    return p->samples.data();
+  }
+  return p;
+}
+
+jack_nframes_t SimBackend::portPlaybackLatency(jack_port_t *port) {
+  return reinterpret_cast<Port *>(port)->playbackLatency;
+}
+
+jack_nframes_t SimBackend::systemPlaybackLatency() {
+  return mSystemPlaybackLatency;
+}
+
+int SimBackend::getCycleTimes(jack_nframes_t *currentFrames,
+                              jack_time_t *currentUsecs,
+                              jack_time_t *nextUsecs, float *periodUsecs) {
+  *currentFrames = static_cast<jack_nframes_t>(mFrameTime);
+  *currentUsecs = mCycleUsecs;
+  *nextUsecs = mNextCycleUsecs;
+  *periodUsecs = static_cast<float>(1e6 * static_cast<double>(mBufferSize) /
+                                    static_cast<double>(mSampleRate));
+  return 0;
+}
+
+std::chrono::microseconds SimBackend::sampleTimeToHostTime(double sampleTime) {
+  const auto point =
+      std::make_pair(sampleTime, static_cast<double>(mCycleUsecs));
+  if (mHostTimePoints.size() < host_time_points) {
+    mHostTimePoints.push_back(point);
+  } else {
+    mHostTimePoints[mHostTimeIndex] = point;
+  }
+  mHostTimeIndex = (mHostTimeIndex + 1) % host_time_points;
+  const auto line =
+      ableton::link::linearRegression(mHostTimePoints.begin(),
+                                      mHostTimePoints.end());
+  return std::chrono::microseconds(
+      std::llround(line.first * sampleTime + line.second));
+}
+
+jack_nframes_t SimBackend::sampleRate() { return mSampleRate; }
+
+jack_nframes_t SimBackend::estimatedFrameTime() {
+  return static_cast<jack_nframes_t>(mFrameTime);
+}
+
+jack_nframes_t SimBackend::bufferSize() { return mBufferSize; }
+
+jack_transport_state_t SimBackend::transportQuery(jack_position_t *pos) {
+  if (pos != nullptr) {
+    *pos = mPos;
+  }
+  return mTransportState;
+}
+
+void SimBackend::midiClearBuffer(void * /*portBuffer*/) {}
+
+int SimBackend::midiEventWrite(void *portBuffer, jack_nframes_t time,
+                               const jack_midi_data_t *data, size_t size) {
+  if (time >= mBufferSize) {
+    return -EINVAL;
+  }
+  if (mMIDISink) {
+    // the sink isn't part of the simulated realtime path
+    RT_CHECK_SUSPEND();
+    auto p = reinterpret_cast<Port *>(portBuffer);
+    mMIDISink(p->name, mFrameTime + time, data, size);
+  }
+  return 0;
+}
+
+uint32_t SimBackend::midiEventCount(void *portBuffer) {
+  auto p = reinterpret_cast<Port *>(portBuffer);
+  return static_cast<uint32_t>(p->inputEnd - p->inputBegin);
+}
+
+int SimBackend::midiEventGet(jack_midi_event_t *event, void *portBuffer,
+                             uint32_t index) {
+  auto p = reinterpret_cast<Port *>(portBuffer);
+  if (p->inputBegin + index >= p->inputEnd) {
+    return -ENODATA;
+  }
+  auto &e = p->input[p->inputBegin + index];
+  event->time =
+      static_cast<jack_nframes_t>(e.frame + mBufferSize - mFrameTime);
+  event->size = e.data.size();
+  event->buffer = const_cast<jack_midi_data_t *>(e.data.data());
+  return 0;
+}
+
+void SimBackend::transportStart() {
+  if (mTransportState == JackTransportStopped) {
+    mTransportState = JackTransportStarting;
+    mStartingFrames = 0;
+  }
+}
+
+void SimBackend::transportStop() { mTransportState = JackTransportStopped; }
+
+int SimBackend::transportReposition(const jack_position_t *pos) {
+  mPos.frame = pos->frame;
+  mPosIsNew = true;
+  // slow sync clients get a chance to catch up
+  if (mTransportState == JackTransportRolling) {
+    mTransportState = JackTransportStarting;
+    mStartingFrames = 0;
+  }
+  return 0;
+}
+
+jack_time_t SimBackend::usecsAt(uint64_t frame) const {
+  double usecs =
+      1e6 * static_cast<double>(frame) / static_cast<double>(mSampleRate);
+  return mStartUsecs + static_cast<jack_time_t>(std::llround(usecs));
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Backend.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// A simulated JACK server: drives the JackTransportLink callbacks from a
+/// cycle loop with a synthetic clock, no server or audio hardware needed.
+///
+/// The transport mimics JACK's: start moves to Starting, the sync callback is
+/// polled until it is ready (or the sync timeout passes), then Rolling. The
+/// timebase callback fills in the position for the next cycle.
+class SimBackend : public Backend {
+public:
+  // port name, absolute frame, data
+  typedef std::function<void(const std::string &, uint64_t,
+                             const jack_midi_data_t *, size_t)>
+      MIDISink;
+
+  SimBackend(jack_nframes_t sampleRate, jack_nframes_t bufferSize);
+  ~SimBackend();
+
+  // run one process cycle
+  void cycle();
+
+  // called for every MIDI event written by the client
+  void setMIDISink(MIDISink sink);
+  // add uniformly distributed jitter, in microseconds, to the reported cycle
+  // times, like a real scheduler would
+  void setTimeJitter(double usecs, unsigned int seed = 0);
+  // how long a start waits for the sync callback before rolling anyway
+  void setSyncTimeout(double seconds);
+  // time the process and timebase callbacks of every cycle
+  void setMeasureCallbacks(bool measure);
+  // downstream latency of the named port, notifies the client like a graph
+  // change would
+  void setPlaybackLatency(const std::string &port, jack_nframes_t frames);
+  // latency of the simulated sound card's outputs, notifies the same way
+  void setSystemPlaybackLatency(jack_nframes_t frames);
+  // data arriving at the named input port at the absolute frame, the client
+  // sees it the period after, like jack. Events must be queued in order
+  void queueMIDIInput(const std::string &port, uint64_t frame,
+                      const std::vector<jack_midi_data_t> &data);
+
+  // durations of the callbacks in the last cycle, in nanoseconds, 0 if not
+  // measured or the callback wasn't called
+  int64_t lastProcessNanos() const { return mProcessNanos; }
+  int64_t lastTimeBaseNanos() const { return mTimeBaseNanos; }
+
+  // what the client wrote to the named audio port in the last cycle, nullptr
+  // if there is no such port
+  const jack_default_audio_sample_t *
+  audioBuffer(const std::string &port) const;
+
+  uint64_t frameTime() const { return mFrameTime; }
+  jack_transport_state_t transportState() const { return mTransportState; }
+  const jack_position_t &position() const { return mPos; }
+
+  void activate(JackTransportLink *link) override;
+  void deactivate() override;
+
+  jack_port_t *portRegister(const char *name, const char *type,
+                            unsigned long flags) override;
+  void *portGetBuffer(jack_port_t *port, jack_nframes_t nframes) override;
+  jack_nframes_t portPlaybackLatency(jack_port_t *port) override;
+  jack_nframes_t systemPlaybackLatency() override;
+
+  int getCycleTimes(jack_nframes_t *currentFrames, jack_time_t *currentUsecs,
+                    jack_time_t *nextUsecs, float *periodUsecs) override;
+  std::chrono::microseconds sampleTimeToHostTime(double sampleTime) override;
+  jack_nframes_t sampleRate() override;
+  jack_nframes_t estimatedFrameTime() override;
+  jack_nframes_t bufferSize() override;
+  jack_transport_state_t transportQuery(jack_position_t *pos) override;
+  void midiClearBuffer(void *portBuffer) override;
+  int midiEventWrite(void *portBuffer, jack_nframes_t time,
+                     const jack_midi_data_t *data, size_t size) override;
+  uint32_t midiEventCount(void *portBuffer) override;
+  int midiEventGet(jack_midi_event_t *event, void *portBuffer,
+                   uint32_t index) override;
+
+  void transportStart() override;
+  void transportStop() override;
+  int transportReposition(const jack_position_t *pos) override;
+
+private:
+  struct InputEvent {
+    uint64_t frame;
+    std::vector<jack_midi_data_t> data;
+  };
+
+  struct Port {
+    std::string name;
+    bool audio = false;
+    jack_nframes_t playbackLatency = 0;
+    std::vector<jack_default_audio_sample_t> samples;
+    // queued midi input and the range that falls in the current cycle
+    std::vector<InputEvent> input;
+    size_t inputBegin = 0;
+    size_t inputEnd = 0;
+  };
+
+  jack_time_t usecsAt(uint64_t frame) const;
+
+  JackTransportLink *mLink = nullptr;
+  std::vector<std::unique_ptr<Port>> mPorts;
+  jack_nframes_t mSystemPlaybackLatency = 0;
+  MIDISink mMIDISink;
+
+  jack_nframes_t mSampleRate;
+  jack_nframes_t mBufferSize;
+  uint64_t mFrameTime = 0;
+  jack_time_t mStartUsecs;
+
+  double mJitterUsecs = 0.0;
+  std::mt19937 mJitterGen;
+  jack_time_t mCycleUsecs = 0;
+  jack_time_t mNextCycleUsecs = 0;
+  // link's host time filter samples the clock when it is called, we can't
+  // give it ours so we run the same regression over the jittered cycle times
+  std::vector<std::pair<double, double>> mHostTimePoints;
+  size_t mHostTimeIndex = 0;
+
+  jack_transport_state_t mTransportState = JackTransportStopped;
+  jack_position_t mPos = {};
+  bool mPosIsNew = true;
+  uint64_t mSyncTimeoutFrames;
+  uint64_t mStartingFrames = 0;
+
+  bool mMeasureCallbacks = false;
+  int64_t mProcessNanos = 0;
+  int64_t mTimeBaseNanos = 0;
+};
@@ -0,0 +1,129 @@
+#include "TempoMap.hpp"
+
+#include <algorithm>
+
+TempoMap::TempoMap(size_t capacity)
+    : mCapacity(std::max<size_t>(capacity, 1)) {
+  mFrames.reserve(mCapacity);
+  mBeats.reserve(mCapacity);
+  mBPMs.reserve(mCapacity);
+  mMergedFrames.reserve(mCapacity);
+  mMergedBeats.reserve(mCapacity);
+  mMergedBPMs.reserve(mCapacity);
+}
+
+void TempoMap::reset(double sampleRate, double bpm) {
+  mSampleRate = sampleRate;
+  mFrames.assign(1, 0.0);
+  mBeats.assign(1, 0.0);
+  mBPMs.assign(1, bpm);
+  mMerging = false;
+}
+
+bool TempoMap::record(double frame, double bpm) {
+  frame = std::max(frame, 0.0);
+  // almost always rolling on past the last change
+  size_t i = frame >= mFrames.back() ? mFrames.size() - 1
+                                     : segment(mFrames, frame);
+  // whatever was played after frame is history, even at the same tempo
+  if (mBPMs[i] == bpm) {
+    truncate(i + 1);
+    merge(frame);
+    return true;
+  }
+  double beat = beatAt(frame);
+  size_t keep = mFrames[i] == frame ? i : i + 1;
+  if (keep > 0 && mBPMs[keep - 1] == bpm) {
+    truncate(keep);
+    merge(frame);
+    return true;
+  }
+  truncate(keep);
+  // merging keeps the last segment as it is, frame is still in it
+  merge(frame);
+  if (mFrames.size() == mCapacity) {
+    return false;
+  }
+  mFrames.push_back(frame);
+  mBeats.push_back(beat);
+  mBPMs.push_back(bpm);
+  return true;
+}
+
+void TempoMap::truncate(size_t size) {
+  mFrames.resize(size);
+  mBeats.resize(size);
+  mBPMs.resize(size);
+  // a locate back past what the merge has been through, start again later
+  if (mMerging && mScan >= size) {
+    mMerging = false;
+  }
+}
+
+void TempoMap::merge(double frame) {
+  const size_t size = mFrames.size();
+  if (!mMerging) {
+    if (mCapacity < 4 || size < mCapacity - mCapacity / 4) {
+      return;
+    }
+    // neighbours shorter than an even share of half the map merge into one,
+    // with each step adding at most one segment to the map and merging
+    // merge_step, the merge catches up long before the map is full
+    mMerging = true;
+    mMergeLength = frame / static_cast<double>(mCapacity / 2);
+    mRun = 0;
+    mScan = 1;
+    mMergedFrames.clear();
+    mMergedBeats.clear();
+    mMergedBPMs.clear();
+  }
+
+  // the last segment is still being played, it is never merged
+  for (size_t n = 0; n < merge_step && mScan + 1 < size; n++, mScan++) {
+    if (mFrames[mScan] - mFrames[mRun] >= mMergeLength) {
+      mergeRun(mScan);
+      mRun = mScan;
+    }
+  }
+  if (mScan + 1 < size) {
+    return;
+  }
+  mergeRun(size - 1);
+  mMergedFrames.push_back(mFrames.back());
+  mMergedBeats.push_back(mBeats.back());
+  mMergedBPMs.push_back(mBPMs.back());
+  mFrames.swap(mMergedFrames);
+  mBeats.swap(mMergedBeats);
+  mBPMs.swap(mMergedBPMs);
+  mMerging = false;
+}
+
+void TempoMap::mergeRun(size_t end) {
+  // rolling from the first start to the next start at the tempo that covers
+  // the same beats, so the beat at every remaining change stays exact and
+  // only the beats in between move
+  double bpm = mBPMs[mRun];
+  if (end > mRun + 1) {
+    bpm = (mBeats[end] - mBeats[mRun]) * 60.0 * mSampleRate /
+          (mFrames[end] - mFrames[mRun]);
+  }
+  mMergedFrames.push_back(mFrames[mRun]);
+  mMergedBeats.push_back(mBeats[mRun]);
+  mMergedBPMs.push_back(bpm);
+}
+
+double TempoMap::beatAt(double frame) const {
+  size_t i = segment(mFrames, frame);
+  return mBeats[i] + (frame - mFrames[i]) * mBPMs[i] / (60.0 * mSampleRate);
+}
+
+double TempoMap::frameAt(double beat) const {
+  size_t i = segment(mBeats, beat);
+  return mFrames[i] + (beat - mBeats[i]) * 60.0 * mSampleRate / mBPMs[i];
+}
+
+size_t TempoMap::segment(const std::vector<double> &starts, double at) {
+  auto it = std::upper_bound(starts.begin(), starts.end(), at);
+  return it == starts.begin() ? 0
+                              : static_cast<size_t>(it - starts.begin()) - 1;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/// Transport frames to beats and back through the tempos the transport has
+/// actually rolled at, recorded as they happen, so a seek lands where that
+/// beat was played rather than where it would be at the current tempo.
+///
+/// A segment is the frame a tempo took over at and the beat there, the sum of
+/// the beats of every segment before it. Frames, beats and tempos are kept in
+/// sorted arrays of their own so either lookup is a binary search over
+/// contiguous keys. The first segment starts at frame 0 and beat 0, and the
+/// last carries on at its tempo forever.
+///
+/// Recording a tempo at a frame inside the map, after a locate back, replaces
+/// every segment after that frame, what is played now wins over what was
+/// played before. Storage is allocated up front and record is realtime safe.
+/// Once the map is three quarters full, record starts merging neighbouring
+/// segments into ones of about the same length, spreading what detail is left
+/// evenly over the history. The merged map is built in spare arrays a few
+/// segments per call, so no call does more than a bounded amount of work,
+/// and swapped in when it has caught up. Not thread safe.
+class TempoMap {
+public:
+  // room for capacity segments, reset before anything else
+  explicit TempoMap(size_t capacity);
+
+  // forget everything, the whole transport at bpm
+  void reset(double sampleRate, double bpm);
+  // the transport rolls at bpm from frame on, returns false if that was a
+  // change and the map had no room for it
+  bool record(double frame, double bpm);
+
+  double beatAt(double frame) const;
+  double frameAt(double beat) const;
+
+  double sampleRate() const { return mSampleRate; }
+  size_t size() const { return mFrames.size(); }
+  size_t capacity() const { return mCapacity; }
+
+private:
+  // segments looked at per call to merge
+  static constexpr size_t merge_step = 16;
+
+  // keep the first size segments
+  void truncate(size_t size);
+  // start merging once the map is filling up, frame is where the transport
+  // is, then carry on with the merge for up to merge_step segments
+  void merge(double frame);
+  // add the segments from mRun up to the one at end to the merged map as one
+  void mergeRun(size_t end);
+  // the segment frame, or beat, falls in
+  static size_t segment(const std::vector<double> &starts, double at);
+
+  size_t mCapacity;
+  double mSampleRate = 0.0;
+  std::vector<double> mFrames;
+  std::vector<double> mBeats;
+  std::vector<double> mBPMs;
+
+  // the merge in progress, mRun is the first segment of the run being
+  // merged and mScan the next one to look at
+  bool mMerging = false;
+  double mMergeLength = 0.0;
+  size_t mRun = 0;
+  size_t mScan = 0;
+  std::vector<double> mMergedFrames;
+  std::vector<double> mMergedBeats;
+  std::vector<double> mMergedBPMs;
+};
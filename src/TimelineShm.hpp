@@ -0,0 +1,163 @@
+#pragma once
+
+// Header only reader for the transport timeline that jack_transport_link
+// publishes in shared memory, for processes that aren't jack clients.
+//
+//   TimelineReader reader;
+//   TimelineRecord record;
+//   if (reader.read(record)) {
+//     double beat = timelineBeatAtTime(record, TimelineReader::hostTimeNow());
+//   }
+//
+// The record is guarded by a seqlock: the writer never waits for readers and
+// a reader retries if it raced with a write, without any syscalls.
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/// The timeline at one instant, beats advance at bpm from hostTime while
+/// playing.
+struct TimelineRecord {
+  // microseconds on link's clock, CLOCK_MONOTONIC_RAW on linux
+  int64_t hostTime = 0;
+  double beat = 0.0;
+  double bpm = 0.0;
+  double quantum = 0.0;
+  uint32_t playing = 0;
+  uint32_t numPeers = 0;
+};
+
+constexpr const char *timeline_default_name = "/jack_transport_link";
+
+namespace timeline_shm {
+constexpr uint32_t magic = 0x4A544C54; // JTLT
+constexpr uint32_t version = 1;
+// 32 bit words are lock free everywhere, even in a read only mapping
+constexpr size_t record_words =
+    (sizeof(TimelineRecord) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+struct Segment {
+  std::atomic<uint32_t> magic;
+  std::atomic<uint32_t> version;
+  // odd while a write is in progress, 0 until the first one
+  std::atomic<uint32_t> sequence;
+  std::array<std::atomic<uint32_t>, record_words> words;
+};
+
+// the name shm_open wants, with a leading slash
+inline std::string name(const std::string &n) {
+  return n.empty() || n[0] != '/' ? "/" + n : n;
+}
+} // namespace timeline_shm
+
+// beat and phase at a host time, extrapolated from the record
+inline double timelineBeatAtTime(const TimelineRecord &record,
+                                 int64_t hostTime) {
+  if (!record.playing) {
+    return record.beat;
+  }
+  return record.beat + static_cast<double>(hostTime - record.hostTime) *
+                           record.bpm / 60e6;
+}
+
+inline double timelinePhaseAtTime(const TimelineRecord &record,
+                                  int64_t hostTime) {
+  double beat = timelineBeatAtTime(record, hostTime);
+  if (record.quantum <= 0.0) {
+    return 0.0;
+  }
+  return beat - std::floor(beat / record.quantum) * record.quantum;
+}
+
+class TimelineReader {
+public:
+  // a reader retries this many times while a write is in progress, a writer
+  // that died mid write would otherwise hold us forever
+  static constexpr int max_attempts = 1000;
+
+  explicit TimelineReader(const std::string &name = timeline_default_name) {
+    int fd = shm_open(timeline_shm::name(name).c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+      return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 &&
+        static_cast<size_t>(st.st_size) >= sizeof(timeline_shm::Segment)) {
+      void *mem = mmap(nullptr, sizeof(timeline_shm::Segment), PROT_READ,
+                       MAP_SHARED, fd, 0);
+      if (mem != MAP_FAILED) {
+        mSegment = static_cast<const timeline_shm::Segment *>(mem);
+      }
+    }
+    close(fd);
+  }
+
+  ~TimelineReader() {
+    if (mSegment != nullptr) {
+      munmap(const_cast<timeline_shm::Segment *>(mSegment),
+             sizeof(timeline_shm::Segment));
+    }
+  }
+
+  TimelineReader(const TimelineReader &) = delete;
+  TimelineReader &operator=(const TimelineReader &) = delete;
+
+  bool isOpen() const {
+    return mSegment != nullptr &&
+           mSegment->magic.load(std::memory_order_acquire) ==
+               timeline_shm::magic &&
+           mSegment->version.load(std::memory_order_relaxed) ==
+               timeline_shm::version;
+  }
+
+  // the latest record, false if there isn't one yet or we kept racing the
+  // writer
+  bool read(TimelineRecord &record) const {
+    if (!isOpen()) {
+      return false;
+    }
+    uint32_t words[timeline_shm::record_words];
+    for (int attempt = 0; attempt < max_attempts; attempt++) {
+      auto before = mSegment->sequence.load(std::memory_order_acquire);
+      if (before == 0) {
+        return false;
+      }
+      if (before & 1) {
+        continue;
+      }
+      for (size_t i = 0; i < timeline_shm::record_words; i++) {
+        words[i] = mSegment->words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (mSegment->sequence.load(std::memory_order_relaxed) == before) {
+        std::memcpy(&record, words, sizeof(TimelineRecord));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // now, on the clock the record's host time is on
+  static int64_t hostTimeNow() {
+    timespec ts;
+#ifdef CLOCK_MONOTONIC_RAW
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+  }
+
+private:
+  const timeline_shm::Segment *mSegment = nullptr;
+};
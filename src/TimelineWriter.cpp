@@ -0,0 +1,62 @@
+#include "TimelineWriter.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+TimelineWriter::TimelineWriter(const std::string &name)
+    : mName(timeline_shm::name(name)) {
+  // readers map it read only, world readable like the metadata properties
+  int fd = shm_open(mName.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    std::cerr << "cannot open shared memory " << mName << ": "
+              << std::strerror(errno) << std::endl;
+    return;
+  }
+  if (ftruncate(fd, sizeof(timeline_shm::Segment)) != 0) {
+    std::cerr << "cannot size shared memory " << mName << ": "
+              << std::strerror(errno) << std::endl;
+    close(fd);
+    return;
+  }
+  void *mem = mmap(nullptr, sizeof(timeline_shm::Segment),
+                   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    std::cerr << "cannot map shared memory " << mName << ": "
+              << std::strerror(errno) << std::endl;
+    return;
+  }
+  mSegment = static_cast<timeline_shm::Segment *>(mem);
+
+  // a segment left behind by an earlier run starts over
+  mSegment->sequence.store(0, std::memory_order_relaxed);
+  mSegment->version.store(timeline_shm::version, std::memory_order_relaxed);
+  mSegment->magic.store(timeline_shm::magic, std::memory_order_release);
+}
+
+TimelineWriter::~TimelineWriter() {
+  if (mSegment != nullptr) {
+    munmap(mSegment, sizeof(timeline_shm::Segment));
+    shm_unlink(mName.c_str());
+  }
+}
+
+void TimelineWriter::publish(const TimelineRecord &record) {
+  if (mSegment == nullptr) {
+    return;
+  }
+  uint32_t words[timeline_shm::record_words] = {};
+  std::memcpy(words, &record, sizeof(TimelineRecord));
+
+  auto seq = mSegment->sequence.load(std::memory_order_relaxed);
+  mSegment->sequence.store(seq + 1, std::memory_order_relaxed);
+  // the odd sequence is visible before any of the words change
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < timeline_shm::record_words; i++) {
+    mSegment->words[i].store(words[i], std::memory_order_relaxed);
+  }
+  // wrapping skips 0, which means never written
+  uint32_t next = seq + 2 == 0 ? 2 : seq + 2;
+  mSegment->sequence.store(next, std::memory_order_release);
+}
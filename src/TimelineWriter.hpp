@@ -0,0 +1,24 @@
+#pragma once
+
+#include "TimelineShm.hpp"
+
+#include <string>
+
+/// Creates the shared memory timeline and publishes records into it.
+///
+/// Construct and destroy from a control thread, publish is realtime safe and
+/// must only be called from one thread at a time.
+class TimelineWriter {
+public:
+  explicit TimelineWriter(const std::string &name = timeline_default_name);
+  ~TimelineWriter();
+  TimelineWriter(const TimelineWriter &) = delete;
+  TimelineWriter &operator=(const TimelineWriter &) = delete;
+
+  bool isOpen() const { return mSegment != nullptr; }
+  void publish(const TimelineRecord &record);
+
+private:
+  std::string mName;
+  timeline_shm::Segment *mSegment = nullptr;
+};
@@ -0,0 +1,304 @@
+#include "Journal.hpp"
+
+#include <OptionParser.h>
+
+#include <jack/transport.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Decodes the journal jack_transport_link writes with --journal, prints the
+// events one a line with wall clock times or summarizes them, filtered by
+// type, server and time.
+
+namespace {
+
+struct Entry {
+  JournalEvent event;
+  // unix time, microseconds
+  int64_t wallTime = 0;
+};
+
+bool exists(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+// appends the events in path to entries, returns false if it isn't a journal
+bool read_journal(const std::string &path, std::vector<Entry> &entries) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    std::cerr << "cannot open " << path << std::endl;
+    return false;
+  }
+  JournalHeader header;
+  if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, journal_magic, sizeof(header.magic)) != 0) {
+    std::cerr << path << " is not a journal" << std::endl;
+    return false;
+  }
+  if (header.version != journal_version ||
+      header.recordSize != sizeof(JournalEvent)) {
+    std::cerr << path << " is journal version " << header.version
+              << ", this reads version " << journal_version << std::endl;
+    return false;
+  }
+  Entry entry;
+  // a record cut short by a crash is left off
+  while (in.read(reinterpret_cast<char *>(&entry.event), sizeof(entry.event))) {
+    entry.wallTime =
+        header.wallTime + (entry.event.hostTime - header.hostTime);
+    entries.push_back(entry);
+  }
+  return true;
+}
+
+std::string format_time(int64_t wallTime) {
+  auto seconds = static_cast<time_t>(wallTime / 1000000);
+  tm local;
+  localtime_r(&seconds, &local);
+  char buf[64];
+  size_t n = std::strftime(buf, sizeof(buf), "%F %T", &local);
+  std::snprintf(buf + n, sizeof(buf) - n, ".%06lld",
+                static_cast<long long>(wallTime % 1000000));
+  return buf;
+}
+
+const char *transport_state_name(double state) {
+  switch (static_cast<int>(state)) {
+  case JackTransportStopped:
+    return "stopped";
+  case JackTransportRolling:
+    return "rolling";
+  case JackTransportLooping:
+    return "looping";
+  case JackTransportStarting:
+    return "starting";
+  default:
+    return "unknown";
+  }
+}
+
+std::string describe(const JournalEvent &e) {
+  std::ostringstream out;
+  switch (e.type) {
+  case JournalEvent::Type::TransportState:
+    out << transport_state_name(e.a) << " at frame "
+        << static_cast<uint64_t>(e.b);
+    break;
+  case JournalEvent::Type::Reposition:
+    out << "to frame " << static_cast<uint64_t>(e.a) << " beat " << e.b;
+    break;
+  case JournalEvent::Type::Tempo:
+    out << e.a << " bpm from " << e.b;
+    break;
+  case JournalEvent::Type::LinkPeers:
+    out << e.a << " peers";
+    break;
+  case JournalEvent::Type::MIDIStart:
+  case JournalEvent::Type::MIDIStop:
+  case JournalEvent::Type::MIDIResync:
+    out << "port " << e.a;
+    break;
+  case JournalEvent::Type::MIDIContinue:
+    out << "port " << e.a << " beat " << e.b;
+    break;
+  case JournalEvent::Type::MIDIInStart:
+  case JournalEvent::Type::MIDIInContinue:
+  case JournalEvent::Type::MIDIInLocate:
+    out << "beat " << e.a;
+    break;
+  case JournalEvent::Type::Xrun:
+    out << e.a << " so far";
+    break;
+  case JournalEvent::Type::Dropped:
+    out << e.a << " events lost";
+    break;
+  case JournalEvent::Type::MIDIInStop:
+  case JournalEvent::Type::ServerUp:
+  case JournalEvent::Type::ServerDown:
+    break;
+  }
+  return out.str();
+}
+
+void print_entry(const Entry &entry) {
+  const auto &e = entry.event;
+  auto name = journalEventName(e.type);
+  std::cout << format_time(entry.wallTime) << " frame " << e.frameTime
+            << " server " << e.source << " "
+            << (name != nullptr ? name : "unknown") << " " << describe(e)
+            << std::endl;
+}
+
+struct TypeSummary {
+  uint64_t count = 0;
+  int64_t first = 0;
+  int64_t last = 0;
+  double min = 0.0;
+  double max = 0.0;
+};
+
+void print_summary(const std::vector<Entry> &entries) {
+  if (entries.empty()) {
+    std::cout << "no events" << std::endl;
+    return;
+  }
+  std::map<JournalEvent::Type, TypeSummary> types;
+  for (auto &entry : entries) {
+    auto &s = types[entry.event.type];
+    if (s.count == 0) {
+      s.first = entry.wallTime;
+      s.min = s.max = entry.event.a;
+    }
+    s.count++;
+    s.last = entry.wallTime;
+    s.min = std::min(s.min, entry.event.a);
+    s.max = std::max(s.max, entry.event.a);
+  }
+  auto span = static_cast<double>(entries.back().wallTime -
+                                  entries.front().wallTime) /
+              1e6;
+  std::cout << entries.size() << " events from "
+            << format_time(entries.front().wallTime) << " to "
+            << format_time(entries.back().wallTime) << ", " << span
+            << " seconds" << std::endl;
+  for (auto &[type, s] : types) {
+    auto name = journalEventName(type);
+    char line[128];
+    std::snprintf(line, sizeof(line), "%-16s %8llu", name ? name : "unknown",
+                  static_cast<unsigned long long>(s.count));
+    std::cout << line << "  first " << format_time(s.first) << "  last "
+              << format_time(s.last);
+    if (type == JournalEvent::Type::Tempo) {
+      std::cout << "  " << s.min << " to " << s.max << " bpm";
+    } else if (type == JournalEvent::Type::LinkPeers) {
+      std::cout << "  " << s.min << " to " << s.max << " peers";
+    } else if (type == JournalEvent::Type::Dropped) {
+      double lost = 0.0;
+      for (auto &entry : entries) {
+        if (entry.event.type == type) {
+          lost += entry.event.a;
+        }
+      }
+      std::cout << "  " << lost << " events lost";
+    }
+    std::cout << std::endl;
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  auto parser =
+      optparse::OptionParser()
+          .usage("%prog [options] journal...")
+          .description("Decode, filter and summarize a jack transport link "
+                       "journal");
+  parser.set_defaults("all", "0");
+  parser.set_defaults("summary", "0");
+  parser.add_option("-a", "--all")
+      .help("read the rotated files, journal.N down to journal.1, before "
+            "each journal")
+      .action("store_true")
+      .dest("all");
+  parser.add_option("-t", "--type")
+      .type("string")
+      .help("only events of this type, comma separated or given more than "
+            "once: transport, reposition, tempo, peers, midi-start, "
+            "midi-stop, midi-continue, midi-resync, midi-in-start, "
+            "midi-in-continue, midi-in-stop, midi-in-locate, xrun, "
+            "server-up, server-down, dropped")
+      .action("append")
+      .dest("types");
+  parser.add_option("-s", "--server")
+      .type("int")
+      .help("only events from this jack server, counted from 0 in the order "
+            "they were given")
+      .action("store")
+      .dest("server")
+      .set_default("-1");
+  parser.add_option("-l", "--last")
+      .type("double")
+      .help("only the events in this many seconds up to the last one")
+      .action("store")
+      .dest("last")
+      .set_default("0");
+  parser.add_option("--summary")
+      .help("count the events of each type rather than printing them")
+      .action("store_true")
+      .dest("summary");
+
+  optparse::Values options = parser.parse_args(argc, argv);
+  std::vector<std::string> paths = parser.args();
+  if (paths.empty()) {
+    parser.print_usage(std::cerr);
+    return 1;
+  }
+
+  std::vector<JournalEvent::Type> types;
+  for (const auto &arg : options.all("types")) {
+    std::istringstream names(arg);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+      JournalEvent::Type type;
+      if (!parseJournalEventType(name, type)) {
+        std::cerr << "unknown event type: " << name << std::endl;
+        return 1;
+      }
+      types.push_back(type);
+    }
+  }
+  int server = options.get("server");
+  double last = options.get("last");
+
+  std::vector<Entry> entries;
+  for (const auto &path : paths) {
+    std::vector<std::string> files;
+    if ((bool)options.get("all")) {
+      for (int i = 1; exists(path + "." + std::to_string(i)); i++) {
+        files.insert(files.begin(), path + "." + std::to_string(i));
+      }
+    }
+    files.push_back(path);
+    for (const auto &file : files) {
+      if (!read_journal(file, entries)) {
+        return 1;
+      }
+    }
+  }
+
+  int64_t from = 0;
+  if (last > 0.0 && !entries.empty()) {
+    from = entries.back().wallTime - static_cast<int64_t>(last * 1e6);
+  }
+  entries.erase(
+      std::remove_if(entries.begin(), entries.end(),
+                     [&](const Entry &entry) {
+                       return entry.wallTime < from ||
+                              (server >= 0 && entry.event.source != server) ||
+                              (!types.empty() &&
+                               std::find(types.begin(), types.end(),
+                                         entry.event.type) == types.end());
+                     }),
+      entries.end());
+
+  if ((bool)options.get("summary")) {
+    print_summary(entries);
+  } else {
+    for (auto &entry : entries) {
+      print_entry(entry);
+    }
+  }
+  return 0;
+}
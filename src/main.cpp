@@ -1,35 +1,127 @@
+#include "EventLoop.hpp"
+#include "JackBackend.hpp"
 #include "JackTransportLink.hpp"
+#include "Journal.hpp"
+#include "LinkSession.hpp"
+#include "OfflineRender.hpp"
+#include "OscPublisher.hpp"
+#include "OscSockets.hpp"
+#include "RTStats.hpp"
+#include "TimelineWriter.hpp"
 
 #include <OptionParser.h>
 #include <chrono>
 #include <csignal>
-#include <thread>
 
-#include <ip/UdpSocket.h>
-#include <osc/OscPacketListener.h>
-#include <osc/OscReceivedElements.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
 
-// TODO windows?
-std::atomic<bool> run = true;
-void signal_handler(int signal) { run.store(false); }
+// a jack server we bridge to link, reconnected to whenever it goes away
+struct Server {
+  // empty for the default server
+  std::string name;
+  // in the order the servers were given, for the journal
+  uint16_t index = 0;
+  // cleared by the shutdown handler when the server goes away
+  std::atomic<bool> running = false;
+  EventNotifier *events = nullptr;
+  std::unique_ptr<JackTransportLink> bridge;
+  std::chrono::steady_clock::time_point retry;
+  // quick retries after the server's socket appeared, zero when waiting for
+  // the socket or polling
+  std::chrono::steady_clock::duration backoff{};
+  // when we saw the server come up, to time its first cycle from
+  std::optional<std::chrono::steady_clock::time_point> appeared;
+};
 
-// the current session (server instance)
-std::atomic<bool> runSession = true;
-void shutdown_handler(void *) {
-  std::cout << "shutdown" << std::endl;
-  runSession.store(false);
+void shutdown_handler(void *arg) {
+  auto server = reinterpret_cast<Server *>(arg);
+  std::cout << "shutdown";
+  if (!server->name.empty()) {
+    std::cout << " " << server->name;
+  }
+  std::cout << std::endl;
+  server->running.store(false);
+  server->events->notify();
 }
 
-int main(int argc, char *argv[]) {
-  // the period with which we check for the program exit condition
-  const auto runPollPeriod = std::chrono::milliseconds(10);
+namespace {
+#ifdef __linux__
+const char *default_socket_dir = "/dev/shm";
+#else
+const char *default_socket_dir = "/tmp";
+#endif
+// a server may create its socket a little before it accepts clients, the
+// first retry after it appears and the most the retries back off to
+const auto socket_retry_first = std::chrono::milliseconds(5);
+const auto socket_retry_max = std::chrono::milliseconds(1000);
+
+void print_host_time_error(const JackTransportLink::RTSnapshot &snapshot) {
+  std::cout << "cycle time error usecs raw rms: " << snapshot.rawTimeErrorRms
+            << " max: " << snapshot.rawTimeErrorMax
+            << " filtered rms: " << snapshot.filteredTimeErrorRms
+            << " max: " << snapshot.filteredTimeErrorMax << std::endl;
+}
+
+// replace path as a whole so a reader never sees half a file
+void write_stats_file(const std::string &path, const JackTransportLink &j) {
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp);
+    if (!out) {
+      std::cerr << "cannot write stats to " << tmp << std::endl;
+      return;
+    }
+    writeStats(out, j.rtStats(), j.notificationStats());
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::cerr << "cannot write stats to " << path << std::endl;
+  }
+}
 
+// something to do every period from the event loop
+class Periodic {
+public:
+  Periodic(std::chrono::steady_clock::duration period,
+           std::function<void()> func)
+      : mPeriod(period), mNext(std::chrono::steady_clock::now() + period),
+        mFunc(std::move(func)) {}
+
+  // run if it is due, returns the milliseconds until it is next
+  int poll() {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= mNext) {
+      mFunc();
+      mNext = now + mPeriod;
+    }
+    auto wait =
+        std::chrono::duration_cast<std::chrono::milliseconds>(mNext - now);
+    return static_cast<int>(wait.count()) + 1;
+  }
+
+private:
+  std::chrono::steady_clock::duration mPeriod;
+  std::chrono::steady_clock::time_point mNext;
+  std::function<void()> mFunc;
+};
+} // namespace
+
+int main(int argc, char *argv[]) {
   // setup options
   auto parser = optparse::OptionParser().description("Jack Transport Link");
   parser.set_defaults("start_stop_sync", "1");
   parser.set_defaults("start_server", "0");
+  parser.set_defaults("render", "0");
+  parser.set_defaults("follow_clock", "0");
+  parser.set_defaults("raw_host_time", "0");
+  parser.set_defaults("report_host_time", "0");
 
   parser.add_option("-s", "--start-stop-sync")
       .help("synchronize starts and stops with other start/stop enabled link "
@@ -54,11 +146,20 @@ int main(int argc, char *argv[]) {
 
   parser.add_option("-p", "--server-poll-period")
       .type("int")
-      .help("the period, in seconds, between attempts to create a jack client, "
+      .help("the period, in seconds, between attempts to create a jack "
+            "client when the jack socket directory can't be watched, "
             "default: %default")
       .action("store")
       .dest("poll_seconds")
       .set_default("2");
+  parser.add_option("--jack-socket-dir")
+      .type("string")
+      .help("the directory jack servers create their sockets in, watched to "
+            "connect as soon as a server comes up, empty to poll instead, "
+            "default: %default")
+      .action("store")
+      .dest("socket_dir")
+      .set_default(default_socket_dir);
   parser.add_option("-b", "--initial-bpm")
       .type("double")
       .help("the initial BPM to set the transport to, if it isn't already set, "
@@ -93,21 +194,216 @@ int main(int argc, char *argv[]) {
       .action("store")
       .dest("name")
       .set_default("jack-transport-link");
+  parser.add_option("--server")
+      .type("string")
+      .help("the name of a jack server to bridge, may be given more than once "
+            "to bridge several servers to one link session, default: the "
+            "default server")
+      .action("append")
+      .dest("servers");
   parser.add_option("-o", "--osc-port")
       .type("int")
-      .help("the name to give to the jack client, default: %default")
+      .help("receive osc over udp on this port, replies and subscriptions "
+            "are sent from it, default: %default")
       .action("store")
       .dest("oscport")
       .set_default("-1");
+  parser.add_option("--osc-unix-socket")
+      .type("string")
+      .help("receive osc on a unix domain datagram socket at this path, for "
+            "controllers on the same machine")
+      .action("store")
+      .dest("osc_unix_socket")
+      .set_default("");
+  parser.add_option("--osc-tcp-port")
+      .type("int")
+      .help("receive osc over tcp on this port, each packet slip framed as "
+            "osc 1.1 specifies")
+      .action("store")
+      .dest("osc_tcp_port")
+      .set_default("-1");
+  parser.add_option("-m", "--midi-clock-port")
+      .type("string")
+      .help("add a midi clock output port, name[:trim], the trim in "
+            "milliseconds is added to the port's playback latency, may be "
+            "given more than once, default: clock")
+      .action("append")
+      .dest("clock_ports");
+  parser.add_option("--mtc")
+      .type("string")
+      .help("send midi time code at this frame rate on an mtc port, 24, 25, "
+            "29.97 (drop frame) or 30")
+      .action("store")
+      .dest("mtc")
+      .set_default("");
+  parser.add_option("--click")
+      .help("play a metronome on a click audio port, alongside the midi clock")
+      .action("store_true")
+      .dest("click");
+  parser.add_option("--click-subdivision")
+      .type("int")
+      .help("clicks per beat, default: %default")
+      .action("store")
+      .dest("click_subdivision")
+      .set_default("1");
+  parser.add_option("--phase-cv")
+      .help("output beat and bar phase ramps, gates and triggers on audio "
+            "ports")
+      .action("store_true")
+      .dest("phase_cv");
+  parser.add_option("--phase-cv-division")
+      .type("int")
+      .help("gates and triggers per beat, default: %default")
+      .action("store")
+      .dest("phase_cv_division")
+      .set_default("1");
+  parser.add_option("--follow-midi-clock")
+      .help("take tempo, start, stop and position from the midi clock on a "
+            "clock_in port")
+      .action("store_true")
+      .dest("follow_clock");
+  parser.add_option("--raw-host-time")
+      .help("give link jack's cycle times instead of filtering the frame "
+            "count onto link's clock")
+      .action("store_true")
+      .dest("raw_host_time");
+  parser.add_option("--report-host-time")
+      .help("print the raw and filtered cycle time error once a second")
+      .action("store_true")
+      .dest("report_host_time");
+  parser.add_option("--max-start-hold")
+      .type("double")
+      .help("longest, in seconds, a transport start is held for the next "
+            "quantum boundary of the link session, 0 to start right away, "
+            "default: %default")
+      .action("store")
+      .dest("max_start_hold")
+      .set_default("2.0");
+  parser.add_option("--output-latency-offset")
+      .type("double")
+      .help("milliseconds added to the playback latency of the system "
+            "outputs, which link's timeline is moved later by so peers hear "
+            "the beat when our speakers play it, negative if jack "
+            "overstates it, default: %default")
+      .action("store")
+      .dest("output_latency_offset")
+      .set_default("0");
+  parser.add_option("--stats-file")
+      .type("string")
+      .help("write callback timing, xrun, resync and phase error statistics "
+            "to this file every stats interval")
+      .action("store")
+      .dest("stats_file")
+      .set_default("");
+  parser.add_option("--stats-interval")
+      .type("double")
+      .help("seconds between writing the stats file and sending the stats to "
+            "osc subscribers, default: %default")
+      .action("store")
+      .dest("stats_interval")
+      .set_default("10.0");
+  parser.add_option("--journal")
+      .type("string")
+      .help("record transport, tempo, link peer, midi clock and xrun events "
+            "to this file, read it with jack_transport_link_journal")
+      .action("store")
+      .dest("journal")
+      .set_default("");
+  parser.add_option("--journal-size")
+      .type("double")
+      .help("megabytes a journal file grows to before it is rotated, "
+            "default: %default")
+      .action("store")
+      .dest("journal_size")
+      .set_default("16");
+  parser.add_option("--journal-files")
+      .type("int")
+      .help("journal files to keep, the one being written included, "
+            "default: %default")
+      .action("store")
+      .dest("journal_files")
+      .set_default("4");
+  parser.add_option("--timeline-shm")
+      .type("string")
+      .help("publish the timeline every cycle to the posix shared memory "
+            "segment with this name, for readers using TimelineShm.hpp")
+      .action("store")
+      .dest("timeline_shm")
+      .set_default("");
+
+  parser.add_option("--render")
+      .help("render offline with a simulated jack server instead of "
+            "connecting to one, prints midi clock statistics")
+      .action("store_true")
+      .dest("render");
+  parser.add_option("--render-output")
+      .type("string")
+      .help("file to write rendered midi events to, .mid for a standard midi "
+            "file, otherwise csv")
+      .action("store")
+      .dest("render_output")
+      .set_default("");
+  parser.add_option("--render-sample-rate")
+      .type("int")
+      .help("the simulated sample rate, default: %default")
+      .action("store")
+      .dest("render_sr")
+      .set_default("48000");
+  parser.add_option("--render-buffer-size")
+      .type("int")
+      .help("the simulated period size, in frames, default: %default")
+      .action("store")
+      .dest("render_nframes")
+      .set_default("256");
+  parser.add_option("--render-seconds")
+      .type("double")
+      .help("how many seconds to render, default: %default")
+      .action("store")
+      .dest("render_seconds")
+      .set_default("60.0");
+  parser.add_option("--render-bpm-script")
+      .type("string")
+      .help("tempo changes to apply while rendering, a comma separated list "
+            "of seconds:bpm pairs, eg: 10:120,20.5:95")
+      .action("store")
+      .dest("render_bpm_script")
+      .set_default("");
+  parser.add_option("--render-time-jitter")
+      .type("double")
+      .help("jitter, in microseconds, to add to the simulated cycle times, "
+            "default: %default")
+      .action("store")
+      .dest("render_jitter")
+      .set_default("0.0");
+  parser.add_option("--render-clock-input")
+      .type("string")
+      .help("follow the midi clock in a csv written by --render-output "
+            "instead of starting the transport")
+      .action("store")
+      .dest("render_clock_input")
+      .set_default("");
+  parser.add_option("--render-clock-input-jitter")
+      .type("double")
+      .help("jitter, in microseconds, to add to the arrival of the input "
+            "clock, default: %default")
+      .action("store")
+      .dest("render_clock_jitter")
+      .set_default("0.0");
+  parser.add_option("--render-click-output")
+      .type("string")
+      .help("write the click, see --click, to this wav file")
+      .action("store")
+      .dest("render_click_output")
+      .set_default("");
+  parser.add_option("--render-free-run")
+      .help("render from the internal timeline instead of syncing to link")
+      .action("store_true")
+      .dest("render_free_run");
 
   // process args
   optparse::Values options = parser.parse_args(argc, argv);
   std::vector<std::string> args = parser.args();
 
-  // setup signal handlers
-  std::signal(SIGINT, signal_handler);
-  std::signal(SIGTERM, signal_handler);
-
   // setup initial conditions and read in options
   jack_options_t jackOptions = (bool)options.get("start_server")
                                    ? JackOptions::JackNullOption
@@ -120,62 +416,400 @@ int main(int argc, char *argv[]) {
   double initialQuantum = options.get("quantum");
   float initialTimeSigDenom = options.get("denom");
   double initialTicksPerBeat = options.get("ticks");
+  std::string socketDir = options["socket_dir"];
   std::string name = options["name"];
   int oscport = options.get("oscport");
+  std::string oscUnixPath = options["osc_unix_socket"];
+  int oscTCPPort = options.get("osc_tcp_port");
+  std::vector<std::string> serverNames;
+  for (const auto &arg : options.all("servers")) {
+    serverNames.push_back(arg);
+  }
+  if (serverNames.empty()) {
+    serverNames.push_back("");
+  }
+  if (serverNames.size() > LinkSession::max_bridges) {
+    std::cerr << "at most " << LinkSession::max_bridges
+              << " jack servers can be bridged" << std::endl;
+    return -1;
+  }
+
+  std::vector<JackTransportLink::MIDIClockPort> clockPorts;
+  for (const auto &arg : options.all("clock_ports")) {
+    JackTransportLink::MIDIClockPort port;
+    auto colon = arg.rfind(':');
+    port.name = arg.substr(0, colon);
+    if (colon != std::string::npos) {
+      char *end = nullptr;
+      port.trimMs = std::strtod(arg.c_str() + colon + 1, &end);
+      if (*end != 0) {
+        std::cerr << "invalid midi clock port trim: " << arg << std::endl;
+        return -1;
+      }
+    }
+    clockPorts.push_back(port);
+  }
+  if (clockPorts.empty()) {
+    clockPorts.push_back({"clock", 0.0});
+  }
+
+  bool followClock = options.get("follow_clock");
+  bool rawHostTime = options.get("raw_host_time");
+  bool reportHostTime = options.get("report_host_time");
+  double maxStartHold = options.get("max_start_hold");
+  double outputLatencyOffset = options.get("output_latency_offset");
+  int clickSubdivision = options.get("click_subdivision");
+  int phaseCVDivision = options.get("phase_cv_division");
+  std::string statsPath = options["stats_file"];
+  double statsInterval = options.get("stats_interval");
+  std::string timelineName = options["timeline_shm"];
+  std::string journalPath = options["journal"];
+  double journalSize = options.get("journal_size");
+  int journalFiles = options.get("journal_files");
+
+  std::optional<MTCRate> mtcRate;
+  if (!options["mtc"].empty()) {
+    MTCRate rate;
+    if (!parseMTCRate(options["mtc"], rate)) {
+      std::cerr << "invalid mtc frame rate: " << options["mtc"] << std::endl;
+      return -1;
+    }
+    mtcRate = rate;
+  }
 
   if (initialBPM <= 0.0 || initialQuantum < 1.0 || initialTimeSigDenom < 1.0 ||
-      initialTicksPerBeat < 1.0) {
+      initialTicksPerBeat < 1.0 || statsInterval <= 0.0 ||
+      maxStartHold < 0.0 || clickSubdivision < 1 || phaseCVDivision < 1 ||
+      journalSize <= 0.0 || journalFiles < 1) {
     std::cerr << "one or more numeric options are out of range" << std::endl;
     return -1;
   }
 
-  std::unique_ptr<oscpack::UdpListeningReceiveSocket> oscsocket;
-  while (run.load()) {
+  if ((bool)options.get("render")) {
+    RenderSettings settings;
+    int sr = options.get("render_sr");
+    int nframes = options.get("render_nframes");
+    settings.seconds = options.get("render_seconds");
+    settings.timeJitterUsecs = options.get("render_jitter");
+    settings.bpmScript = options["render_bpm_script"];
+    settings.outputPath = options["render_output"];
+    settings.clockInputPath = options["render_clock_input"];
+    settings.clockInputJitterUsecs = options.get("render_clock_jitter");
+    settings.rawHostTime = rawHostTime;
+    settings.syncLink = !options.get("render_free_run");
+    settings.maxStartHoldSeconds = maxStartHold;
+    settings.clickSubdivision = options.get("click") ? clickSubdivision : 0;
+    settings.clickOutputPath = options["render_click_output"];
+    settings.enableStartStopSync = enableStartStopSync;
+    settings.initialBPM = initialBPM;
+    settings.initialQuantum = initialQuantum;
+    settings.initialTimeSigDenom = initialTimeSigDenom;
+    settings.initialTicksPerBeat = initialTicksPerBeat;
+    if (sr <= 0 || nframes <= 0 || settings.seconds <= 0.0 ||
+        settings.clockInputJitterUsecs < 0.0) {
+      std::cerr << "one or more render options are out of range" << std::endl;
+      return -1;
+    }
+    settings.sampleRate = static_cast<jack_nframes_t>(sr);
+    settings.bufferSize = static_cast<jack_nframes_t>(nframes);
+    return offlineRender(settings);
+  }
+
+  // everything outside the realtime thread is driven from this loop, block
+  // the signals before jack or link start any threads
+  bool run = true;
+  SignalWatcher signals({SIGINT, SIGTERM});
+  EventNotifier sessionEvents;
+  EventLoop loop;
+  loop.add(signals.fd(), [&]() {
+    if (signals.read() != 0) {
+      run = false;
+    }
+  });
+  loop.add(sessionEvents.fd(), [&]() { sessionEvents.drain(); });
+
+  // outlives every session so readers keep their mapping across jack restarts
+  std::unique_ptr<TimelineWriter> timeline;
+  if (!timelineName.empty()) {
+    timeline = std::make_unique<TimelineWriter>(timelineName);
+    if (!timeline->isOpen()) {
+      return -1;
+    }
+  }
+
+  // like the timeline, one journal for every server and session
+  std::unique_ptr<Journal> journal;
+  if (!journalPath.empty()) {
+    journal = std::make_unique<Journal>(
+        journalPath, static_cast<size_t>(journalSize * 1024.0 * 1024.0),
+        static_cast<size_t>(journalFiles));
+    if (!journal->isOpen()) {
+      return -1;
+    }
+  }
+  auto journalServer = [&](const Server &server, JournalEvent::Type type) {
+    if (journal) {
+      JournalEvent e;
+      e.hostTime = Journal::now();
+      e.type = type;
+      e.source = server.index;
+      journal->record(e);
+    }
+  };
+
+  JackTransportLink::Settings bridgeSettings;
+  bridgeSettings.enableStartStopSync = enableStartStopSync;
+  bridgeSettings.initialBPM = initialBPM;
+  bridgeSettings.initialQuantum = initialQuantum;
+  bridgeSettings.initialTimeSigDenom = initialTimeSigDenom;
+  bridgeSettings.initialTicksPerBeat = initialTicksPerBeat;
+  bridgeSettings.clockPorts = clockPorts;
+  bridgeSettings.mtcRate = mtcRate;
+  bridgeSettings.followMIDIClock = followClock;
+  bridgeSettings.rawHostTime = rawHostTime;
+  bridgeSettings.maxStartHoldSeconds = maxStartHold;
+  if (options.get("click")) {
+    bridgeSettings.clickSubdivision = clickSubdivision;
+  }
+  if (options.get("phase_cv")) {
+    bridgeSettings.phaseCVDivision = phaseCVDivision;
+  }
+
+  // one link peer however many servers we bridge. The session outlives the
+  // clients so the other peers never see us leave when a server restarts, and
+  // tempo and phase carry on
+  auto link = std::make_shared<LinkSession>(initialBPM, enableStartStopSync,
+                                            true);
+  std::vector<std::unique_ptr<Server>> servers;
+  for (const auto &serverName : serverNames) {
+    auto server = std::make_unique<Server>();
+    server->name = serverName;
+    server->index = static_cast<uint16_t>(servers.size());
+    server->events = &sessionEvents;
+    servers.push_back(std::move(server));
+  }
+
+  auto connect = [&](Server &server) {
     jack_status_t status;
-    auto client = jack_client_open(name.c_str(), jackOptions, &status);
-    if (client != nullptr) {
-      runSession.store(true);
-      jack_on_shutdown(client, shutdown_handler, nullptr);
-      JackTransportLink j(client, enableStartStopSync, initialBPM,
-                          initialQuantum, initialTimeSigDenom,
-                          initialTicksPerBeat);
-
-      if (oscport > 0) {
-        try {
-          oscpack::IpEndpointName oscendpoint(
-              oscpack::IpEndpointName::ANY_ADDRESS, oscport);
-          oscsocket = std::make_unique<oscpack::UdpListeningReceiveSocket>(
-              oscendpoint, &j);
-        } catch (std::runtime_error &e) {
-          std::cerr << "error creating osc socket " << e.what() << std::endl;
+    jack_client_t *client =
+        server.name.empty()
+            ? jack_client_open(name.c_str(), jackOptions, &status)
+            : jack_client_open(
+                  name.c_str(),
+                  static_cast<jack_options_t>(jackOptions |
+                                              JackOptions::JackServerName),
+                  &status, server.name.c_str());
+    if (client == nullptr) {
+      return false;
+    }
+    if (!server.appeared) {
+      server.appeared = std::chrono::steady_clock::now();
+    }
+    server.running.store(true);
+    jack_on_shutdown(client, shutdown_handler, &server);
+    server.bridge = std::make_unique<JackTransportLink>(
+        std::make_unique<JackBackend>(client), bridgeSettings, link);
+    auto j = server.bridge.get();
+    journalServer(server, JournalEvent::Type::ServerUp);
+    j->setJournal(journal.get(), server.index);
+    j->setOutputLatencyOffset(outputLatencyOffset);
+    loop.add(j->eventFD(), [j, &server]() {
+      j->processEvents();
+      auto first = j->firstProcessTime();
+      if (first && server.appeared) {
+        auto ms = std::chrono::duration<double, std::milli>(*first -
+                                                            *server.appeared);
+        std::cout << "first cycle";
+        if (!server.name.empty()) {
+          std::cout << " " << server.name;
         }
+        std::cout << " " << ms.count() << " ms after the server came up"
+                  << std::endl;
+        server.appeared.reset();
       }
+    });
+    return true;
+  };
 
-      // run osc in a thread
-      std::thread oscthread;
-      if (oscsocket) {
-        oscthread = std::thread([&oscsocket]() { oscsocket->Run(); });
+  // connect the moment a server's socket appears rather than on the next
+  // poll, and don't wake up at all while there is no server
+  std::unique_ptr<DirectoryWatcher> socketWatcher;
+  if (!socketDir.empty()) {
+    socketWatcher = std::make_unique<DirectoryWatcher>(socketDir, "jack");
+    if (socketWatcher->fd() < 0) {
+      std::cerr << "polling for jack servers every "
+                << (long)options.get("poll_seconds") << " seconds"
+                << std::endl;
+      socketWatcher.reset();
+    }
+  }
+  if (socketWatcher) {
+    loop.add(socketWatcher->fd(), [&]() {
+      if (!socketWatcher->read()) {
+        return;
       }
+      auto now = std::chrono::steady_clock::now();
+      for (auto &server : servers) {
+        if (server->bridge) {
+          continue;
+        }
+        server->retry = now;
+        server->backoff = socket_retry_first;
+        if (!server->appeared) {
+          server->appeared = now;
+        }
+      }
+    });
+  }
 
-      while (run.load() && runSession.load()) {
-        std::this_thread::sleep_for(runPollPeriod);
-        j.processEvents();
+  // osc, the statistics and the shared memory timeline follow one server, the
+  // first to connect, until it goes away. The timeline has a single writer so
+  // it only moves on once that server's realtime thread has stopped.
+  Server *front = nullptr;
+  int oscfd = -1;
+  std::unique_ptr<OscPublisher> publisher;
+  std::unique_ptr<OscUnixSocket> oscUnix;
+  std::unique_ptr<OscStreamServer> oscStream;
+  std::vector<Periodic> periodic;
+  auto attachFront = [&](Server &server) {
+    front = &server;
+    auto j = server.bridge.get();
+    j->setTimelineWriter(timeline.get());
+
+    oscfd = oscport > 0 ? openOscUdpSocket(oscport) : -1;
+    if (oscfd >= 0) {
+      publisher = std::make_unique<OscPublisher>(*j, oscfd);
+      j->setOscPublisher(publisher.get());
+      loop.add(oscfd, [j, fd = oscfd]() { readOscDatagrams(fd, *j); });
+      loop.add(publisher->fd(),
+               [p = publisher.get()]() { p->processLookups(); });
+    }
+    if (!oscUnixPath.empty()) {
+      oscUnix = std::make_unique<OscUnixSocket>(oscUnixPath);
+      if (oscUnix->fd() >= 0) {
+        loop.add(oscUnix->fd(),
+                 [j, fd = oscUnix->fd()]() { readOscDatagrams(fd, *j); });
       }
+    }
+    if (oscTCPPort > 0) {
+      oscStream = std::make_unique<OscStreamServer>(loop, *j, oscTCPPort);
+    }
+
+    if (reportHostTime) {
+      periodic.emplace_back(std::chrono::seconds(1),
+                            [j]() { print_host_time_error(j->snapshot()); });
+    }
+    if (!statsPath.empty() || publisher) {
+      periodic.emplace_back(
+          std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(statsInterval)),
+          [&, j]() {
+            if (!statsPath.empty()) {
+              write_stats_file(statsPath, *j);
+            }
+            if (publisher) {
+              publisher->publishStats();
+            }
+          });
+    }
+  };
+  auto detachFront = [&]() {
+    periodic.clear();
+    oscStream.reset();
+    if (oscUnix) {
+      loop.remove(oscUnix->fd());
+      oscUnix.reset();
+    }
+    if (oscfd >= 0) {
+      loop.remove(oscfd);
+      loop.remove(publisher->fd());
+      front->bridge->setOscPublisher(nullptr);
+      publisher.reset();
+      close(oscfd);
+      oscfd = -1;
+    }
+    front->bridge->setTimelineWriter(nullptr);
+    front = nullptr;
+  };
 
-      // cleanup osc
-      if (oscthread.joinable() && oscsocket) {
-        oscsocket->AsynchronousBreak();
-        oscthread.join();
+  while (run) {
+    using std::chrono::steady_clock;
+    auto now = steady_clock::now();
+    // wake up in time for the next reconnect, osc subscriber update or
+    // periodic task
+    int timeout = -1;
+    for (auto &server : servers) {
+      if (server->bridge && !server->running.load()) {
+        if (front == server.get()) {
+          detachFront();
+        }
+        loop.remove(server->bridge->eventFD());
+        server->bridge.reset();
+        journalServer(*server, JournalEvent::Type::ServerDown);
+        server->retry = now;
+        server->backoff = {};
+        server->appeared.reset();
+      }
+      if (!server->bridge && now >= server->retry && !connect(*server)) {
+        if (!socketWatcher) {
+          server->retry = now + serverPollPeriod;
+        } else if (server->backoff.count() > 0) {
+          server->retry = now + server->backoff;
+          server->backoff *= 2;
+          if (server->backoff > socket_retry_max) {
+            server->backoff = {};
+          }
+        } else {
+          // until a socket appears
+          server->retry = steady_clock::time_point::max();
+          server->appeared.reset();
+        }
       }
-      oscsocket.reset();
-    } else {
-      // sleep and check for poll period timeout
-      using std::chrono::system_clock;
-      auto timeout = system_clock::now() + serverPollPeriod;
-      while (run.load() && system_clock::now() < timeout) {
-        std::this_thread::sleep_for(runPollPeriod);
+      if (!server->bridge && server->retry != steady_clock::time_point::max()) {
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+            server->retry - now);
+        int ms = static_cast<int>(wait.count()) + 1;
+        timeout = timeout < 0 ? ms : std::min(timeout, ms);
       }
     }
+    if (front == nullptr) {
+      for (auto &server : servers) {
+        if (server->bridge) {
+          attachFront(*server);
+          break;
+        }
+      }
+    }
+
+    for (auto &server : servers) {
+      if (server->bridge) {
+        int ms = server->bridge->publishProperties();
+        if (ms >= 0) {
+          timeout = timeout < 0 ? ms : std::min(timeout, ms);
+        }
+      }
+    }
+    if (publisher) {
+      int ms = publisher->publish();
+      if (ms >= 0) {
+        timeout = timeout < 0 ? ms : std::min(timeout, ms);
+      }
+    }
+    for (auto &p : periodic) {
+      int ms = p.poll();
+      timeout = timeout < 0 ? ms : std::min(timeout, ms);
+    }
+    loop.runOnce(timeout);
+  }
+
+  if (front != nullptr) {
+    detachFront();
+  }
+  for (auto &server : servers) {
+    if (server->bridge) {
+      loop.remove(server->bridge->eventFD());
+      server->bridge.reset();
+    }
   }
   return 0;
 }